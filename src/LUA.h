@@ -63,6 +63,12 @@ typedef const char * (*LUA_Reader) (LUA_State *L, void *ud, size_t *sz);
 
 typedef int (*LUA_Writer) (LUA_State *L, const void* p, size_t sz, void* ud);
 
+/*
+** function that releases the memory image of a chunk given to
+** 'LUA_loadimage'
+*/
+typedef void (*LUA_Unmap) (void *ud, void *p, size_t sz);
+
 
 /*
 ** prototype for memory-allocation functions
@@ -197,6 +203,8 @@ LUA_API void  (LUA_arith) (LUA_State *L, int op);
 
 LUA_API int   (LUA_rawequal) (LUA_State *L, int idx1, int idx2);
 LUA_API int   (LUA_compare) (LUA_State *L, int idx1, int idx2, int op);
+LUA_API void  (LUA_pushfop) (LUA_State *L, const char *op);
+LUA_API void  (LUA_bind) (LUA_State *L, int n);
 
 
 /*
@@ -261,6 +269,9 @@ LUA_API int   (LUA_pcallk) (LUA_State *L, int nargs, int nresults, int errfunc,
 LUA_API int   (LUA_load) (LUA_State *L, LUA_Reader reader, void *dt,
                                         const char *chunkname,
                                         const char *mode);
+LUA_API int   (LUA_loadimage) (LUA_State *L, void *p, size_t sz,
+                                             const char *chunkname,
+                                             LUA_Unmap unmap, void *ud);
 
 LUA_API int (LUA_dump) (LUA_State *L, LUA_Writer writer, void *data);
 
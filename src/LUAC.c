@@ -28,6 +28,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optimizing=0;		/* optimize bytecodes? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -55,6 +56,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file " LUA_QL("name") " (default is \"%s\")\n"
+  "  -O       optimize bytecodes\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -92,6 +94,8 @@ static int doargs(int argc, char* argv[])
     usage(LUA_QL("-o") " needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -166,6 +170,7 @@ static int pmain(LUA_State* L)
  const Proto* f;
  int i;
  if (!LUA_checkstack(L,argc)) fatal("too many input files");
+ G(L)->optimize=optimizing;
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
@@ -259,12 +264,16 @@ static void PrintConstant(const Proto* f, int i)
   case LUA_TBOOLEAN:
 	printf(bvalue(o) ? "true" : "false");
 	break;
-  case LUA_TNUMBER:
+  case LUA_TNUMFLT:
+  case LUA_TNUMINT:
 	printf(LUA_NUMBER_FMT,nvalue(o));
 	break;
   case LUA_TSTRING:
 	PrintString(rawtsvalue(o));
 	break;
+  case LUA_TTABLE:
+	printf("{...}");
+	break;
   default:				/* cannot happen */
 	printf("? type=%d",ttype(o));
 	break;
@@ -311,11 +320,14 @@ static void PrintCode(const Proto* f)
     printf("%d",MYK(ax));
     break;
   }
-  switch (o)
+  switch (GET_BASEOP(i))
   {
    case OP_LOADK:
     printf("\t; "); PrintConstant(f,bx);
     break;
+   case OP_NEWTABLEK:
+    if (bx!=MAXARG_Bx) { printf("\t; "); PrintConstant(f,bx); }
+    break;
    case OP_GETUPVAL:
    case OP_SETUPVAL:
     printf("\t; %s",UPVALNAME(b));
@@ -467,6 +467,72 @@
 
 
 
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch opcodes through a
+** table of label addresses (the "labels as values" extension of GCC
+** and Clang) instead of a 'switch', giving each opcode its own
+** indirect jump.
+** CHANGE it (define LUA_NOJUMPTABLE) if your compiler chokes on it.
+*/
+#if defined(__GNUC__) && !defined(LUA_ANSI) && !defined(LUA_NOJUMPTABLE)
+#define LUA_USE_JUMPTABLE
+#endif
+
+
+
+/*
+@@ LUA_USE_FUSEDOPS makes the compiler and the undumper fuse common
+** pairs of instructions into single opcodes (see 'LUAP_fuse').
+** CHANGE it (define LUA_NOFUSEDOPS) to run the code exactly as
+** generated, e.g. to debug the interpreter.
+*/
+#if !defined(LUA_NOFUSEDOPS)
+#define LUA_USE_FUSEDOPS
+#endif
+
+
+
+/*
+@@ LUA_USE_JIT turns on a baseline compiler from bytecode to x86-64
+** native code (see Ljit.c), used for prototypes that run often, and
+** a trace compiler for their hot numeric FOR loops.
+** CHANGE it (define it) if you are on an x86-64 POSIX system and want
+** to trade some memory for speed. It is off by default. The native code
+** assumes the usual 16-byte values, so it does not go with
+** LUA_NANTRICK64.
+*/
+#if defined(LUA_USE_JIT) && \
+    (!(defined(__x86_64__) && defined(LUA_USE_POSIX) && \
+       !defined(LUA_ANSI)) || defined(LUA_NANTRICK64))
+#undef LUA_USE_JIT
+#endif
+
+
+
+/*
+@@ LUA_USE_SWISSTABLE replaces the chained scatter hash part of tables
+** (see Ltable.c) with open addressing over groups of 16 slots, each
+** slot with a control byte holding 7 bits of its key's hash. A lookup
+** compares a whole group of control bytes at once (with SSE2 where the
+** compiler offers it) and only looks at the nodes whose bytes match.
+** CHANGE it (define it) if your programs keep inserting keys into and
+** removing keys from large tables. It is off by default.
+*/
+
+
+
+/*
+@@ LUA_USE_SHAPES gives tables whose non-array keys are all short
+** strings (records) a key layout shared with the tables that got the
+** same keys in the same order, and a dense vector of values in place
+** of a hash part (see Ltable.c). Field accesses with constant keys then
+** find their values at offsets cached in the instructions.
+** CHANGE it (define it) if your programs keep many small records.
+** It is off by default.
+*/
+
+
+
 /*
 ** Some tricks with doubles
 */
@@ -495,6 +561,14 @@
 ** are 32-bit values) with numbers represented as IEEE 754-2008 doubles
 ** with conventional endianess (12345678 or 87654321), in CPUs that do
 ** not produce signaling NaN values (all NaNs are quiet).
+**
+@@ LUA_NANTRICK64 packs all values into a single double on x86-64,
+** using the payload of negative NaN values for a tag and a 47-bit
+** pointer. It halves the size of stack slots, array parts and hash
+** nodes, but light userdata must be user-space addresses and numbers
+** lose their integer variant. It is off by default.
+** CHANGE it (define it) if your states are bound by memory rather
+** than by arithmetic.
 */
 
 /* Microsoft compiler on a Pentium (32 bit) ? */
@@ -533,6 +607,44 @@
 
 #endif							/* } */
 
+#if defined(LUA_NANTRICK64) && \
+    !(defined(__x86_64) && defined(LUA_NUMBER_DOUBLE) && !defined(LUA_ANSI))
+#undef LUA_NANTRICK64
+#endif
+
+
+
+/*
+@@ LUA_USE_INTEGERS gives numbers an integer variant (of type LUA_Integer)
+** next to the float one. Integral constants, lengths, values pushed with
+** LUA_pushinteger and integer arithmetic that neither overflows nor
+** yields -0 stay integers; everything else turns into a float. Scripts
+** only see the difference in exactness beyond 2^53.
+** CHANGE it (define LUA_NOINTEGERS) to keep all numbers as LUA_Number.
+** The integer variant does not fit in LUA_NANTRICK or LUA_NANTRICK64
+** values.
+*/
+#if !defined(LUA_NOINTEGERS) && !defined(LUA_NANTRICK) && \
+    !defined(LUA_NANTRICK64)
+#define LUA_USE_INTEGERS
+#endif
+
+
+/*
+@@ LUA_USE_PACKEDARRAYS keeps the array part of a table that holds only
+** numbers of one kind (all floats or all integers), without holes, as
+** bare values instead of TValues, which halves its size. Such arrays
+** are packed when appends grow them (see Ltable.c); storing anything
+** else into them unpacks them back. It has no effect with LUA_NANTRICK
+** or LUA_NANTRICK64, whose values are already that small.
+** CHANGE it (define it) if your states keep large arrays of numbers.
+** It is off by default.
+*/
+#if defined(LUA_USE_PACKEDARRAYS) && \
+    (defined(LUA_NANTRICK) || defined(LUA_NANTRICK64))
+#undef LUA_USE_PACKEDARRAYS
+#endif
+
 /* }================================================================== */
 
 
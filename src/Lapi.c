@@ -303,11 +303,7 @@ LUA_API void LUA_arith (LUA_State *L, int op) {
   }
   o1 = L->top - 2;
   o2 = L->top - 1;
-  if (ttisnumber(o1) && ttisnumber(o2)) {
-    setnvalue(o1, LUAO_arith(op, nvalue(o1), nvalue(o2)));
-  }
-  else
-    LUAV_arith(L, o1, o1, o2, cast(TMS, op - LUA_OPADD + TM_ADD));
+  LUAV_arith(L, o1, o1, o2, cast(TMS, op - LUA_OPADD + TM_ADD));
   L->top--;
   LUA_unlock(L);
 }
@@ -332,6 +328,72 @@ LUA_API int LUA_compare (LUA_State *L, int index1, int index2, int op) {
 }
 
 
+/*
+** operator functions (FOP); the VM runs those in 'LUAA_fops' inline
+** when their operands need no metamethods
+*/
+#define FOP_CLOSURE(NAME, CODE)static int fop_##NAME(LUA_State *L) {CODE return 1;}
+FOP_CLOSURE(add, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPADD);)
+FOP_CLOSURE(sub, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPSUB);)
+FOP_CLOSURE(mul, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPMUL);)
+FOP_CLOSURE(div, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPDIV);)
+FOP_CLOSURE(mod, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPMOD);)
+FOP_CLOSURE(pow, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_arith(L, LUA_OPPOW);)
+FOP_CLOSURE(unm, LUAV_quickenfop(L); LUA_settop(L, 1); LUA_arith(L, LUA_OPUNM);)
+FOP_CLOSURE(eq, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_pushboolean(L, LUA_compare(L, 1, 2, LUA_OPEQ));)
+FOP_CLOSURE(lt, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_pushboolean(L, LUA_compare(L, 1, 2, LUA_OPLT));)
+FOP_CLOSURE(gt, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_pushboolean(L, !LUA_compare(L, 1, 2, LUA_OPLE));)
+FOP_CLOSURE(or, LUA_settop(L, 2); if(LUA_toboolean(L, 1))LUA_pop(L, 1);)
+FOP_CLOSURE(and, LUA_settop(L, 2); if(!LUA_toboolean(L, 1))LUA_pop(L, 1);)
+FOP_CLOSURE(not, LUA_settop(L, 1); LUA_pushboolean(L, !LUA_toboolean(L, 1));)
+FOP_CLOSURE(len, int isnum; LUA_Integer n; LUA_settop(L, 1); LUA_len(L, 1);
+  n = LUA_tointegerx(L, -1, &isnum);
+  if (!isnum) LUAG_runerror(L, "object length is not a number");
+  LUA_pushnumber(L, (LUA_Number)n);)
+FOP_CLOSURE(cct, LUA_settop(L, 2); LUA_concat(L, 2);)
+FOP_CLOSURE(idx, LUAV_quickenfop(L); LUA_settop(L, 2); LUA_gettable(L, 1);)
+FOP_CLOSURE(self, LUA_settop(L, 2); LUA_gettable(L, 1); LUA_pushvalue(L, 1); LUA_gettable(L, 2);)
+FOP_CLOSURE(nop, UNUSED(L); return 0;)
+FOP_CLOSURE(id, return LUA_gettop(L);)
+FOP_CLOSURE(call, LUA_call(L, LUA_gettop(L)-1, LUA_MULTRET); return LUA_gettop(L);)
+FOP_CLOSURE(dup, int narg=LUA_gettop(L); int i; for(i=1; i<=narg; i++) LUA_pushvalue(L, i); return narg*2;)
+
+
+LUAI_DDEF const LUA_CFunction LUAA_fops[FOP_N] = {
+  fop_add, fop_sub, fop_mul, fop_div, fop_mod, fop_pow,
+  fop_unm, fop_idx, fop_eq, fop_lt, fop_gt
+};
+
+
+LUA_API void LUA_pushfop (LUA_State *L, const char *op) {
+  LUA_CFunction f;
+  switch (op[0]) {
+    case '+': f = fop_add; break;
+    case '-': f = fop_sub; break;
+    case '*': f = fop_mul; break;
+    case '/': f = fop_div; break;
+    case '%': f = fop_mod; break;
+    case '^': f = fop_pow; break;
+    case '_': f = fop_unm; break;
+    case '=': f = fop_eq; break;
+    case '<': f = fop_lt; break;
+    case '>': f = fop_gt; break;
+    case '|': f = fop_or; break;
+    case '&': f = fop_and; break;
+    case '!': f = fop_not; break;
+    case '#': f = fop_len; break;
+    case ';': f = fop_cct; break;
+    case '.': f = fop_idx; break;
+    case ':': f = fop_self; break;
+    case ' ': f = fop_id; break;
+    case '@': f = fop_call; break;
+    case '$': f = fop_dup; break;
+    default: f = fop_nop; break;
+  }
+  LUA_pushcfunction(L, f);
+}
+
+
 LUA_API LUA_Number LUA_tonumberx (LUA_State *L, int idx, int *isnum) {
   TValue n;
   const TValue *o = index2addr(L, idx);
@@ -349,7 +411,11 @@ LUA_API LUA_Number LUA_tonumberx (LUA_State *L, int idx, int *isnum) {
 LUA_API LUA_Integer LUA_tointegerx (LUA_State *L, int idx, int *isnum) {
   TValue n;
   const TValue *o = index2addr(L, idx);
-  if (tonumber(o, &n)) {
+  if (ttisinteger(o)) {  /* no conversion needed */
+    if (isnum) *isnum = 1;
+    return ivalue(o);
+  }
+  else if (tonumber(o, &n)) {
     LUA_Integer res;
     LUA_Number num = nvalue(o);
     LUA_number2integer(res, num);
@@ -366,7 +432,11 @@ LUA_API LUA_Integer LUA_tointegerx (LUA_State *L, int idx, int *isnum) {
 LUA_API LUA_Unsigned LUA_tounsignedx (LUA_State *L, int idx, int *isnum) {
   TValue n;
   const TValue *o = index2addr(L, idx);
-  if (tonumber(o, &n)) {
+  if (ttisinteger(o)) {  /* wraps around like 'LUA_number2unsigned' */
+    if (isnum) *isnum = 1;
+    return cast(LUA_Unsigned, ivalue(o));
+  }
+  else if (tonumber(o, &n)) {
     LUA_Unsigned res;
     LUA_Number num = nvalue(o);
     LUA_number2unsigned(res, num);
@@ -482,17 +552,21 @@ LUA_API void LUA_pushnumber (LUA_State *L, LUA_Number n) {
 
 LUA_API void LUA_pushinteger (LUA_State *L, LUA_Integer n) {
   LUA_lock(L);
-  setnvalue(L->top, cast_num(n));
+  setivalue(L->top, n);
   api_incr_top(L);
   LUA_unlock(L);
 }
 
 
 LUA_API void LUA_pushunsigned (LUA_State *L, LUA_Unsigned u) {
-  LUA_Number n;
   LUA_lock(L);
-  n = LUA_unsigned2number(u);
-  setnvalue(L->top, n);
+  if (u <= cast(LUA_Unsigned, MAX_LUAINTEGER)) {  /* fits in an integer? */
+    setivalue(L->top, cast(LUA_Integer, u));
+  }
+  else {
+    LUA_Number n = LUA_unsigned2number(u);
+    setnvalue(L->top, n);
+  }
   api_incr_top(L);
   LUA_unlock(L);
 }
@@ -574,6 +648,54 @@ LUA_API void LUA_pushcclosure (LUA_State *L, LUA_CFunction fn, int n) {
 }
 
 
+/*
+** A bound function is a C closure of 'LUAA_bound' whose first upvalue
+** is the function to call and whose other upvalues are the arguments
+** bound to it. 'LUAD_precall' splices those into the frame, so the
+** body below only runs when 'LUAA_bound' is called as a plain C function.
+*/
+int LUAA_bound (LUA_State *L) {
+  int n;
+  for (n = 1; !LUA_isnone(L, LUA_upvalueindex(n)); n++) {
+    LUA_pushvalue(L, LUA_upvalueindex(n));
+    LUA_insert(L, n);
+  }
+  LUA_call(L, LUA_gettop(L) - 1, LUA_MULTRET);
+  return LUA_gettop(L);
+}
+
+
+LUA_API void LUA_bind (LUA_State *L, int n) {
+  StkId f;
+  Closure *cl;
+  int nb = 0;  /* arguments already bound to 'f' */
+  int i;
+  LUA_lock(L);
+  api_checknelems(L, n + 1);
+  api_check(L, ttisfunction(L->top - n - 1), "function expected");
+  LUAC_checkGC(L);
+  f = L->top - n - 1;
+  if (ttisCclosure(f) && clCvalue(f)->f == LUAA_bound &&
+      clCvalue(f)->nupvalues + n <= MAXUPVAL)
+    nb = clCvalue(f)->nupvalues - 1;  /* collapse into a single closure */
+  api_check(L, 1 + nb + n <= MAXUPVAL, "too many arguments to bind");
+  cl = LUAF_newCclosure(L, 1 + nb + n);
+  cl->c.f = LUAA_bound;
+  if (nb > 0) {
+    for (i = 0; i <= nb; i++)
+      setobj2n(L, &cl->c.upvalue[i], &clCvalue(f)->upvalue[i]);
+  }
+  else
+    setobj2n(L, &cl->c.upvalue[0], f);
+  for (i = 0; i < n; i++)
+    setobj2n(L, &cl->c.upvalue[1 + nb + i], f + 1 + i);
+  L->top = f;
+  setclCvalue(L, L->top, cl);
+  api_incr_top(L);
+  LUA_unlock(L);
+}
+
+
 LUA_API void LUA_pushboolean (LUA_State *L, int b) {
   LUA_lock(L);
   setbvalue(L->top, (b != 0));  /* ensure that true is 1 */
@@ -773,6 +895,9 @@ LUA_API void LUA_rawset (LUA_State *L, int idx) {
   api_checknelems(L, 2);
   t = index2addr(L, idx);
   api_check(L, ttistable(t), "table expected");
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (!LUAH_setpacked(L, hvalue(t), L->top-2, L->top-1))
+#endif
   setobj2t(L, LUAH_set(L, hvalue(t), L->top-2), L->top-1);
   invalidateTMcache(hvalue(t));
   LUAC_barrierback(L, gcvalue(t), L->top-1);
@@ -783,10 +908,17 @@ LUA_API void LUA_rawset (LUA_State *L, int idx) {
 
 LUA_API void LUA_rawseti (LUA_State *L, int idx, int n) {
   StkId t;
+#if defined(LUA_USE_PACKEDARRAYS)
+  TValue k;
+#endif
   LUA_lock(L);
   api_checknelems(L, 1);
   t = index2addr(L, idx);
   api_check(L, ttistable(t), "table expected");
+#if defined(LUA_USE_PACKEDARRAYS)
+  setivalue(&k, n);
+  if (!LUAH_setpacked(L, hvalue(t), &k, L->top - 1))  /* appends pack */
+#endif
   LUAH_setint(L, hvalue(t), n, L->top - 1);
   LUAC_barrierback(L, gcvalue(t), L->top-1);
   L->top--;
@@ -970,6 +1102,19 @@ LUA_API int LUA_pcallk (LUA_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+static void setglobalenv (LUA_State *L) {
+  LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
+  if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+    /* get global table from registry */
+    Table *reg = hvalue(&G(L)->l_registry);
+    const TValue *gt = LUAH_getint(reg, LUA_RIDX_GLOBALS);
+    /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
+    setobj(L, f->upvals[0]->v, gt);
+    LUAC_barrier(L, f->upvals[0], gt);
+  }
+}
+
+
 LUA_API int LUA_load (LUA_State *L, LUA_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -977,18 +1122,53 @@ LUA_API int LUA_load (LUA_State *L, LUA_Reader reader, void *data,
   LUA_lock(L);
   if (!chunkname) chunkname = "?";
   LUAZ_init(L, &z, reader, data);
-  status = LUAD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) {  /* no errors? */
-    LClosure *f = clLvalue(L->top - 1);  /* get newly created function */
-    if (f->nupvalues == 1) {  /* does it have one upvalue? */
-      /* get global table from registry */
-      Table *reg = hvalue(&G(L)->l_registry);
-      const TValue *gt = LUAH_getint(reg, LUA_RIDX_GLOBALS);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v, gt);
-      LUAC_barrier(L, f->upvals[0], gt);
-    }
+  status = LUAD_protectedparser(L, &z, chunkname, mode, NULL);
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L);
+  LUA_unlock(L);
+  return status;
+}
+
+
+/* reader for 'LUA_loadimage': the whole image in one block */
+static const char *getimage (LUA_State *L, void *ud, size_t *size) {
+  Image **pimage = cast(Image **, ud);
+  Image *image = *pimage;
+  UNUSED(L);
+  if (image == NULL) return NULL;
+  *pimage = NULL;  /* only once */
+  *size = image->size;
+  return image->p;
+}
+
+
+/*
+** Load the precompiled chunk at 'p', which the state then owns: it may
+** change it, and keeps it (calling 'unmap' when done with it) for as
+** long as functions still use it in place. Code is used where it lies
+** when aligned, and nested functions are loaded only when their first
+** closure is created.
+*/
+LUA_API int LUA_loadimage (LUA_State *L, void *p, size_t size,
+                           const char *chunkname, LUA_Unmap unmap, void *ud) {
+  ZIO z;
+  int status;
+  Image *image, *reader;
+  LUA_lock(L);
+  if (!chunkname) chunkname = "?";
+  image = reader = LUAU_newimage(L, p, size, unmap, ud);
+  if (image == NULL) {  /* cannot even keep track of it? */
+    (*unmap)(ud, p, size);
+    setsvalue2s(L, L->top, G(L)->memerrmsg);
+    api_incr_top(L);
+    LUA_unlock(L);
+    return LUA_ERRMEM;
   }
+  LUAZ_init(L, &z, getimage, &reader);
+  status = LUAD_protectedparser(L, &z, chunkname, "b", image);
+  LUAU_unrefimage(L, image);  /* loader is done with it */
+  if (status == LUA_OK)  /* no errors? */
+    setglobalenv(L);
   LUA_unlock(L);
   return status;
 }
@@ -17,6 +17,17 @@
 #define adjustresults(L,nres) \
     { if ((nres) == LUA_MULTRET && L->ci->top < L->top) L->ci->top = L->top; }
 
+/* operator functions from 'LUA_pushfop' that the VM may run inline */
+enum FOPS {
+  FOP_ADD, FOP_SUB, FOP_MUL, FOP_DIV, FOP_MOD, FOP_POW,  /* ORDER TM */
+  FOP_UNM, FOP_IDX, FOP_EQ, FOP_LT, FOP_GT, FOP_N
+};
+
+LUAI_DDEC const LUA_CFunction LUAA_fops[FOP_N];
+
+/* function of the closures made by 'LUA_bind' */
+LUAI_FUNC int LUAA_bound (LUA_State *L);
+
 #define api_checknelems(L,n)	api_check(L, (n) < (L->top - L->ci->func), \
 				  "not enough elements in the stack")
 
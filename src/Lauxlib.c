@@ -22,6 +22,7 @@
 #include "LUA.h"
 
 #include "Lauxlib.h"
+#include "LUAlib.h"
 
 
 /*
@@ -627,8 +628,7 @@ static int skipcomment (LoadF *lf, int *cp) {
 }
 
 
-LUALIB_API int LUAL_loadfilex (LUA_State *L, const char *filename,
-                                             const char *mode) {
+static int loadfile (LUA_State *L, const char *filename, const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
@@ -663,6 +663,292 @@ LUALIB_API int LUAL_loadfilex (LUA_State *L, const char *filename,
 }
 
 
+/*
+** {======================================================
+** Compiled-chunk cache
+** When 'PACKAGE.CACHE' names a directory, 'LUAL_loadfilex' keeps there
+** the dump of each text chunk it compiles, and loads it instead of
+** parsing the file again while the file's name, its modification time
+** and its contents, as well as the load mode, stay the same. An entry
+** is that key, the length and hash of the dump, and the dump; it is
+** written under another name and then renamed, so that readers never
+** see it half done, and an entry that does not check out is compiled
+** over.
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static unsigned long l_mtime (const char *filename) {
+  struct stat st;
+  return (stat(filename, &st) == 0) ? (unsigned long)st.st_mtime : 0;
+}
+
+#define l_procid()	((unsigned long)getpid())
+
+#else
+
+#include <time.h>
+
+#define l_mtime(filename)	0UL  /* rely on the contents alone */
+#define l_procid()	((unsigned long)time(NULL) ^ (unsigned long)clock())
+
+#endif
+
+
+#define CACHESIG	"\033LUA cache 1\n"
+
+/* size of the line with the length and hash of the dump */
+#define CACHEDUMPLINE	18
+
+
+/* 32-bit FNV-1a hash of 'n' bytes at 's', continuing from 'h' */
+static unsigned long hashbytes (unsigned long h, const char *s, size_t n) {
+  for (; n > 0; n--, s++)
+    h = ((h ^ (unsigned char)*s) * 16777619UL) & 0xffffffffUL;
+  return h;
+}
+
+#define HASHSEED	2166136261UL
+
+
+typedef struct CacheW {
+  FILE *f;
+  unsigned long n;  /* length of the dump written so far */
+  unsigned long h;  /* its hash */
+} CacheW;
+
+
+static int writer (LUA_State *L, const void *b, size_t size, void *ud) {
+  CacheW *cw = (CacheW *)ud;
+  (void)L;  /* not used */
+  cw->n += size;
+  cw->h = hashbytes(cw->h, (const char *)b, size);
+  return (fwrite(b, 1, size, cw->f) != size);
+}
+
+
+/*
+** If there is a cache and 'filename' is a text file, push the name of
+** its entry and the key the entry must start with, and return 1.
+*/
+static int cachekey (LUA_State *L, const char *filename, const char *mode) {
+  char buff[LUAL_BUFFERSIZE];
+  char num[3 * 9 + 1];
+  unsigned long h = HASHSEED;
+  unsigned long size = 0;
+  size_t n;
+  const char *dir;
+  FILE *f;
+  LUA_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+  if (LUA_istable(L, -1))
+    LUA_getfield(L, -1, LUA_LOADLIBNAME);
+  else
+    LUA_pushnil(L);
+  if (LUA_istable(L, -1))
+    LUA_getfield(L, -1, "CACHE");
+  else
+    LUA_pushnil(L);
+  dir = LUA_tostring(L, -1);
+  if (dir == NULL || (f = fopen(filename, "rb")) == NULL) {
+    LUA_pop(L, 3);
+    return 0;  /* no cache (or leave the error to 'loadfile') */
+  }
+  while ((n = fread(buff, 1, sizeof(buff), f)) > 0) {
+    if (size == 0 && buff[0] == LUA_SIGNATURE[0]) break;  /* binary */
+    size += n;
+    h = hashbytes(h, buff, n);
+  }
+  if (ferror(f) || n > 0) {  /* read error or binary chunk? */
+    fclose(f);
+    LUA_pop(L, 3);
+    return 0;
+  }
+  fclose(f);
+  if (mode == NULL) mode = "bt";
+  snprintf(num, sizeof(num), "%08lx",
+           hashbytes(hashbytes(HASHSEED, mode, strlen(mode)),
+                     filename, strlen(filename)));
+  LUA_pushfstring(L, "%s" LUA_DIRSEP "%s", dir, num);
+  LUA_replace(L, -4);
+  LUA_pop(L, 2);
+  snprintf(num, sizeof(num), "%08lx %08lx %08lx",
+           l_mtime(filename) & 0xffffffffUL, size & 0xffffffffUL, h);
+  LUA_pushfstring(L, CACHESIG "%s\n%s\n%s\n", filename, mode, num);
+  return 1;
+}
+
+
+/*
+** Try to load the cache entry named at index -2, which must start with
+** the key at index -1; push the function and return 1 on success.
+*/
+static int loadcached (LUA_State *L, const char *filename) {
+  size_t lkey;
+  const char *key = LUA_tolstring(L, -1, &lkey);
+  FILE *f = fopen(LUA_tostring(L, -2), "rb");
+  const char *chunkname;
+  unsigned long n, h;
+  long size;
+  char *b;
+  int ok;
+  if (f == NULL) return 0;
+  if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 ||
+      (unsigned long)size < lkey + CACHEDUMPLINE || fseek(f, 0, SEEK_SET)) {
+    fclose(f);
+    return 0;
+  }
+  b = (char *)LUA_newuserdata(L, (size_t)size + 1);
+  ok = (fread(b, 1, (size_t)size, f) == (size_t)size);
+  fclose(f);
+  b[size] = '\0';
+  ok = ok && memcmp(b, key, lkey) == 0 &&
+       sscanf(b + lkey, "%8lx %8lx", &n, &h) == 2 &&
+       n == ((size - lkey - CACHEDUMPLINE) & 0xffffffffUL) &&
+       h == hashbytes(HASHSEED, b + lkey + CACHEDUMPLINE, (size_t)n);
+  if (!ok) {
+    LUA_pop(L, 1);  /* remove buffer */
+    return 0;
+  }
+  chunkname = LUA_pushfstring(L, "@%s", filename);
+  if (LUAL_loadbufferx(L, b + lkey + CACHEDUMPLINE, (size_t)n,
+                       chunkname, "b") != LUA_OK) {
+    LUA_pop(L, 3);  /* remove buffer, chunk name and error message */
+    return 0;
+  }
+  LUA_replace(L, -3);  /* function replaces buffer */
+  LUA_pop(L, 1);  /* remove chunk name */
+  return 1;
+}
+
+
+/*
+** Write the dump of the function at index -1 as the cache entry named
+** at index -3, with the key at index -2. Failures are silent: the file
+** is compiled again next time.
+*/
+static void storecached (LUA_State *L) {
+  size_t lkey;
+  const char *key = LUA_tolstring(L, -2, &lkey);
+  const char *name = LUA_tostring(L, -3);
+  char line[CACHEDUMPLINE + 1];
+  const char *tmp;
+  CacheW cw;
+  int ok;
+  sprintf(line, "%08lx", l_procid() & 0xffffffffUL);
+  tmp = LUA_pushfstring(L, "%s.%s", name, line);
+  cw.f = fopen(tmp, "wb");
+  if (cw.f == NULL) {
+    LUA_pop(L, 1);
+    return;
+  }
+  cw.n = 0; cw.h = HASHSEED;
+  sprintf(line, "%08lx %08lx\n", 0UL, 0UL);
+  ok = (fwrite(key, 1, lkey, cw.f) == lkey &&
+        fwrite(line, 1, CACHEDUMPLINE, cw.f) == CACHEDUMPLINE);
+  if (ok) {
+    LUA_pushvalue(L, -2);  /* function to be dumped */
+    ok = (LUA_dump(L, writer, &cw) == 0);
+    LUA_pop(L, 1);
+  }
+  if (ok) {  /* now the length and hash of the dump are known */
+    sprintf(line, "%08lx %08lx\n", cw.n & 0xffffffffUL, cw.h);
+    ok = (fseek(cw.f, (long)lkey, SEEK_SET) == 0 &&
+          fwrite(line, 1, CACHEDUMPLINE, cw.f) == CACHEDUMPLINE);
+  }
+  ok = (fclose(cw.f) == 0) && ok;
+  if (ok && rename(tmp, name) != 0) {  /* cannot replace old entry? */
+    remove(name);
+    ok = (rename(tmp, name) == 0);
+  }
+  if (!ok) remove(tmp);
+  LUA_pop(L, 1);  /* remove 'tmp' */
+}
+
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Mapped precompiled files
+** With mode 'm', a precompiled file is given to 'LUA_loadimage' as a
+** private mapping of it, so that its code stays where it is and its
+** functions are only loaded when first used.
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+static void unmapfile (void *ud, void *p, size_t size) {
+  (void)ud;  /* not used */
+  munmap(p, size);
+}
+
+
+/* returns -1 if 'filename' cannot be mapped or is not precompiled */
+static int loadmapped (LUA_State *L, const char *filename) {
+  struct stat st;
+  size_t size;
+  void *p;
+  int status;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+      (size = (size_t)st.st_size) != (unsigned long)st.st_size) {
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);  /* mapping stays */
+  if (p == MAP_FAILED) return -1;
+  if (*(char *)p != LUA_SIGNATURE[0]) {  /* text file? */
+    munmap(p, size);
+    return -1;
+  }
+  status = LUA_loadimage(L, p, size, LUA_pushfstring(L, "@%s", filename),
+                         unmapfile, NULL);
+  LUA_remove(L, -2);  /* remove chunk name */
+  return status;
+}
+
+#else
+
+#define loadmapped(L,filename)	(-1)
+
+#endif
+
+/* }====================================================== */
+
+
+LUALIB_API int LUAL_loadfilex (LUA_State *L, const char *filename,
+                                             const char *mode) {
+  int status;
+  if (filename != NULL && mode != NULL && strchr(mode, 'm') != NULL &&
+      strchr(mode, 'b') != NULL && (status = loadmapped(L, filename)) >= 0)
+    return status;
+  if (filename == NULL || !cachekey(L, filename, mode))
+    return loadfile(L, filename, mode);
+  if (loadcached(L, filename))
+    status = LUA_OK;
+  else {
+    status = loadfile(L, filename, mode);
+    if (status == LUA_OK)
+      storecached(L);
+  }
+  LUA_replace(L, -3);  /* result replaces entry name */
+  LUA_pop(L, 1);  /* remove key */
+  return status;
+}
+
+
 typedef struct LoadS {
   const char *s;
   size_t size;
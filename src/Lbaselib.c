@@ -421,6 +421,9 @@ static int LUAB_tostring (LUA_State *L) {
 */
 
 
+static int aux_func_mod_cont (LUA_State *L);
+
+
 static int aux_func_add_closure(LUA_State *L) {
   int narg = LUA_gettop(L);
   int s=LUA_tonumber(L, LUA_upvalueindex(2));
@@ -484,45 +487,75 @@ static int aux_func_sub(LUA_State *L) {
 }
 
 
-static int aux_func_mod_closure(LUA_State *L) {
-  int narg = LUA_gettop(L);
-  int i;
-  LUA_pushvalue(L, LUA_upvalueindex(1));
-  for (i=1; i<=narg; i++)
-    LUA_pushvalue(L, i);
-  LUA_call(L, narg, LUA_MULTRET);
-  int nres = LUA_gettop(L)-narg;
-  LUA_pushvalue(L, LUA_upvalueindex(2));
-  for (i=1; i<=nres; i++)
-    LUA_pushvalue(L, i+narg);
-  LUA_call(L, nres, LUA_MULTRET);
-  return LUA_gettop(L)-narg-nres;
+/*
+** A composition 'f % g % ...' is a single C closure whose upvalues are
+** its stages, in the order they are applied. Each stage is called with
+** the results of the previous one left in place on the stack, and with
+** a continuation, so that a stage may yield.
+*/
+
+#define MAXSTAGES	255	/* maximum number of upvalues of a C closure */
+
+
+static int aux_func_mod_stages (LUA_State *L, int stage) {
+  for (; !LUA_isnone(L, LUA_upvalueindex(stage)); stage++) {
+    LUAL_checkstack(L, 1, "too many results");  /* (a stage may fill it) */
+    LUA_pushvalue(L, LUA_upvalueindex(stage));
+    LUA_insert(L, 1);
+    LUA_callk(L, LUA_gettop(L) - 1, LUA_MULTRET, stage + 1, aux_func_mod_cont);
+  }
+  return LUA_gettop(L);
+}
+
+
+static int aux_func_mod_cont (LUA_State *L) {
+  int stage = 0;
+  LUA_getctx(L, &stage);
+  return aux_func_mod_stages(L, stage);
+}
+
+
+static int aux_func_mod_closure (LUA_State *L) {
+  return aux_func_mod_stages(L, 1);
+}
+
+
+/* push the stages of function 'idx' and return their number */
+static int aux_func_pushstages (LUA_State *L, int idx) {
+  int n = 0;
+  if (LUA_tocfunction(L, idx) == aux_func_mod_closure) {
+    while (LUA_getupvalue(L, idx, n + 1) != NULL)
+      n++;
+  }
+  else {
+    LUA_pushvalue(L, idx);
+    n = 1;
+  }
+  return n;
 }
 
 
 static int aux_func_mod(LUA_State *L) {
+  int n;
   LUAL_checktype(L, 1, LUA_TFUNCTION);
   LUAL_checktype(L, 2, LUA_TFUNCTION);
-  LUA_pushcclosure(L, aux_func_mod_closure, 2);
+  LUA_settop(L, 2);
+  LUAL_checkstack(L, 2 * MAXSTAGES, "too many stages");
+  n = aux_func_pushstages(L, 1);
+  n += aux_func_pushstages(L, 2);
+  if (n > MAXSTAGES) {  /* too long? compose the two as they are */
+    LUA_settop(L, 2);
+    n = 2;
+  }
+  LUA_pushcclosure(L, aux_func_mod_closure, n);
   return 1;
 }
 
 
-static int aux_func_index_closure(LUA_State *L) {
-  int narg = LUA_gettop(L);
-  int i;
-  LUA_pushvalue(L, LUA_upvalueindex(1));
-  LUA_pushvalue(L, LUA_upvalueindex(2));
-  for (i=1; i<=narg; i++)
-    LUA_pushvalue(L, i);
-  LUA_call(L, narg+1, LUA_MULTRET);
-  return LUA_gettop(L)-narg;
-}
-
-
 static int aux_func_index(LUA_State *L) {
   LUAL_checktype(L, 1, LUA_TFUNCTION);
-  LUA_pushcclosure(L, aux_func_index_closure, 2);
+  LUA_settop(L, 2);
+  LUA_bind(L, 1);
   return 1;
 }
 
@@ -547,58 +580,8 @@ static void aux_funcmeta(LUA_State *L) {
   LUA_pop(L, 1);
 }
 
-#define FOP_CLOSURE(NAME, CODE)static int aux_fop_##NAME(LUA_State *L) {CODE return 1;}
-FOP_CLOSURE(add, LUA_settop(L, 2); LUA_arith(L, LUA_OPADD);)
-FOP_CLOSURE(sub, LUA_settop(L, 2); LUA_arith(L, LUA_OPSUB);)
-FOP_CLOSURE(mul, LUA_settop(L, 2); LUA_arith(L, LUA_OPMUL);)
-FOP_CLOSURE(div, LUA_settop(L, 2); LUA_arith(L, LUA_OPDIV);)
-FOP_CLOSURE(mod, LUA_settop(L, 2); LUA_arith(L, LUA_OPMOD);)
-FOP_CLOSURE(pow, LUA_settop(L, 2); LUA_arith(L, LUA_OPPOW);)
-FOP_CLOSURE(unm, LUA_settop(L, 1); LUA_arith(L, LUA_OPUNM);)
-FOP_CLOSURE(eq, LUA_settop(L, 2); LUA_pushboolean(L, LUA_compare(L, 1, 2, LUA_OPEQ));)
-FOP_CLOSURE(lt, LUA_settop(L, 2); LUA_pushboolean(L, LUA_compare(L, 1, 2, LUA_OPLT));)
-FOP_CLOSURE(gt, LUA_settop(L, 2); LUA_pushboolean(L, !LUA_compare(L, 1, 2, LUA_OPLE));)
-FOP_CLOSURE(or, LUA_settop(L, 2); if(LUA_toboolean(L, 1))LUA_pop(L, 1);)
-FOP_CLOSURE(and, LUA_settop(L, 2); if(!LUA_toboolean(L, 1))LUA_pop(L, 1);)
-FOP_CLOSURE(not, LUA_settop(L, 1); LUA_pushboolean(L, !LUA_toboolean(L, 1));)
-FOP_CLOSURE(len, LUA_settop(L, 1); LUA_pushnumber(L, LUAL_len(L, 1));)
-FOP_CLOSURE(cct, LUA_settop(L, 2); LUA_concat(L, 2);)
-FOP_CLOSURE(idx, LUA_settop(L, 2); LUA_gettable(L, 1);)
-FOP_CLOSURE(self, LUA_settop(L, 2); LUA_gettable(L, 1); LUA_pushvalue(L, 1); LUA_gettable(L, 2);)
-FOP_CLOSURE(nop, return 0;)
-FOP_CLOSURE(id, return LUA_gettop(L);)
-FOP_CLOSURE(call, LUA_call(L, LUA_gettop(L)-1, LUA_MULTRET); return LUA_gettop(L);)
-FOP_CLOSURE(dup, int narg=LUA_gettop(L); int i; for(i=1; i<=narg; i++) LUA_pushvalue(L, i); return narg*2;)
-
 static int LUAB_fop(LUA_State *L) {
-  if(LUA_isnoneornil(L, 1)) {
-      LUA_pushcfunction(L, aux_fop_nop);
-  }
-  else {
-    switch(LUAL_optstring(L, 1, "")[0]) {
-      case '+': LUA_pushcfunction(L, aux_fop_add); break;
-      case '-': LUA_pushcfunction(L, aux_fop_sub); break;
-      case '*': LUA_pushcfunction(L, aux_fop_mul); break;
-      case '/': LUA_pushcfunction(L, aux_fop_div); break;
-      case '%': LUA_pushcfunction(L, aux_fop_mod); break;
-      case '^': LUA_pushcfunction(L, aux_fop_pow); break;
-      case '_': LUA_pushcfunction(L, aux_fop_unm); break;
-      case '=': LUA_pushcfunction(L, aux_fop_eq); break;
-      case '<': LUA_pushcfunction(L, aux_fop_lt); break;
-      case '>': LUA_pushcfunction(L, aux_fop_gt); break;
-      case '|': LUA_pushcfunction(L, aux_fop_or); break;
-      case '&': LUA_pushcfunction(L, aux_fop_and); break;
-      case '!': LUA_pushcfunction(L, aux_fop_not); break;
-      case '#': LUA_pushcfunction(L, aux_fop_len); break;
-      case ';': LUA_pushcfunction(L, aux_fop_cct); break;
-      case '.': LUA_pushcfunction(L, aux_fop_idx); break;
-      case ':': LUA_pushcfunction(L, aux_fop_self); break;
-      case ' ': LUA_pushcfunction(L, aux_fop_id); break;
-      case '@': LUA_pushcfunction(L, aux_fop_call); break;
-      case '$': LUA_pushcfunction(L, aux_fop_dup); break;
-      default: LUA_pushcfunction(L, aux_fop_nop); break;
-    }
-  }
+  LUA_pushfop(L, LUAL_optstring(L, 1, ""));
   return 1;
 }
 
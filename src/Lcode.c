@@ -6,6 +6,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 
 #define lcode_c
 #define LUA_CORE
@@ -288,31 +289,39 @@ static void freeexp (FuncState *fs, expdesc *e) {
 }
 
 
+/* append constant 'v' to the function, without looking for a copy */
+static int appendk (FuncState *fs, TValue *v) {
+  LUA_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int oldsize = f->sizek;
+  int k = fs->nk;
+  LUAM_growvector(L, f->k, k, f->sizek, TValue, MAXARG_Ax, "constants");
+  while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
+  setobj(L, &f->k[k], v);
+  fs->nk++;
+  LUAC_barrier(L, f, v);
+  return k;
+}
+
+
 static int addk (FuncState *fs, TValue *key, TValue *v) {
   LUA_State *L = fs->ls->L;
   TValue *idx = LUAH_set(L, fs->h, key);
   Proto *f = fs->f;
-  int k, oldsize;
+  int k;
   if (ttisnumber(idx)) {
     LUA_Number n = nvalue(idx);
     LUA_number2int(k, n);
-    if (LUAV_rawequalobj(&f->k[k], v))
-      return k;
+    if (k < fs->nk && LUAV_rawequalobj(&f->k[k], v))
+      return k;  /* (entries from 'nk' on were dropped; see 'tabletemplate') */
     /* else may be a collision (e.g., between 0.0 and "\0\0\0\0\0\0\0\0");
        go through and create a new entry for this value */
   }
   /* constant not found; create a new entry */
-  oldsize = f->sizek;
-  k = fs->nk;
   /* numerical value does not need GC barrier;
      table has no metatable, so it does not need to invalidate cache */
-  setnvalue(idx, cast_num(k));
-  LUAM_growvector(L, f->k, k, f->sizek, TValue, MAXARG_Ax, "constants");
-  while (oldsize < f->sizek) setnilvalue(&f->k[oldsize++]);
-  setobj(L, &f->k[k], v);
-  fs->nk++;
-  LUAC_barrier(L, f, v);
-  return k;
+  setnvalue(idx, cast_num(fs->nk));
+  return appendk(fs, v);
 }
 
 
@@ -327,7 +336,7 @@ int LUAK_numberK (FuncState *fs, LUA_Number r) {
   int n;
   LUA_State *L = fs->ls->L;
   TValue o;
-  setnvalue(&o, r);
+  LUAO_setnumber(&o, r);
   if (r == 0 || LUAi_numisnan(NULL, r)) {  /* handle -0 and NaN */
     /* use raw representation as key to avoid numeric problems */
     setsvalue(L, L->top++, LUAS_newlstr(L, (char *)&r, sizeof(r)));
@@ -710,12 +719,27 @@ void LUAK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
+static int foldnum (OpCode op, LUA_Number v1, LUA_Number v2, LUA_Number *r) {
+#if defined(LUA_USE_INTEGERS)
+  LUA_Integer i1, i2, ir;
+#endif
+  if ((op == OP_DIV || op == OP_MOD) && v2 == 0)
+    return 0;  /* do not attempt to divide by 0 */
+  *r = LUAO_arith(op - OP_ADD + LUA_OPADD, v1, v2);
+#if defined(LUA_USE_INTEGERS)
+  if (LUAO_num2int(v1, &i1) && LUAO_num2int(v2, &i2) &&
+      LUAO_intarith(op - OP_ADD + LUA_OPADD, i1, i2, &ir) &&
+      !(LUAO_num2int(*r, &i1) && i1 == ir))
+    return 0;  /* integer result is not exact as a float; compute it later */
+#endif
+  return 1;
+}
+
+
 static int constfolding (OpCode op, expdesc *e1, expdesc *e2) {
   LUA_Number r;
   if (!isnumeral(e1) || !isnumeral(e2)) return 0;
-  if ((op == OP_DIV || op == OP_MOD) && e2->u.nval == 0)
-    return 0;  /* do not attempt to divide by 0 */
-  r = LUAO_arith(op - OP_ADD + LUA_OPADD, e1->u.nval, e2->u.nval);
+  if (!foldnum(op, e1->u.nval, e2->u.nval, &r)) return 0;
   e1->u.nval = r;
   return 1;
 }
@@ -879,3 +903,1087 @@ void LUAK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+/*
+** maximum number of slots (array and hash, nested templates included)
+** in a constructor template; larger constructors are usually data run
+** once, for which a template would only double the work and memory
+*/
+#if !defined(LUAI_MAXTEMPLATE)
+#define LUAI_MAXTEMPLATE	128
+#endif
+
+
+/* number of slots in template 'h', or more than 'limit' */
+static int templatesize (Table *h, int limit) {
+  int n = h->sizearray + nfields(h) + sizenode(h);
+  int i;
+  for (i = 0; i < h->sizearray && n <= limit; i++) {
+    if (ttistable(&h->array[i]))
+      n += templatesize(hvalue(&h->array[i]), limit - n);
+  }
+#if defined(LUA_USE_SHAPES)
+  for (i = 0; i < nfields(h) && n <= limit; i++) {
+    if (ttistable(&h->fields[i]))
+      n += templatesize(hvalue(&h->fields[i]), limit - n);
+  }
+#endif
+  for (i = 0; i < sizenode(h) && n <= limit; i++) {
+    if (ttistable(gval(gnode(h, i))))
+      n += templatesize(hvalue(gval(gnode(h, i))), limit - n);
+  }
+  return n;
+}
+
+
+/* argument of the EXTRAARG after instruction 'pc', which is skipped */
+static int extraarg (Proto *f, int *pc) {
+  LUA_assert(GET_OPCODE(f->code[*pc + 1]) == OP_EXTRAARG);
+  return GETARG_Ax(f->code[++*pc]);
+}
+
+
+/* value of RK operand 'x' in 'runconstructor', or NULL if unknown */
+static const TValue *operand (Proto *f, TValue *reg, int t, int x) {
+  if (ISK(x)) return &f->k[INDEXK(x)];
+  x -= t + 1;
+  return (0 <= x && x < LFIELDS_PER_FLUSH) ? &reg[x] : NULL;
+}
+
+
+/*
+** Run the code of a constructor that loads and stores only constants
+** (from its NEWTABLE at 'pc' to the end) over a template table, as the
+** VM would; return 0 if it does anything else.
+*/
+static int runconstructor (FuncState *fs, int pc, Table *h) {
+  LUA_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int t = GETARG_A(f->code[pc]);
+  TValue reg[LFIELDS_PER_FLUSH];  /* registers t+1, t+2, ... */
+  int n;
+  for (n = 0; n < LFIELDS_PER_FLUSH; n++) setnilvalue(&reg[n]);
+  for (pc++; pc < fs->pc; pc++) {
+    Instruction i = f->code[pc];
+    int a = GETARG_A(i) - (t + 1);
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    if (GET_OPCODE(i) == OP_SETTABLE || GET_OPCODE(i) == OP_SETLIST) {
+      if (a != -1) return 0;
+    }
+    else if (a < 0 || a >= LFIELDS_PER_FLUSH) return 0;
+    switch (GET_OPCODE(i)) {
+      case OP_LOADK: case OP_LOADKX: case OP_NEWTABLEK: {
+        int k = GETARG_Bx(i);
+        if (GET_OPCODE(i) == OP_LOADKX ||
+            (GET_OPCODE(i) == OP_NEWTABLEK && k == MAXARG_Bx))
+          k = extraarg(f, &pc);
+        setobj(L, &reg[a], &f->k[k]);
+        break;
+      }
+      case OP_LOADBOOL: {
+        if (c != 0) return 0;
+        setbvalue(&reg[a], b);
+        break;
+      }
+      case OP_LOADNIL: {
+        if (a + b >= LFIELDS_PER_FLUSH) return 0;
+        for (n = a; n <= a + b; n++) setnilvalue(&reg[n]);
+        break;
+      }
+      case OP_SETLIST: {
+        int last;
+        if (b == 0) return 0;  /* multiple results */
+        if (c == 0) c = extraarg(f, &pc);
+        last = ((c-1)*LFIELDS_PER_FLUSH) + b - 2;
+        if (last + 2 > h->sizearray)
+          LUAH_resizearray(L, h, last + 2);
+        for (n = 0; n < b; n++) {
+          setobj2t(L, &h->array[last - b + n + 2], &reg[n]);
+          LUAC_barrierback(L, obj2gco(h), &reg[n]);
+        }
+        break;
+      }
+      case OP_SETTABLE: {
+        const TValue *key = operand(f, reg, t, b);
+        const TValue *val = operand(f, reg, t, c);
+        if (key == NULL || val == NULL) return 0;
+        if (ttisnil(key) || (ttisnumber(key) &&
+                             LUAi_numisnan(L, nvalue(key))))
+          return 0;  /* leave the error to run time */
+        if (ttistable(key))
+          return 0;  /* copies would share it (see 'LUAH_copy') */
+        setobj2t(L, LUAH_set(L, h, key), val);
+        LUAC_barrierback(L, obj2gco(h), val);
+        break;
+      }
+      default: return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* drop constants from index 'nk' on, clearing their entries in 'fs->h' */
+static void dropk (FuncState *fs, int nk) {
+  Proto *f = fs->f;
+  while (fs->nk > nk) {
+    const TValue *k = &f->k[--fs->nk];
+    if (!ttisnil(k)) {
+      TValue *idx = cast(TValue *, LUAH_get(fs->h, k));
+      if (ttisnumber(idx) && nvalue(idx) == cast_num(fs->nk))
+        setnilvalue(idx);
+    }
+  }
+}
+
+
+/*
+** Replace the code of a constructor (from its NEWTABLE at 'pc' to the
+** end) by a single NEWTABLEK that copies a prebuilt template, when it
+** stores only constants. Constants from index 'nk' on were added for
+** this code alone and are dropped; templates of nested constructors
+** become values of the enclosing template.
+*/
+void LUAK_tabletemplate (FuncState *fs, int pc, int nk) {
+  LUA_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  Instruction i = f->code[pc];
+  int t = GETARG_A(i);
+  Table *h;
+  int k;
+  int na = LUAO_fb2int(GETARG_B(i));
+  int nh = LUAO_fb2int(GETARG_C(i));
+  if (fs->pc == pc + 1 || fs->jpc != NO_JUMP || fs->lasttarget > pc)
+    return;  /* empty constructor or pending jumps */
+  if (na + nh > LUAI_MAXTEMPLATE)
+    return;  /* too large to be worth a template */
+  h = LUAH_new(L);
+  sethvalue(L, L->top, h);  /* anchor template */
+  incr_top(L);
+  LUAH_resize(L, h, na, nh);
+  if (runconstructor(fs, pc, h) &&
+      templatesize(h, LUAI_MAXTEMPLATE) <= LUAI_MAXTEMPLATE) {
+    dropk(fs, nk);
+    k = appendk(fs, L->top - 1);  /* templates are never shared */
+    fs->pc = pc + 1;
+    if (k < MAXARG_Bx)
+      f->code[pc] = CREATE_ABx(OP_NEWTABLEK, t, k);
+    else {
+      f->code[pc] = CREATE_ABx(OP_NEWTABLEK, t, MAXARG_Bx);
+      codeextraarg(fs, k);
+    }
+  }
+  L->top--;
+}
+
+
+
+/*
+** {======================================================
+** Bytecode optimizer
+** Runs over a finished function (before 'close_func' shrinks its
+** arrays) when 'G(L)->optimize' is set. Removed instructions behave as
+** no-ops until 'compact' drops them, so a jump to one of them lands on
+** the next instruction that is kept.
+** =======================================================
+*/
+
+/* instruction flags */
+#define OPT_TARGET	1	/* instruction is a jump target */
+#define OPT_KEEP	2	/* instruction cannot be removed or moved */
+#define OPT_LIVE	4	/* instruction is reachable */
+#define OPT_DEAD	8	/* instruction will be removed */
+
+
+static int jumpdest (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP:
+      return pc + 1 + GETARG_sBx(i);
+    default: return -1;  /* not a jump */
+  }
+}
+
+
+/* check whether instruction uses (and so needs in place) the next one */
+static int usesnext (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_LOADBOOL: return (GETARG_C(i) != 0);
+    case OP_SETLIST: return (GETARG_C(i) == 0);
+    case OP_NEWTABLEK: return (GETARG_Bx(i) == MAXARG_Bx);
+    case OP_LOADKX: case OP_TFORCALL: return 1;
+    default: return (testTMode(GET_OPCODE(i)) != 0);
+  }
+}
+
+
+static void marktargets (FuncState *fs, lu_byte *fl) {
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  int pc;
+  for (pc = 0; pc < n; pc++)
+    fl[pc] &= ~(OPT_TARGET | OPT_KEEP);
+  for (pc = 0; pc < n; pc++) {
+    int d = jumpdest(code[pc], pc);
+    if (d >= 0) fl[d] |= OPT_TARGET;
+    if (usesnext(code[pc])) {
+      fl[pc + 1] |= OPT_KEEP;
+      if (pc + 2 < n) fl[pc + 2] |= OPT_TARGET;  /* skip destination */
+    }
+  }
+}
+
+
+/*
+** registers captured as upvalues by nested functions can change behind
+** the back of this function (and be read by it); leave them alone
+*/
+static void markcaptured (FuncState *fs, lu_byte *capt) {
+  Proto *f = fs->f;
+  int i, j;
+  for (i = 0; i < f->maxstacksize; i++) capt[i] = 0;
+  for (i = 0; i < fs->np; i++) {
+    Proto *p = f->p[i];
+    for (j = 0; j < p->sizeupvalues; j++)
+      if (p->upvalues[j].instack) capt[p->upvalues[j].idx] = 1;
+  }
+}
+
+
+/* numeric constant held by RK operand 'x', or -1 */
+static int numoperand (FuncState *fs, const int *kreg, int x) {
+  int k = ISK(x) ? INDEXK(x) : kreg[x];
+  return (k >= 0 && ttisnumber(&fs->f->k[k])) ? k : -1;
+}
+
+
+/*
+** Propagate constants loaded into registers along each basic block and
+** fold arithmetic over them into plain loads.
+*/
+static void foldconstants (FuncState *fs, lu_byte *fl, const lu_byte *capt,
+                           int *kreg) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int pc, r;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int a = GETARG_A(i);
+    if (pc == 0 || (fl[pc] & OPT_TARGET))  /* new basic block? */
+      for (r = 0; r < f->maxstacksize; r++) kreg[r] = -1;
+    switch (op) {
+      case OP_LOADK: {
+        kreg[a] = capt[a] ? -1 : GETARG_Bx(i);
+        break;
+      }
+      case OP_MOVE: {
+        kreg[a] = capt[a] ? -1 : kreg[GETARG_B(i)];
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL:
+      case OP_DIV: case OP_MOD: case OP_POW: case OP_UNM: {
+        int k1 = numoperand(fs, kreg, GETARG_B(i));
+        int k2 = (op == OP_UNM) ? k1 : numoperand(fs, kreg, GETARG_C(i));
+        LUA_Number v;
+        kreg[a] = -1;
+        if (k1 >= 0 && k2 >= 0 && !capt[a] &&
+            foldnum(op, nvalue(&f->k[k1]),
+                    (op == OP_UNM) ? 0 : nvalue(&f->k[k2]), &v)) {
+          int k = LUAK_numberK(fs, v);
+          if (k <= MAXARG_Bx) {
+            f->code[pc] = CREATE_ABx(OP_LOADK, a, k);
+            kreg[a] = k;
+          }
+        }
+        break;
+      }
+      case OP_LOADNIL: case OP_SELF: case OP_CALL: case OP_VARARG:
+      case OP_TFORCALL: case OP_TFORLOOP: case OP_FORLOOP: case OP_FORPREP: {
+        for (r = a; r < f->maxstacksize; r++) kreg[r] = -1;
+        break;
+      }
+      default: {
+        if (testAMode(op)) kreg[a] = -1;
+        break;
+      }
+    }
+  }
+}
+
+
+/* register set by instruction without side effects, or -1 */
+static int purestore (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL:
+      return GETARG_A(i);
+    case OP_LOADBOOL:
+      return (GETARG_C(i) == 0) ? GETARG_A(i) : -1;
+    case OP_LOADNIL:
+      return (GETARG_B(i) == 0) ? GETARG_A(i) : -1;
+    default: return -1;
+  }
+}
+
+
+/* check whether instruction sets register 'reg' without reading it */
+static int overwrites (Instruction i, int reg) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADNIL:
+      return (a <= reg && reg <= a + GETARG_B(i));
+    case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+    case OP_GETUPVAL: case OP_NEWTABLE: case OP_NEWTABLEK:
+      return (a == reg);
+    case OP_MOVE: case OP_UNM: case OP_NOT: case OP_LEN:
+      return (a == reg && GETARG_B(i) != reg);
+    case OP_GETTABUP:
+      return (a == reg && GETARG_C(i) != reg);
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL:
+    case OP_DIV: case OP_MOD: case OP_POW:
+      return (a == reg && GETARG_B(i) != reg && GETARG_C(i) != reg);
+    default: return 0;
+  }
+}
+
+
+/* remove stores overwritten by the next instruction and useless moves */
+static void removestores (FuncState *fs, lu_byte *fl, const lu_byte *capt) {
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  int pc;
+  for (pc = 0; pc + 1 < n; pc++) {
+    Instruction i = code[pc];
+    int r = purestore(i);
+    if (r < 0 || (fl[pc] & (OPT_KEEP | OPT_DEAD))) continue;
+    if (GET_OPCODE(i) == OP_MOVE && GETARG_B(i) == r)
+      fl[pc] |= OPT_DEAD;  /* MOVE A A */
+    else if (!capt[r] && overwrites(code[pc + 1], r))
+      fl[pc] |= OPT_DEAD;
+    else if (GET_OPCODE(i) == OP_MOVE && !(fl[pc + 1] & OPT_TARGET) &&
+             GET_OPCODE(code[pc + 1]) == OP_MOVE &&
+             GETARG_A(code[pc + 1]) == GETARG_B(i) &&
+             GETARG_B(code[pc + 1]) == r && !(fl[pc + 1] & OPT_KEEP))
+      fl[pc + 1] |= OPT_DEAD;  /* MOVE A B; MOVE B A */
+  }
+}
+
+
+/* first instruction at or after 'pc' that is not removed */
+static int skipdead (const lu_byte *fl, int n, int pc) {
+  while (pc < n && (fl[pc] & OPT_DEAD)) pc++;
+  return pc;
+}
+
+
+/*
+** Thread chains of jumps, turn jumps into returns they lead to, and
+** remove jumps to the next instruction.
+*/
+static void threadjumps (FuncState *fs, lu_byte *fl, const lu_byte *capt) {
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  int pc, r;
+  for (pc = 0; pc < n; pc++) {  /* drop closes with no upvalue to close */
+    if (GET_OPCODE(code[pc]) == OP_JMP && GETARG_A(code[pc]) != 0) {
+      for (r = GETARG_A(code[pc]) - 1; r < fs->f->maxstacksize; r++)
+        if (capt[r]) break;
+      if (r == fs->f->maxstacksize) SETARG_A(code[pc], 0);
+    }
+  }
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = code[pc];
+    int a, d, count;
+    if (GET_OPCODE(i) != OP_JMP || (fl[pc] & OPT_DEAD)) continue;
+    a = GETARG_A(i);
+    d = skipdead(fl, n, jumpdest(i, pc));
+    for (count = 0; count < n && d < n; count++) {  /* 'count' stops cycles */
+      Instruction j = code[d];
+      if (GET_OPCODE(j) != OP_JMP || d == pc) break;
+      if (a != 0 && GETARG_A(j) != 0 && GETARG_A(j) != a) break;
+      if (a == 0) a = GETARG_A(j);  /* close upvalues as the target would */
+      d = skipdead(fl, n, jumpdest(j, d));
+    }
+    if (d >= n) continue;  /* should not happen */
+    if (!(fl[pc] & OPT_KEEP) && GET_OPCODE(code[d]) == OP_RETURN)
+      code[pc] = code[d];  /* a return closes all upvalues anyway */
+    else {
+      SETARG_A(code[pc], a);
+      SETARG_sBx(code[pc], d - (pc + 1));
+    }
+  }
+}
+
+
+/* remove jumps to the next instruction that is kept */
+static void removenopjumps (FuncState *fs, lu_byte *fl) {
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  int pc;
+  for (pc = n - 1; pc >= 0; pc--) {  /* backwards, to remove chains */
+    Instruction i = code[pc];
+    if (GET_OPCODE(i) == OP_JMP && GETARG_A(i) == 0 &&
+        !(fl[pc] & (OPT_KEEP | OPT_DEAD)) &&
+        skipdead(fl, n, jumpdest(i, pc)) == skipdead(fl, n, pc + 1))
+      fl[pc] |= OPT_DEAD;
+  }
+}
+
+
+/* mark as removed all instructions that cannot be reached */
+static void removeunreachable (FuncState *fs, lu_byte *fl, int *stack) {
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  int top = 0;
+  int pc;
+  stack[top++] = 0;
+  while (top > 0) {
+    pc = stack[--top];
+    while (pc < n && !(fl[pc] & OPT_LIVE)) {
+      Instruction i = code[pc];
+      int d = jumpdest(i, pc);
+      fl[pc] |= OPT_LIVE;
+      if (fl[pc] & OPT_DEAD) { pc++; continue; }
+      switch (GET_OPCODE(i)) {
+        case OP_RETURN: pc = n; break;
+        case OP_JMP: case OP_FORPREP: pc = d; break;
+        case OP_LOADBOOL: pc += (GETARG_C(i) != 0) ? 2 : 1; break;
+        default: {
+          if (d >= 0)
+            stack[top++] = d;
+          else if (testTMode(GET_OPCODE(i)))
+            stack[top++] = pc + 2;
+          pc++;
+          break;
+        }
+      }
+    }
+  }
+  for (pc = 0; pc < n; pc++)
+    if (!(fl[pc] & (OPT_LIVE | OPT_KEEP))) fl[pc] |= OPT_DEAD;
+}
+
+
+/*
+** mark in 'kmap' the constants used by instruction 'code[pc]' or, with
+** 'renumber' set, make it use their new indices given by 'kmap' (and
+** drop its EXTRAARG when the new index fits in the instruction)
+*/
+static void mapk (Instruction *code, lu_byte *fl, int pc, int *kmap,
+                  int renumber) {
+  Instruction i = code[pc];
+  OpCode op = GET_OPCODE(i);
+  int x;
+  if (op == OP_LOADKX || (op == OP_NEWTABLEK && GETARG_Bx(i) == MAXARG_Bx)) {
+    x = GETARG_Ax(code[pc + 1]);  /* index is in the EXTRAARG */
+    if (!renumber) kmap[x] = 0;
+    else if (kmap[x] < MAXARG_Bx) {
+      code[pc] = CREATE_ABx(op == OP_LOADKX ? OP_LOADK : OP_NEWTABLEK,
+                            GETARG_A(i), kmap[x]);
+      fl[pc + 1] |= OPT_DEAD;
+    }
+    else SETARG_Ax(code[pc + 1], kmap[x]);
+  }
+  else if (getOpMode(op) == iABx) {
+    if (getBMode(op) != OpArgK) return;
+    x = GETARG_Bx(i);
+    if (renumber) SETARG_Bx(code[pc], kmap[x]);
+    else kmap[x] = 0;
+  }
+  else if (getOpMode(op) == iABC) {
+    if (getBMode(op) == OpArgK && ISK(GETARG_B(i))) {
+      x = INDEXK(GETARG_B(i));
+      if (renumber) SETARG_B(code[pc], RKASK(kmap[x]));
+      else kmap[x] = 0;
+    }
+    if (getCMode(op) == OpArgK && ISK(GETARG_C(i))) {
+      x = INDEXK(GETARG_C(i));
+      if (renumber) SETARG_C(code[pc], RKASK(kmap[x]));
+      else kmap[x] = 0;
+    }
+  }
+}
+
+
+/*
+** drop the constants no instruction uses any more (such as the operands
+** of folded arithmetic); constants keep their order, so indices only
+** shrink and every operand still fits. 'fs->h' is stale afterwards,
+** but no constant is added to a function once it is optimized.
+*/
+static void compactk (FuncState *fs, lu_byte *fl, int *kmap) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int pc, k, nk = 0;
+  for (k = 0; k < fs->nk; k++) kmap[k] = -1;
+  for (pc = 0; pc < n; pc++)
+    if (!(fl[pc] & OPT_DEAD)) mapk(f->code, fl, pc, kmap, 0);
+  for (k = 0; k < fs->nk; k++) {
+    if (kmap[k] < 0) continue;  /* unused */
+    kmap[k] = nk;
+    setobj(fs->ls->L, &f->k[nk], &f->k[k]);
+    nk++;
+  }
+  for (pc = 0; pc < n; pc++)
+    if (!(fl[pc] & OPT_DEAD)) mapk(f->code, fl, pc, kmap, 1);
+  fs->nk = nk;
+}
+
+
+/* drop removed instructions, fixing jumps and debug information */
+static void compact (FuncState *fs, lu_byte *fl, int *newpc) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int pc, j = 0;
+  for (pc = 0; pc < n; pc++) {
+    newpc[pc] = j;
+    if (!(fl[pc] & OPT_DEAD)) j++;
+  }
+  newpc[n] = j;
+  for (pc = 0; pc < n; pc++) {
+    if (!(fl[pc] & OPT_DEAD)) {
+      Instruction i = f->code[pc];
+      int d = jumpdest(i, pc);
+      if (d >= 0) SETARG_sBx(i, newpc[d] - (newpc[pc] + 1));
+      f->code[newpc[pc]] = i;
+      f->lineinfo[newpc[pc]] = f->lineinfo[pc];
+    }
+  }
+  for (pc = 0; pc < fs->nlocvars; pc++) {
+    f->locvars[pc].startpc = newpc[f->locvars[pc].startpc];
+    f->locvars[pc].endpc = newpc[f->locvars[pc].endpc];
+  }
+  for (pc = 0; pc < j; pc++) fl[pc] = 0;
+  fs->pc = j;
+}
+
+
+/*
+** Inlining of small local functions: a local function defined by a
+** CLOSURE and never assigned again is inlined into the calls to it (in
+** this function and in the functions nested in its scope, which reach
+** it through upvalues) when it is small, not vararg, creates no
+** closures and writes no upvalues. The copy runs in the registers
+** above the call, where its frame would be, and takes the line of the
+** call.
+*/
+
+#if !defined(LUAI_MAXINLINE)
+#define LUAI_MAXINLINE	16	/* maximum size of an inlined function */
+#endif
+
+#define MAXINLINEK	(3 * LUAI_MAXINLINE)	/* ...and of its constants */
+
+/*
+** references to variables of the function being optimized, as seen from
+** the function being edited: a register or an upvalue of the latter
+*/
+#define REFREG(r)	(2 * (r))
+#define REFUPV(u)	(2 * (u) + 1)
+#define NOREF		(-1)
+#define isrefreg(x)	(((x) & 1) == 0)
+#define refidx(x)	((x) >> 1)
+
+typedef struct Inline {
+  Proto *c;  /* function being inlined */
+  int cu;  /* reference to it */
+  int up[LUAI_MAXINLINE];  /* references to its upvalues */
+  int k[MAXINLINEK];  /* its constants in the function being edited */
+} Inline;
+
+
+/* reference in nested function 'p' to the same variable as 'ref' */
+static int childref (Proto *p, int ref) {
+  int i;
+  if (ref == NOREF) return NOREF;
+  for (i = 0; i < p->sizeupvalues; i++) {
+    if (p->upvalues[i].instack == isrefreg(ref) &&
+        p->upvalues[i].idx == refidx(ref))
+      return REFUPV(i);
+  }
+  return NOREF;
+}
+
+
+/* check whether 'p' or a function nested in it assigns to upvalue 'u' */
+static int setsupval (Proto *p, int u) {
+  int i;
+  for (i = 0; i < p->sizecode; i++) {
+    if (GET_BASEOP(p->code[i]) == OP_SETUPVAL && GETARG_B(p->code[i]) == u)
+      return 1;
+  }
+  for (i = 0; i < p->sizep; i++) {
+    int r = childref(p->p[i], REFUPV(u));
+    if (r != NOREF && setsupval(p->p[i], refidx(r)))
+      return 1;
+  }
+  return 0;
+}
+
+
+/* check whether instruction may change register 'reg' */
+static int setsreg (Instruction i, int reg) {
+  OpCode op = GET_BASEOP(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= reg && reg <= a + GETARG_B(i));
+    case OP_SELF: return (reg == a || reg == a + 1);
+    case OP_CALL: case OP_VARARG: return (reg >= a);  /* frame above 'a' */
+    case OP_TFORCALL: return (reg >= a + 3);
+    case OP_FORLOOP: case OP_FORPREP: return (a <= reg && reg <= a + 3);
+    default: return (testAMode(op) && a == reg);
+  }
+}
+
+
+static int caninline (Proto *c, int self) {
+  int pc;
+  if (c->is_vararg || c->sizep > 0 || c->sizecode > LUAI_MAXINLINE ||
+      c->sizeupvalues > LUAI_MAXINLINE || c->sizek > MAXINLINEK)
+    return 0;
+  if (childref(c, REFREG(self)) != NOREF)
+    return 0;  /* recursive */
+  for (pc = 0; pc < c->sizecode; pc++) {
+    Instruction i = c->code[pc];
+    switch (GET_BASEOP(i)) {
+      case OP_TAILCALL: case OP_SETUPVAL: case OP_VARARG:
+      case OP_CLOSURE: case OP_LOADKX: case OP_NEWTABLEK:
+        return 0;
+      case OP_RETURN:
+        if (GETARG_B(i) == 0) return 0;  /* multiple results */
+        break;
+      default: break;
+    }
+  }
+  return 1;
+}
+
+
+/* check whether the inlined function uses its upvalue 'u' */
+static int usesupval (Proto *c, int u) {
+  int pc;
+  for (pc = 0; pc < c->sizecode; pc++) {
+    Instruction i = c->code[pc];
+    switch (GET_BASEOP(i)) {
+      case OP_GETUPVAL: case OP_GETTABUP:
+        if (GETARG_B(i) == u) return 1;
+        break;
+      case OP_SETTABUP:
+        if (GETARG_A(i) == u) return 1;
+        break;
+      default: break;
+    }
+  }
+  return 0;
+}
+
+
+/* check that every upvalue used by the inlined function is reachable */
+static int upvalsok (const Inline *in) {
+  int u;
+  for (u = 0; u < in->c->sizeupvalues; u++) {
+    if (in->up[u] == NOREF && usesupval(in->c, u)) return 0;
+  }
+  return 1;
+}
+
+
+/* check whether constants 'a' and 'b' are the same (telling 0 from -0) */
+static int samek (const TValue *a, const TValue *b) {
+  if (ttype(a) != ttype(b)) return 0;
+  if (ttisnumber(a) && !ttisinteger(a)) {
+    LUA_Number x = nvalue(a);
+    LUA_Number y = nvalue(b);
+    return (memcmp(&x, &y, sizeof(x)) == 0);
+  }
+  return LUAV_rawequalobj(a, b);
+}
+
+
+/*
+** map the constants of the inlined function into 'p', which has 'nk'
+** of them; fail if one used by an RK operand does not fit there
+*/
+static int mapconstants (LUA_State *L, Proto *p, int *nk, Inline *in) {
+  Proto *c = in->c;
+  int i, j;
+  for (i = 0; i < c->sizek; i++) {
+    for (j = 0; j < *nk; j++)
+      if (samek(&p->k[j], &c->k[i])) break;
+    if (j == *nk) {  /* new constant? */
+      int oldsize = p->sizek;
+      LUAM_growvector(L, p->k, j, p->sizek, TValue, MAXARG_Ax, "constants");
+      while (oldsize < p->sizek) setnilvalue(&p->k[oldsize++]);
+      setobj(L, &p->k[j], &c->k[i]);
+      LUAC_barrier(L, p, &c->k[i]);
+      (*nk)++;
+    }
+    in->k[i] = j;
+  }
+  for (i = 0; i < c->sizecode; i++) {
+    Instruction ins = c->code[i];
+    OpCode op = GET_BASEOP(ins);
+    if ((getBMode(op) == OpArgK && getOpMode(op) == iABC &&
+         ISK(GETARG_B(ins)) && in->k[INDEXK(GETARG_B(ins))] > MAXINDEXRK) ||
+        (getCMode(op) == OpArgK &&
+         ISK(GETARG_C(ins)) && in->k[INDEXK(GETARG_C(ins))] > MAXINDEXRK) ||
+        (op == OP_LOADK && in->k[GETARG_Bx(ins)] > MAXARG_Bx))
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** find the instruction that loads the callee of the call at 'pc' from
+** 'ref', with no other way into the call; return it or -1
+*/
+static int callsite (Proto *p, int n, int ref, int from, int pc) {
+  Instruction *code = p->code;
+  Instruction i = code[pc];
+  int a = GETARG_A(i);
+  int m, j;
+  if (GET_BASEOP(i) != OP_CALL || GETARG_B(i) == 0 || GETARG_C(i) == 0 ||
+      pc - 1 <= from || usesnext(code[pc - 1]))
+    return -1;
+  for (m = pc - 1; m > from && !setsreg(code[m], a); m--) ;
+  if (m <= from || (m > 0 && usesnext(code[m - 1])) ||
+      !(isrefreg(ref) ? GET_BASEOP(code[m]) == OP_MOVE :
+                        GET_BASEOP(code[m]) == OP_GETUPVAL) ||
+      GETARG_A(code[m]) != a || GETARG_B(code[m]) != refidx(ref))
+    return -1;
+  for (j = 0; j < n; j++) {  /* no jumps from outside into the call */
+    int d = jumpdest(code[j], j);
+    if (usesnext(code[j])) d = j + 2;
+    if (m < d && d <= pc && (j < m || j >= pc))
+      return -1;
+  }
+  return m;
+}
+
+
+/* size of the inlined code for a call wanting 'nres' results */
+static int inlinedsize (Proto *c, int nargs, int nres, int *cpc) {
+  int j, size = (nargs < c->numparams);
+  for (j = 0; j < c->sizecode; j++) {
+    Instruction i = c->code[j];
+    cpc[j] = size;
+    if (GET_BASEOP(i) == OP_RETURN) {
+      int nret = GETARG_B(i) - 1;
+      size += (nret < nres) ? nret + 1 : nres;
+      size += (j < c->sizecode - 1);  /* jump to the end */
+    }
+    else size++;
+  }
+  cpc[c->sizecode] = size;
+  return size;
+}
+
+
+/* RK operand 'x' of the inlined function, with frame at 'base' */
+static int inlinerk (const Inline *in, int x, int base) {
+  return ISK(x) ? RKASK(in->k[INDEXK(x)]) : x + base;
+}
+
+
+/*
+** emit the body of the inlined function for a call at register 'a';
+** return the number of instructions emitted
+*/
+static int emitinline (const Inline *in, Instruction call, Instruction *code) {
+  Proto *c = in->c;
+  int a = GETARG_A(call);
+  int nargs = GETARG_B(call) - 1;
+  int nres = GETARG_C(call) - 1;
+  int base = a + 1;
+  int cpc[LUAI_MAXINLINE + 1];
+  int size = inlinedsize(c, nargs, nres, cpc);
+  int j, k, n = 0;
+  if (nargs < c->numparams)  /* complete missing arguments */
+    code[n++] = CREATE_ABC(OP_LOADNIL, base + nargs,
+                           c->numparams - nargs - 1, 0);
+  for (j = 0; j < c->sizecode; j++) {
+    Instruction i = c->code[j];
+    OpCode op = GET_BASEOP(i);
+    int ia = GETARG_A(i);
+    int ib = GETARG_B(i);
+    int ic = GETARG_C(i);
+    switch (op) {
+      case OP_RETURN: {
+        int nret = ib - 1;
+        for (k = 0; k < nret && k < nres; k++)
+          code[n++] = CREATE_ABC(OP_MOVE, a + k, base + ia + k, 0);
+        if (nret < nres)
+          code[n++] = CREATE_ABC(OP_LOADNIL, a + nret, nres - nret - 1, 0);
+        if (j < c->sizecode - 1) {  /* jump to the end */
+          code[n] = CREATE_ABx(OP_JMP, 0, size - (n + 1) + MAXARG_sBx);
+          n++;
+        }
+        continue;
+      }
+      case OP_GETUPVAL: {
+        int u = in->up[ib];
+        i = isrefreg(u) ? CREATE_ABC(OP_MOVE, base + ia, refidx(u), 0)
+                        : CREATE_ABC(OP_GETUPVAL, base + ia, refidx(u), 0);
+        break;
+      }
+      case OP_GETTABUP: {
+        int u = in->up[ib];
+        i = CREATE_ABC(isrefreg(u) ? OP_GETTABLE : OP_GETTABUP, base + ia,
+                       refidx(u), inlinerk(in, ic, base));
+        break;
+      }
+      case OP_SETTABUP: {
+        int u = in->up[ia];
+        i = CREATE_ABC(isrefreg(u) ? OP_SETTABLE : OP_SETTABUP, refidx(u),
+                       inlinerk(in, ib, base), inlinerk(in, ic, base));
+        break;
+      }
+      case OP_JMP: case OP_FORLOOP: case OP_FORPREP: case OP_TFORLOOP: {
+        int d = cpc[j + 1 + GETARG_sBx(i)];
+        i = CREATE_ABx(op, (op == OP_JMP) ? 0 : base + ia,
+                       d - (n + 1) + MAXARG_sBx);
+        break;
+      }
+      case OP_LOADK: {
+        i = CREATE_ABx(op, base + ia, in->k[GETARG_Bx(i)]);
+        break;
+      }
+      case OP_EXTRAARG: break;
+      default: {
+        SET_OPCODE(i, op);
+        if (testAMode(op) || op == OP_SETTABLE || op == OP_TEST ||
+            op == OP_TFORCALL || op == OP_SETLIST)
+          SETARG_A(i, base + ia);
+        if (getBMode(op) == OpArgR) SETARG_B(i, base + ib);
+        else if (getBMode(op) == OpArgK) SETARG_B(i, inlinerk(in, ib, base));
+        if (getCMode(op) == OpArgR) SETARG_C(i, base + ic);
+        else if (getCMode(op) == OpArgK) SETARG_C(i, inlinerk(in, ic, base));
+        break;
+      }
+    }
+    code[n++] = i;
+  }
+  LUA_assert(n == size);
+  return n;
+}
+
+
+/*
+** inline the calls to 'in->c' in instructions [from, to) of 'p'
+** (whose first 'n' instructions and 'nlocvars' local variables are in
+** use); return the new number of instructions
+*/
+static int inlinecalls (LUA_State *L, Proto *p, int n, int *nk, int nlocvars,
+                        Inline *in, int from, int to) {
+  Proto *c = in->c;
+  int cpc[LUAI_MAXINLINE + 1];
+  int pc, m, newn = n, nsites = 0;
+  int *newpc;
+  Instruction *code;
+  int *line;
+  lu_byte *drop;
+  Udata *u;
+  if (!upvalsok(in)) return n;
+  for (pc = from + 1; pc < to; pc++) {  /* count sites and new size */
+    m = callsite(p, n, in->cu, from, pc);
+    if (m >= 0 && GETARG_A(p->code[pc]) + 1 + c->maxstacksize <= MAXSTACK) {
+      newn += inlinedsize(c, GETARG_B(p->code[pc]) - 1,
+                          GETARG_C(p->code[pc]) - 1, cpc) - 2;
+      nsites++;
+    }
+  }
+  if (nsites == 0 || !mapconstants(L, p, nk, in)) return n;
+  /* scratch memory lives in a userdata, so errors do not leak it */
+  u = LUAS_newudata(L, (n + 1) * (sizeof(int) + 1) +
+                       newn * (sizeof(Instruction) + sizeof(int)), NULL);
+  setuvalue(L, L->top, u);
+  incr_top(L);
+  code = cast(Instruction *, u + 1);
+  line = cast(int *, code + newn);
+  newpc = line + newn;
+  drop = cast(lu_byte *, newpc + n + 1);
+  for (pc = 0; pc < n; pc++) drop[pc] = 0;
+  for (pc = from + 1; pc < to; pc++) {
+    m = callsite(p, n, in->cu, from, pc);
+    if (m >= 0 && GETARG_A(p->code[pc]) + 1 + c->maxstacksize <= MAXSTACK) {
+      drop[m] = 1;  /* callee is not needed in a register */
+      drop[pc] = 2;  /* call is replaced by the inlined code */
+    }
+  }
+  for (pc = 0, m = 0; pc < n; pc++) {
+    Instruction i = p->code[pc];
+    newpc[pc] = m;
+    if (drop[pc] == 2) {
+      int j, k = emitinline(in, i, code + m);
+      int a = GETARG_A(i) + 1 + c->maxstacksize;
+      for (j = 0; j < k; j++) line[m + j] = p->lineinfo[pc];
+      if (a > p->maxstacksize) p->maxstacksize = cast_byte(a);
+      m += k;
+    }
+    else if (!drop[pc]) {
+      SET_OPCODE(i, GET_BASEOP(i));  /* fused forms are redone later */
+      code[m] = i;
+      line[m++] = p->lineinfo[pc];
+    }
+  }
+  LUA_assert(m == newn);
+  newpc[n] = newn;
+  for (pc = 0; pc < n; pc++) {  /* fix jumps of the old instructions */
+    int d;
+    if (drop[pc]) continue;
+    d = jumpdest(code[newpc[pc]], pc);
+    if (d >= 0) SETARG_sBx(code[newpc[pc]], newpc[d] - (newpc[pc] + 1));
+  }
+  for (pc = 0; pc < nlocvars; pc++) {
+    p->locvars[pc].startpc = newpc[p->locvars[pc].startpc];
+    p->locvars[pc].endpc = newpc[p->locvars[pc].endpc];
+  }
+  if (newn > p->sizecode) {
+    LUAM_reallocvector(L, p->code, p->sizecode, newn, Instruction);
+    p->sizecode = newn;
+  }
+  if (newn > p->sizelineinfo) {
+    LUAM_reallocvector(L, p->lineinfo, p->sizelineinfo, newn, int);
+    p->sizelineinfo = newn;
+  }
+  memcpy(p->code, code, newn * sizeof(Instruction));
+  memcpy(p->lineinfo, line, newn * sizeof(int));
+  L->top--;  /* remove scratch memory */
+  return newn;
+}
+
+
+/*
+** references of nested function 'np' to what 'in' refers to; when 'np'
+** uses the inlined function, it gets the upvalues needed by its body
+*/
+static void childinline (LUA_State *L, Proto *np, const Inline *in,
+                         Inline *nin) {
+  Proto *c = in->c;
+  int u;
+  nin->c = c;
+  nin->cu = childref(np, in->cu);
+  for (u = 0; u < c->sizeupvalues; u++) {
+    nin->up[u] = childref(np, in->up[u]);
+    if (nin->up[u] == NOREF && nin->cu != NOREF && in->up[u] != NOREF &&
+        np->sizeupvalues < MAXUPVAL && usesupval(c, u)) {
+      int n = np->sizeupvalues;
+      LUAM_reallocvector(L, np->upvalues, n, n + 1, Upvaldesc);
+      np->sizeupvalues = n + 1;
+      np->upvalues[n].instack = cast_byte(isrefreg(in->up[u]));
+      np->upvalues[n].idx = cast_byte(refidx(in->up[u]));
+      np->upvalues[n].name = c->upvalues[u].name;
+      LUAC_objbarrier(L, np, c->upvalues[u].name);
+      nin->up[u] = REFUPV(n);
+    }
+  }
+}
+
+
+/* inline calls to 'in->c' in finished function 'p' and those nested in it */
+static void inlinenested (LUA_State *L, Proto *p, Inline *in) {
+  int i, nk = p->sizek;
+  int n = inlinecalls(L, p, p->sizecode, &nk, p->sizelocvars, in,
+                      -1, p->sizecode);
+  /* shrink arrays to their final sizes and redo fused instructions */
+  LUAM_reallocvector(L, p->code, p->sizecode, n, Instruction);
+  p->sizecode = n;
+  LUAM_reallocvector(L, p->lineinfo, p->sizelineinfo, n, int);
+  p->sizelineinfo = n;
+  LUAM_reallocvector(L, p->k, p->sizek, nk, TValue);
+  p->sizek = nk;
+  LUAP_fuse(p->code, n);
+  for (i = 0; i < p->sizep; i++) {
+    Inline nin;
+    childinline(L, p->p[i], in, &nin);
+    if (nin.cu != NOREF) inlinenested(L, p->p[i], &nin);
+  }
+}
+
+
+static void inlinelocals (FuncState *fs) {
+  LUA_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int v, i;
+  for (v = 0; v < fs->nlocvars; v++) {
+    LocVar *lv = &f->locvars[v];
+    int reg = 0;
+    int cp = lv->startpc;  /* the CLOSURE defining the variable */
+    Inline in;
+    for (i = 0; i < v; i++) {  /* register of 'v': locals active before it */
+      if (f->locvars[i].startpc <= cp && cp < f->locvars[i].endpc)
+        reg++;
+    }
+    if (cp >= fs->pc || GET_OPCODE(f->code[cp]) != OP_CLOSURE ||
+        GETARG_A(f->code[cp]) != reg)
+      cp--;  /* 'LOCAL f = FUNCTION' defines it just before its scope */
+    if (cp < 0 || GET_OPCODE(f->code[cp]) != OP_CLOSURE ||
+        GETARG_A(f->code[cp]) != reg)
+      continue;
+    in.c = f->p[GETARG_Bx(f->code[cp])];
+    in.cu = REFREG(reg);
+    if (!caninline(in.c, reg)) continue;
+    for (i = cp + 1; i < lv->endpc; i++) {  /* never assigned again? */
+      Instruction ins = f->code[i];
+      if (setsreg(ins, reg)) break;
+      if (GET_OPCODE(ins) == OP_CLOSURE) {
+        Proto *np = f->p[GETARG_Bx(ins)];
+        int r = childref(np, in.cu);
+        if (r != NOREF && setsupval(np, refidx(r))) break;
+      }
+    }
+    if (i < lv->endpc) continue;
+    for (i = 0; i < in.c->sizeupvalues; i++) {
+      Upvaldesc *up = &in.c->upvalues[i];
+      in.up[i] = up->instack ? REFREG(up->idx) : REFUPV(up->idx);
+    }
+    for (i = cp + 1; i < lv->endpc; i++) {  /* functions in its scope */
+      if (GET_OPCODE(f->code[i]) == OP_CLOSURE) {
+        Inline nin;
+        Proto *np = f->p[GETARG_Bx(f->code[i])];
+        childinline(L, np, &in, &nin);
+        if (nin.cu != NOREF) inlinenested(L, np, &nin);
+      }
+    }
+    fs->pc = inlinecalls(L, f, fs->pc, &fs->nk, fs->nlocvars, &in,
+                         cp, lv->endpc);
+  }
+}
+
+
+void LUAK_optimize (FuncState *fs) {
+  LUA_State *L = fs->ls->L;
+  int n, ns, nk, i;
+  Udata *u;
+  int *newpc, *kreg, *kmap;
+  lu_byte *fl, *capt;
+  inlinelocals(fs);
+  n = fs->pc;
+  ns = fs->f->maxstacksize;
+  nk = fs->nk + n;  /* each folding adds at most one constant */
+  /* scratch memory lives in a userdata, so errors do not leak it */
+  u = LUAS_newudata(L, (n + 1 + ns) * (sizeof(int) + 1) + nk * sizeof(int),
+                    NULL);
+  setuvalue(L, L->top, u);
+  incr_top(L);
+  newpc = cast(int *, u + 1);
+  kreg = newpc + n + 1;
+  kmap = kreg + ns;
+  fl = cast(lu_byte *, kmap + nk);
+  capt = fl + n + 1;
+  for (i = 0; i <= n; i++) fl[i] = 0;
+  markcaptured(fs, capt);
+  marktargets(fs, fl);
+  foldconstants(fs, fl, capt, kreg);
+  removestores(fs, fl, capt);
+  threadjumps(fs, fl, capt);
+  removeunreachable(fs, fl, newpc);
+  removenopjumps(fs, fl);
+  LUA_assert(fs->nk <= nk);
+  compactk(fs, fl, kmap);
+  compact(fs, fl, newpc);
+  L->top--;  /* remove scratch memory */
+}
+
+/* }====================================================== */
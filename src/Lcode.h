@@ -78,6 +78,8 @@ LUAI_FUNC void LUAK_infix (FuncState *fs, BinOpr op, expdesc *v);
 LUAI_FUNC void LUAK_posfix (FuncState *fs, BinOpr op, expdesc *v1,
                             expdesc *v2, int line);
 LUAI_FUNC void LUAK_setlist (FuncState *fs, int base, int nelems, int tostore);
+LUAI_FUNC void LUAK_tabletemplate (FuncState *fs, int pc, int nk);
+LUAI_FUNC void LUAK_optimize (FuncState *fs);
 
 
 #endif
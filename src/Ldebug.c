@@ -335,7 +335,7 @@ static int findsetreg (Proto *p, int lastpc, int reg) {
   int setreg = -1;  /* keep last instruction that changed 'reg' */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     int a = GETARG_A(i);
     switch (op) {
       case OP_LOADNIL: {
@@ -385,7 +385,7 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
   pc = findsetreg(p, lastpc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOP(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -407,6 +407,21 @@ static const char *getobjname (Proto *p, int lastpc, int reg,
         *name = upvalname(p, GETARG_B(i));
         return "upvalue";
       }
+      case OP_TEST: {  /* read of a cached global? (see 'loadhoisted') */
+        int d;
+        if (pc == 0 || pc + 1 >= p->sizecode ||
+            GET_BASEOP(p->code[pc + 1]) != OP_JMP)
+          break;
+        d = pc + 1 + GETARG_sBx(p->code[pc + 1]);  /* end of the refill */
+        if (d > pc + 2 && d < lastpc &&
+            GET_BASEOP(p->code[pc - 1]) == OP_GETUPVAL &&
+            GETARG_A(p->code[pc - 1]) == GETARG_A(i) &&
+            GET_BASEOP(p->code[d]) == OP_SETUPVAL &&
+            GETARG_A(p->code[d]) == GETARG_A(i) &&
+            GETARG_B(p->code[d]) == GETARG_B(p->code[pc - 1]))
+          return getobjname(p, d, GETARG_A(i), name);  /* as the refill */
+        break;
+      }
       case OP_LOADK:
       case OP_LOADKX: {
         int b = (op == OP_LOADK) ? GETARG_Bx(i)
@@ -434,7 +449,7 @@ static const char *getfuncname (LUA_State *L, CallInfo *ci, const char **name) {
   Proto *p = ci_func(ci)->p;  /* calling function */
   int pc = currentpc(ci);  /* calling instruction index */
   Instruction i = p->code[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (GET_BASEOP(i)) {
     case OP_CALL:
     case OP_TAILCALL:  /* get function name */
       return getobjname(p, pc, GETARG_A(i), name);
@@ -259,8 +259,10 @@ static StkId adjust_varargs (LUA_State *L, Proto *p, int actual) {
   int nfixargs = p->numparams;
   StkId base, fixed;
   LUA_assert(actual >= nfixargs);
-  /* move fixed parameters to final position */
   fixed = L->top - actual;  /* first fixed argument */
+  if (actual == nfixargs)  /* no extra arguments? */
+    return fixed;  /* parameters are already in place */
+  /* move fixed parameters to final position */
   base = L->top;  /* final position of first argument */
   for (i=0; i<nfixargs; i++) {
     setobjs2s(L, L->top++, fixed + i);
@@ -285,8 +287,27 @@ static StkId tryfuncTM (LUA_State *L, StkId func) {
 }
 
 
-
-#define next_ci(L) (L->ci = (L->ci->next ? L->ci->next : LUAE_extendCI(L)))
+/*
+** Replace the bound function at 'func' by the function it binds, with
+** the bound arguments inserted before the actual ones
+*/
+static StkId unbind (LUA_State *L, StkId func) {
+  CClosure *cl;
+  StkId p;
+  int nb = clCvalue(func)->nupvalues - 1;  /* number of bound arguments */
+  int i;
+  ptrdiff_t funcr = savestack(L, func);
+  LUAD_checkstack(L, nb);
+  func = restorestack(L, funcr);  /* previous call may change stack */
+  cl = clCvalue(func);
+  /* open a hole for the bound arguments */
+  for (p = L->top - 1; p > func; p--) setobjs2s(L, p + nb, p);
+  L->top += nb;
+  for (i = 1; i <= nb; i++)
+    setobj2s(L, func + i, &cl->upvalue[i]);
+  setobj2s(L, func, &cl->upvalue[0]);
+  return func;
+}
 
 
 /*
@@ -303,6 +324,8 @@ int LUAD_precall (LUA_State *L, StkId func, int nresults) {
       goto Cfunc;
     case LUA_TCCL: {  /* C closure */
       f = clCvalue(func)->f;
+      if (f == LUAA_bound)  /* bound function? */
+        return LUAD_precall(L, unbind(L, func), nresults);
      Cfunc:
       LUAD_checkstack(L, LUA_MINSTACK);  /* ensure minimum stack size */
       ci = next_ci(L);  /* now 'enter' new function */
@@ -617,6 +640,7 @@ struct SParser {  /* data to `f_parser' */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  Image *image;  /* image 'z' reads from, if any */
 };
 
 
@@ -636,11 +660,12 @@ static void f_parser (LUA_State *L, void *ud) {
   int c = zgetc(p->z);  /* read first character */
   if (c == LUA_SIGNATURE[0]) {
     checkmode(L, p->mode, "binary");
-    cl = LUAU_undump(L, p->z, &p->buff, p->name);
+    cl = LUAU_undump(L, p->z, &p->buff, p->name, p->image);
   }
   else {
     checkmode(L, p->mode, "text");
-    cl = LUAY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = LUAY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                     p->mode != NULL && strchr(p->mode, 'g') != NULL);
   }
   LUA_assert(cl->l.nupvalues == cl->l.p->sizeupvalues);
   for (i = 0; i < cl->l.nupvalues; i++) {  /* initialize upvalues */
@@ -652,11 +677,11 @@ static void f_parser (LUA_State *L, void *ud) {
 
 
 int LUAD_protectedparser (LUA_State *L, ZIO *z, const char *name,
-                                        const char *mode) {
+                                        const char *mode, Image *image) {
   struct SParser p;
   int status;
   L->nny++;  /* cannot yield during parsing */
-  p.z = z; p.name = name; p.mode = mode;
+  p.z = z; p.name = name; p.mode = mode; p.image = image;
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.comefrom.arr = NULL; p.dyd.comefrom.size = 0;
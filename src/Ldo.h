@@ -19,6 +19,8 @@
 
 #define incr_top(L) {L->top++; LUAD_checkstack(L,0);}
 
+#define next_ci(L) (L->ci = (L->ci->next ? L->ci->next : LUAE_extendCI(L)))
+
 #define savestack(L,p)		((char *)(p) - (char *)L->stack)
 #define restorestack(L,n)	((TValue *)((char *)L->stack + (n)))
 
@@ -27,7 +29,8 @@
 typedef void (*Pfunc) (LUA_State *L, void *ud);
 
 LUAI_FUNC int LUAD_protectedparser (LUA_State *L, ZIO *z, const char *name,
-                                                  const char *mode);
+                                                  const char *mode,
+                                                  Image *image);
 LUAI_FUNC void LUAD_hook (LUA_State *L, int event, int line);
 LUAI_FUNC int LUAD_precall (LUA_State *L, StkId func, int nresults);
 LUAI_FUNC void LUAD_call (LUA_State *L, StkId func, int nResults,
@@ -12,7 +12,9 @@
 #include "LUA.h"
 
 #include "Lobject.h"
+#include "Lopcodes.h"
 #include "Lstate.h"
+#include "Ltable.h"
 #include "Lundump.h"
 
 typedef struct {
@@ -73,37 +75,98 @@ static void DumpString(const TString* s, DumpState* D)
  }
 }
 
-#define DumpCode(f,D)	 DumpVector(f->code,f->sizecode,sizeof(Instruction),D)
+#define CODECHUNK	64
+
+/* code is dumped with quickened instructions put back in their original form */
+static void DumpCode(const Proto* f, DumpState* D)
+{
+ Instruction b[CODECHUNK];
+ int i,j,n=f->sizecode;
+ DumpInt(n,D);
+ for (i=0; i<n; i+=j)
+ {
+  for (j=0; j<CODECHUNK && i+j<n; j++)
+  {
+   b[j]=f->code[i+j];
+   SET_OPCODE(b[j],GET_BASEOP(b[j]));
+  }
+  DumpMem(b,j,sizeof(Instruction),D);
+ }
+}
 
 static void DumpFunction(const Proto* f, DumpState* D);
 
-static void DumpConstants(const Proto* f, DumpState* D)
+static void DumpConstant(const TValue* o, DumpState* D);
+
+/* template of a constant constructor: array part, then hash entries */
+static void DumpTemplate(const Table* t, DumpState* D)
 {
- int i,n=f->sizek;
+ int i,n=0,size=sizenode(t);
+ DumpInt(t->sizearray,D);
+ for (i=0; i<t->sizearray; i++) DumpConstant(&t->array[i],D);
+ for (i=0; i<size; i++) if (!ttisnil(gval(gnode(t,i)))) n++;
+#if defined(LUA_USE_SHAPES)
+ for (i=0; i<nfields(t); i++) if (!ttisnil(&t->fields[i])) n++;
+#endif
  DumpInt(n,D);
- for (i=0; i<n; i++)
+#if defined(LUA_USE_SHAPES)
+ for (i=0; i<nfields(t); i++)
+ {
+  if (!ttisnil(&t->fields[i]))
+  {
+   DumpChar(LUA_TSTRING,D);
+   DumpString(t->shape->keys[i],D);
+   DumpConstant(&t->fields[i],D);
+  }
+ }
+#endif
+ for (i=0; i<size; i++)
  {
-  const TValue* o=&f->k[i];
-  DumpChar(ttypenv(o),D);
-  switch (ttypenv(o))
+  const Node* nd=gnode(t,i);
+  if (!ttisnil(gval(nd)))
   {
-   case LUA_TNIL:
+   DumpConstant(gkey(nd),D);
+   DumpConstant(gval(nd),D);
+  }
+ }
+}
+
+static void DumpConstant(const TValue* o, DumpState* D)
+{
+ DumpChar(ttypenv(o),D);
+ switch (ttypenv(o))
+ {
+  case LUA_TNIL:
 	break;
-   case LUA_TBOOLEAN:
+  case LUA_TBOOLEAN:
 	DumpChar(bvalue(o),D);
 	break;
-   case LUA_TNUMBER:
+  case LUA_TNUMBER:
 	DumpNumber(nvalue(o),D);
 	break;
-   case LUA_TSTRING:
+  case LUA_TSTRING:
 	DumpString(rawtsvalue(o),D);
 	break;
-    default: LUA_assert(0);
-  }
+  case LUA_TTABLE:
+	DumpTemplate(hvalue(o),D);
+	break;
+   default: LUA_assert(0);
  }
+}
+
+static void DumpConstants(const Proto* f, DumpState* D)
+{
+ int i,n=f->sizek;
+ DumpInt(n,D);
+ for (i=0; i<n; i++) DumpConstant(&f->k[i],D);
  n=f->sizep;
  DumpInt(n,D);
- for (i=0; i<n; i++) DumpFunction(f->p[i],D);
+ for (i=0; i<n; i++)
+ {
+  const Proto* p=f->p[i];
+  if (p->lazy!=NULL) p=LUAU_materialize(D->L,cast(Proto*,f),i);
+  DumpFunction(p,D);
+ }
 }
 
 static void DumpUpvalues(const Proto* f, DumpState* D)
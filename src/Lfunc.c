@@ -14,9 +14,11 @@
 
 #include "Lfunc.h"
 #include "Lgc.h"
+#include "Ljit.h"
 #include "Lmem.h"
 #include "Lobject.h"
 #include "Lstate.h"
+#include "Lundump.h"
 
 
 
@@ -115,6 +117,11 @@ Proto *LUAF_newproto (LUA_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->cache = NULL;
+  f->icache = NULL;
+#if defined(LUA_USE_JIT)
+  f->jit = NULL;
+  f->jitcount = LUAI_JITHOT;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -128,17 +135,25 @@ Proto *LUAF_newproto (LUA_State *L) {
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+  f->image = NULL;
+  f->lazy = NULL;
   return f;
 }
 
 
 void LUAF_freeproto (LUA_State *L, Proto *f) {
-  LUAM_freearray(L, f->code, f->sizecode);
+  if (f->icache) LUAM_freearray(L, f->icache, f->sizecode);
+#if defined(LUA_USE_JIT)
+  if (f->jit) LUAJ_free(L, f);
+#endif
+  if (f->image == NULL || !LUAU_inimage(f->image, f->code))
+    LUAM_freearray(L, f->code, f->sizecode);
   LUAM_freearray(L, f->p, f->sizep);
   LUAM_freearray(L, f->k, f->sizek);
   LUAM_freearray(L, f->lineinfo, f->sizelineinfo);
   LUAM_freearray(L, f->locvars, f->sizelocvars);
   LUAM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->image) LUAU_unrefimage(L, f->image);
   LUAM_free(L, f);
 }
 
@@ -354,9 +354,9 @@ static void restartcollection (global_State *g) {
 
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
-  /* if there is array part, assume it may have white values (do not
-     traverse it just to check) */
-  int hasclears = (h->sizearray > 0);
+  /* if there is array part or fields, assume they may have white values
+     (do not traverse them just to check); field keys are fixed strings */
+  int hasclears = ((h->sizearray > 0 && !ispacked(h)) || nfields(h) > 0);
   for (n = gnode(h, 0); n < limit; n++) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
@@ -381,13 +381,23 @@ static int traverseephemeron (global_State *g, Table *h) {
   int prop = 0;  /* true if table has entry "white-key -> white-value" */
   Node *n, *limit = gnodelast(h);
   int i;
-  /* traverse array part (numeric keys are 'strong') */
-  for (i = 0; i < h->sizearray; i++) {
+  /* traverse array part (numeric keys are 'strong'; packed arrays hold
+     only numbers) */
+  for (i = 0; i < h->sizearray && !ispacked(h); i++) {
     if (valiswhite(&h->array[i])) {
       marked = 1;
       reallymarkobject(g, gcvalue(&h->array[i]));
     }
   }
+#if defined(LUA_USE_SHAPES)
+  /* traverse fields (their keys are fixed strings) */
+  for (i = 0; i < nfields(h); i++) {
+    if (valiswhite(&h->fields[i])) {
+      marked = 1;
+      reallymarkobject(g, gcvalue(&h->fields[i]));
+    }
+  }
+#endif
   /* traverse hash part */
   for (n = gnode(h, 0); n < limit; n++) {
     checkdeadkey(n);
@@ -416,8 +426,12 @@ static int traverseephemeron (global_State *g, Table *h) {
 static void traversestrongtable (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
   int i;
-  for (i = 0; i < h->sizearray; i++)  /* traverse array part */
+  for (i = 0; i < h->sizearray && !ispacked(h); i++)  /* array part */
     markvalue(g, &h->array[i]);
+#if defined(LUA_USE_SHAPES)
+  for (i = 0; i < nfields(h); i++)  /* traverse fields */
+    markvalue(g, &h->fields[i]);
+#endif
   for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
@@ -449,8 +463,12 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, sizenode(h));
+  return sizeof(Table) +
+         (ispacked(h) ? sizeof(Value) : sizeof(TValue)) * h->sizearray +
+#if defined(LUA_USE_SHAPES)
+         sizeof(TValue) * h->sizefields +
+#endif
+         sizeof(Node) * cast(size_t, sizenode(h));
 }
 
 
@@ -468,6 +486,7 @@ static int traverseproto (global_State *g, Proto *f) {
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobject(g, f->locvars[i].varname);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
+                         (f->icache ? sizeof(int) * f->sizecode : 0) +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
@@ -638,11 +657,18 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     int i;
-    for (i = 0; i < h->sizearray; i++) {
+    for (i = 0; i < h->sizearray && !ispacked(h); i++) {
       TValue *o = &h->array[i];
       if (iscleared(g, o))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
+#if defined(LUA_USE_SHAPES)
+    for (i = 0; i < nfields(h); i++) {
+      TValue *o = &h->fields[i];
+      if (iscleared(g, o))  /* value was collected? */
+        setnilvalue(o);  /* remove value */
+    }
+#endif
     for (n = gnode(h, 0); n < limit; n++) {
       if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
         setnilvalue(gval(n));  /* remove value ... */
@@ -0,0 +1,1744 @@
+/*
+** $Id: Ljit.c $
+** Baseline native-code compiler (x86-64)
+** See Copyright Notice in LUA.h
+*/
+
+
+#include <stddef.h>
+#include <string.h>
+
+#define ljit_c
+#define LUA_CORE
+
+#include "LUA.h"
+
+#if defined(LUA_USE_JIT)
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Ldo.h"
+#include "Lfunc.h"
+#include "Lgc.h"
+#include "Ljit.h"
+#include "Lmem.h"
+#include "Lobject.h"
+#include "Lopcodes.h"
+#include "Lstate.h"
+#include "Ltable.h"
+#include "Ltm.h"
+#include "Lvm.h"
+
+
+/*
+** The compiler translates a whole prototype, one template per
+** instruction, into a native function that runs from any instruction
+** on. Numeric operations, moves, loads, tests and loops are done
+** inline (behind type guards); table accesses, calls to C functions
+** and all slow paths call 'jit_op', which runs the instruction through
+** the generic VM functions with 'savedpc' set exactly as the
+** interpreter sets it, so errors, yields and tracebacks see a normal
+** frame. Anything else (returns, LUA calls, closures, varargs...) exits
+** to the interpreter, which re-enters the native code at its next loop
+** back edge or frame change. Native code never runs while hooks are
+** active.
+**
+** Native register usage:
+**   rbx = base, rbp = k, r12 = L, r13 = ci, r14 = closure
+*/
+
+
+/* registers */
+#define RAX	0
+#define RCX	1
+#define RDX	2
+#define RBX	3
+#define RSP	4
+#define RBP	5
+#define RSI	6
+#define RDI	7
+#define R8	8
+#define R9	9
+#define R10	10
+#define R11	11
+#define R12	12
+#define R13	13
+#define R14	14
+#define R15	15
+
+/* condition codes (the lowest bit inverts a condition) */
+#define CC_O	0x0
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_P	0xA
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+
+/* maximum size of the template of one instruction */
+#define MAXTEMPLATE	384
+
+/* size of prologue and exit stubs */
+#define MAXSTUBS	128
+
+/* special fixup targets */
+#define TO_EXIT		(-1)	/* return 0 (savedpc in rax) */
+#define TO_FRAME	(-2)	/* return 1 (new LUA frame) */
+
+#define TVSIZE		cast_int(sizeof(TValue))
+#define TTOFF		cast_int(offsetof(TValue, tt_))
+
+#define CI_BASE		cast_int(offsetof(CallInfo, u.l.base))
+#define CI_SAVEDPC	cast_int(offsetof(CallInfo, u.l.savedpc))
+
+
+typedef int (*JitEntry) (LUA_State *L, CallInfo *ci, LClosure *cl,
+                         void *start);
+
+
+/* a numeric FOR loop of a compiled prototype and its trace */
+typedef struct JitLoop {
+  lu_byte *f;  /* trace code (NULL if none) */
+  int hot;  /* iterations left before recording a trace */
+  int nexit;  /* failed entries left before dropping the trace */
+  int pc;  /* the FORLOOP instruction */
+  size_t size;  /* size of the trace mapping */
+  lu_byte *mem;  /* trace mapping (kept while 'f' is dropped) */
+} JitLoop;
+
+
+/* compiled code of a prototype; lives in its own mapping */
+typedef struct JitCode {
+  size_t size;  /* size of the whole mapping */
+  size_t start;  /* offset of the entry function */
+  JitLoop *loops;  /* (writable) FOR loops of the prototype */
+  int nloops;
+  unsigned int entry[1];  /* offset of each instruction's code */
+} JitCode;
+
+
+typedef struct Fixup {
+  size_t pos;  /* position of a rel32 field */
+  int target;  /* target instruction (or TO_EXIT/TO_FRAME) */
+} Fixup;
+
+
+typedef struct JitState {
+  lu_byte *buf;  /* code being generated */
+  size_t n;  /* current position in 'buf' */
+  const Proto *p;
+  Fixup *fix;
+  int nfix;
+  unsigned int *entry;  /* offset of each instruction */
+  size_t exit, frame;  /* offsets of exit stubs */
+  JitLoop *loops;  /* next loops to be compiled */
+} JitState;
+
+
+
+/*
+** {======================================================
+** Instruction encoding
+** =======================================================
+*/
+
+static void e8 (JitState *J, int b) {
+  J->buf[J->n++] = cast(lu_byte, b);
+}
+
+
+static void e32 (JitState *J, lu_int32 x) {
+  memcpy(J->buf + J->n, &x, 4);
+  J->n += 4;
+}
+
+
+static void e64 (JitState *J, size_t x) {
+  memcpy(J->buf + J->n, &x, 8);
+  J->n += 8;
+}
+
+
+/* REX prefix (if needed) */
+static void rex (JitState *J, int w, int reg, int rm) {
+  int r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (r != 0x40) e8(J, r);
+}
+
+
+/*
+** instruction with a memory operand [base + disp32]; 'pfx' is a
+** mandatory prefix (or 0) and 'op' holds up to two opcode bytes
+*/
+static void emem (JitState *J, int pfx, int w, int op, int reg, int base,
+                  int disp) {
+  if (pfx) e8(J, pfx);
+  rex(J, w, reg, base);
+  if (op > 0xff) e8(J, op >> 8);
+  e8(J, op & 0xff);
+  e8(J, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) e8(J, 0x24);  /* SIB for rsp/r12 */
+  e32(J, cast(lu_int32, disp));
+}
+
+
+/* instruction with two register operands */
+static void ereg (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  if (pfx) e8(J, pfx);
+  rex(J, w, reg, rm);
+  if (op > 0xff) e8(J, op >> 8);
+  e8(J, op & 0xff);
+  e8(J, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/*
+** (these are functions, not macros, so that a memory operand can be
+** given by a single macro such as 'REG')
+*/
+static void ld64 (JitState *J, int r, int b, int d) {
+  emem(J, 0, 1, 0x8b, r, b, d);
+}
+
+
+static void st64 (JitState *J, int b, int d, int r) {
+  emem(J, 0, 1, 0x89, r, b, d);
+}
+
+
+static void ld32 (JitState *J, int r, int b, int d) {
+  emem(J, 0, 0, 0x8b, r, b, d);
+}
+
+
+/* movsd xmm, [b + d] */
+static void movsdld (JitState *J, int x, int b, int d) {
+  emem(J, 0xf2, 0, 0x0f10, x, b, d);
+}
+
+
+/* movsd [b + d], xmm */
+static void movsdst (JitState *J, int b, int d, int x) {
+  emem(J, 0xf2, 0, 0x0f11, x, b, d);
+}
+
+
+/* addsd/subsd/mulsd/divsd xmm, [b + d] */
+static void sdop (JitState *J, int op, int x, int b, int d) {
+  emem(J, 0xf2, 0, op, x, b, d);
+}
+
+
+#define mov64(J,dst,src)	ereg(J, 0, 1, 0x89, src, dst)
+#define xor64(J,dst,src)	ereg(J, 0, 1, 0x31, src, dst)
+#define movapd(J,x,y)		ereg(J, 0x66, 0, 0x0f28, x, y)
+#define movqx(J,x,r)		ereg(J, 0x66, 1, 0x0f6e, x, r)
+#define sdopr(J,op,x,y)		ereg(J, 0xf2, 0, op, x, y)
+#define ucomisd(J,x,y)		ereg(J, 0x66, 0, 0x0f2e, x, y)
+#define xorpd(J,x,y)		ereg(J, 0x66, 0, 0x0f57, x, y)
+#define movqr(J,r,x)		ereg(J, 0x66, 1, 0x0f7e, x, r)
+#define cvtsi2sd(J,x,r)		ereg(J, 0xf2, 1, 0x0f2a, x, r)
+#define cvttsd2si(J,r,x)	ereg(J, 0xf2, 1, 0x0f2c, r, x)
+#define cmp64(J,r,s)		ereg(J, 0, 1, 0x39, s, r)
+#define test64(J,r)		ereg(J, 0, 1, 0x85, r, r)
+#define neg64(J,r)		ereg(J, 0, 1, 0xf7, 3, r)
+
+/* SSE2 arithmetic opcodes */
+#define SD_ADD	0x0f58
+#define SD_MUL	0x0f59
+#define SD_SUB	0x0f5c
+#define SD_DIV	0x0f5e
+
+/* integer arithmetic opcodes (reg = reg op r/m) */
+#define I_ADD	0x03
+#define I_SUB	0x2b
+#define I_MUL	0x0faf
+
+
+/* mov dword [base + disp], imm32 */
+static void st32i (JitState *J, int base, int disp, int imm) {
+  emem(J, 0, 0, 0xc7, 0, base, disp);
+  e32(J, cast(lu_int32, imm));
+}
+
+
+/* cmp dword [base + disp], imm32 */
+static void cmp32i (JitState *J, int base, int disp, int imm) {
+  emem(J, 0, 0, 0x81, 7, base, disp);
+  e32(J, cast(lu_int32, imm));
+}
+
+
+/* cmp byte [base + disp], imm8 */
+static void cmp8i (JitState *J, int base, int disp, int imm) {
+  emem(J, 0, 0, 0x80, 7, base, disp);
+  e8(J, imm);
+}
+
+
+/* mov reg, imm64 */
+static void movi64 (JitState *J, int r, size_t imm) {
+  rex(J, 1, 0, r);
+  e8(J, 0xb8 + (r & 7));
+  e64(J, imm);
+}
+
+
+/* conditional jump with a rel32 to be patched; returns its position */
+static size_t jcc (JitState *J, int cc) {
+  e8(J, 0x0f); e8(J, 0x80 + cc);
+  e32(J, 0);
+  return J->n - 4;
+}
+
+
+static size_t jmp (JitState *J) {
+  e8(J, 0xe9);
+  e32(J, 0);
+  return J->n - 4;
+}
+
+
+/* make the rel32 at 'pos' jump to offset 'to' */
+static void patchto (JitState *J, size_t pos, size_t to) {
+  lu_int32 rel = cast(lu_int32, to - (pos + 4));
+  memcpy(J->buf + pos, &rel, 4);
+}
+
+
+#define patchhere(J,pos)	patchto(J, pos, (J)->n)
+
+
+static void addfix (JitState *J, size_t pos, int target) {
+  J->fix[J->nfix].pos = pos;
+  J->fix[J->nfix++].target = target;
+}
+
+
+#define jmpto(J,t)	addfix(J, jmp(J), t)
+#define jccto(J,cc,t)	addfix(J, jcc(J, cc), t)
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Runtime support
+** =======================================================
+*/
+
+#define RB(i)	(base+GETARG_B(i))
+#define RKB(i)	(ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
+#define RKC(i)	(ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+
+
+/*
+** runs instruction 'pc' for the native code through the generic VM
+** functions; returns the result of a comparison or, for a call,
+** whether a new LUA frame was pushed
+*/
+static int jit_op (LUA_State *L, CallInfo *ci, const Instruction *pc) {
+  Instruction i = *pc;
+  LClosure *cl = clLvalue(ci->func);
+  TValue *k = cl->p->k;
+  StkId base = ci->u.l.base;
+  StkId ra = base + GETARG_A(i);
+  OpCode op = GET_BASEOP(i);
+  ci->u.l.savedpc = pc + 1;  /* as the interpreter does */
+  switch (op) {
+    case OP_GETTABUP:
+      LUAV_gettable(L, cl->upvals[GETARG_B(i)]->v, RKC(i), ra);
+      break;
+    case OP_GETTABLE:
+      LUAV_gettable(L, RB(i), RKC(i), ra);
+      break;
+    case OP_SETTABUP:
+      LUAV_settable(L, cl->upvals[GETARG_A(i)]->v, RKB(i), RKC(i));
+      break;
+    case OP_SETUPVAL: {
+      UpVal *uv = cl->upvals[GETARG_B(i)];
+      setobj(L, uv->v, ra);
+      LUAC_barrier(L, uv, ra);
+      break;
+    }
+    case OP_SETTABLE:
+      LUAV_settable(L, ra, RKB(i), RKC(i));
+      break;
+    case OP_NEWTABLE: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      Table *t = LUAH_new(L);
+      sethvalue(L, ra, t);
+      if (b != 0 || c != 0)
+        LUAH_resize(L, t, LUAO_fb2int(b), LUAO_fb2int(c));
+      LUAC_condGC(L, {L->top = ra + 1; LUAC_step(L); L->top = ci->top;});
+      break;
+    }
+    case OP_NEWTABLEK: {  /* (only the short form; see 'instruction') */
+      Table *t = LUAH_new(L);
+      sethvalue(L, ra, t);
+      LUAH_copy(L, t, hvalue(k + GETARG_Bx(i)));
+      LUAC_condGC(L, {L->top = ra + 1; LUAC_step(L); L->top = ci->top;});
+      break;
+    }
+    case OP_SELF: {
+      StkId rb = RB(i);
+      setobjs2s(L, ra + 1, rb);
+      LUAV_gettable(L, rb, RKC(i), ra);
+      break;
+    }
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+    case OP_MOD: case OP_POW:
+      LUAV_arith(L, ra, RKB(i), RKC(i), cast(TMS, op - OP_ADD + TM_ADD));
+      break;
+    case OP_UNM:
+      LUAV_arith(L, ra, RB(i), RB(i), TM_UNM);
+      break;
+    case OP_NOT: {
+      int res = l_isfalse(RB(i));
+      setbvalue(ra, res);
+      break;
+    }
+    case OP_LEN:
+      LUAV_objlen(L, ra, RB(i));
+      break;
+    case OP_CONCAT: {
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      StkId rb;
+      L->top = base + c + 1;  /* mark the end of concat operands */
+      LUAV_concat(L, c - b + 1);
+      base = ci->u.l.base;
+      ra = base + GETARG_A(i);
+      rb = base + b;
+      setobjs2s(L, ra, rb);
+      LUAC_condGC(L, {L->top = (ra >= rb ? ra + 1 : rb); LUAC_step(L);});
+      L->top = ci->top;  /* restore top */
+      break;
+    }
+    case OP_JMP:  /* only to close upvalues */
+      LUAF_close(L, ci->u.l.base + GETARG_A(i) - 1);
+      break;
+    case OP_FORPREP:
+      LUAV_forprep(L, ra);
+      break;
+    case OP_EQ: {
+      TValue *rb = RKB(i);
+      TValue *rc = RKC(i);
+      return equalobj(L, rb, rc);
+    }
+    case OP_LT:
+      return LUAV_lessthan(L, RKB(i), RKC(i));
+    case OP_LE:
+      return LUAV_lessequal(L, RKB(i), RKC(i));
+    case OP_CALL: {
+      int b = GETARG_B(i);
+      int nresults = GETARG_C(i) - 1;
+      if (b != 0) L->top = ra + b;  /* else previous instruction set top */
+      if (LUAV_fastlcf(L, ra)) {
+        LUAV_calllcf(L, ra, nresults);
+        if (nresults >= 0) L->top = ci->top;
+        return 0;
+      }
+      if (LUAD_precall(L, ra, nresults)) {  /* C function? */
+        if (nresults >= 0) L->top = ci->top;  /* adjust results */
+        return 0;
+      }
+      return 1;  /* LUA function: interpreter must run the new frame */
+    }
+    case OP_TFORCALL: {
+      StkId cb = ra + 3;  /* call base */
+      setobjs2s(L, cb + 2, ra + 2);
+      setobjs2s(L, cb + 1, ra + 1);
+      setobjs2s(L, cb, ra);
+      L->top = cb + 3;  /* func. + 2 args (state and index) */
+      LUAD_call(L, cb, GETARG_C(i), 1);
+      L->top = ci->top;
+      break;
+    }
+    default: LUA_assert(0);
+  }
+  return 0;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Traces of numeric FOR loops
+** =======================================================
+*/
+
+/*
+** When the back edge of a FOR loop gets hot in native code, the path
+** its body takes is recorded from the current values of the registers.
+** Only moves, number constants, arithmetic and comparisons (which
+** become guards on the recorded outcome) may appear in the path. The
+** trace keeps every LUA register it touches unboxed in an SSE register
+** (integers as their raw bits): as the type each register gets is
+** fixed by the recorded path, the types of the registers it reads are
+** checked once on entry; integer overflow and an integer compared with
+** a float it does not convert to exactly leave the trace; operations
+** on known constants are folded; and the first iteration is peeled, so
+** that in the loop copy every register has been set when a guard
+** fails. On any exit (a failed
+** guard, the end of the loop or a hook) the trace boxes the registers
+** back into the stack and returns the instruction where the native
+** code of the prototype goes on.
+**
+** Trace register usage:
+**   rdi = base, rsi = L, rax/rcx/xmm0/xmm1 = scratch,
+**   xmm2-xmm15 = registers, rdx/r8-r11 = registers holding integers only
+*/
+
+#define MAXTRACE	128	/* maximum length of a recorded path */
+#define MAXTRACEREG	14	/* registers kept in xmm2-xmm15 */
+#define XMM(h)		((h) + 2)
+
+/* at most three exits for each instruction of each copy, plus entry */
+#define MAXTRACEEXITS	(6 * MAXTRACE + MAXTRACEREG + 8)
+
+/* maximum size of the code of one traced instruction and of one exit */
+#define MAXTRACEINS	96
+#define MAXTRACEEXIT	(MAXTRACEREG * 32 + 32)
+
+/* failed entries before a trace is dropped */
+#define MAXENTRYFAIL	16
+
+
+typedef struct TraceIns {
+  Instruction i;
+  int pc;
+  int res;  /* recorded outcome of a comparison */
+  int exitpc;  /* where to go on the other outcome */
+} TraceIns;
+
+
+/* state of the traced registers at some point */
+typedef struct Snapshot {
+  lu_byte valid[MAXTRACEREG];  /* register was loaded or set? */
+  lu_byte isint[MAXTRACEREG];  /* register holds an integer? */
+  lu_byte isk[MAXTRACEREG];  /* register holds a known constant? */
+  TValue k[MAXTRACEREG];  /* ...its value */
+} Snapshot;
+
+
+typedef struct TraceExit {
+  size_t pos;  /* jump to be patched */
+  int pc;  /* where to go on (-1 for a failed entry) */
+  Snapshot s;
+} TraceExit;
+
+
+typedef struct TraceState {
+  JitState J;
+  LUA_State *L;
+  const Proto *p;
+  int start;  /* first instruction of the loop body */
+  int loop;  /* the FORLOOP instruction */
+  int a;  /* base register of the loop */
+  int stepgt0;  /* recorded sign of the step */
+  int intloop;  /* recorded variant of the control values */
+  int nins;
+  int nreg;
+  int nexit;
+  int home[MAXSTACK];  /* index of each LUA register (or -1) */
+  int reg[MAXTRACEREG];  /* LUA register of each index */
+  lu_byte livein[MAXTRACEREG];  /* register read before set? */
+  lu_byte entryint[MAXTRACEREG];  /* ...and then it held an integer? */
+  lu_byte flt[MAXTRACEREG];  /* register ever holds a float? */
+  int gpr[MAXTRACEREG];  /* general register of an integer one (or -1) */
+  TValue val[MAXTRACEREG];  /* current values while recording */
+  Snapshot cur;  /* current state while generating code */
+  TraceIns ins[MAXTRACE];
+  TraceExit exit[MAXTRACEEXITS];
+} TraceState;
+
+
+/* arithmetic on numbers exactly as the interpreter does it */
+static void foldarith (OpCode op, const TValue *b, const TValue *c,
+                       TValue *res) {
+  int aop = (op == OP_UNM) ? LUA_OPUNM : op - OP_ADD + LUA_OPADD;
+  LUA_Integer i;
+  if (ttisinteger(b) && ttisinteger(c) &&
+      LUAO_intarith(aop, ivalue(b), ivalue(c), &i)) {
+    setivalue(res, i);
+  }
+  else {
+    LUA_Number n = LUAO_arith(aop, nvalue(b), nvalue(c));
+    setnvalue(res, n);
+  }
+}
+
+
+static int sdcode (OpCode op) {
+  switch (op) {
+    case OP_ADD: return SD_ADD;
+    case OP_SUB: return SD_SUB;
+    case OP_MUL: return SD_MUL;
+    default: return SD_DIV;
+  }
+}
+
+
+/* index of register 'r' (allocating one); -1 if too many */
+static int gethome (TraceState *T, int r) {
+  if (T->home[r] < 0) {
+    if (T->nreg == MAXTRACEREG) return -1;
+    T->reg[T->nreg] = r;
+    T->livein[T->nreg] = 0;
+    T->flt[T->nreg] = 0;
+    T->home[r] = T->nreg++;
+  }
+  return T->home[r];
+}
+
+
+/* value of RK operand 'x' while recording; 0 if not a number */
+static int recread (TraceState *T, StkId base, int x, TValue *v) {
+  if (ISK(x)) {
+    const TValue *o = T->p->k + INDEXK(x);
+    if (!ttisnumber(o)) return 0;
+    *v = *o;
+  }
+  else {
+    int fresh = (T->home[x] < 0);
+    int h = gethome(T, x);
+    if (h < 0) return 0;
+    if (fresh) {  /* read before set: value comes from the stack */
+      if (!ttisnumber(base + x)) return 0;
+      T->livein[h] = 1;
+      T->entryint[h] = ttisinteger(base + x);
+      T->flt[h] = !T->entryint[h];
+      T->val[h] = *(base + x);
+    }
+    *v = T->val[h];
+  }
+  return 1;
+}
+
+
+static int recwrite (TraceState *T, int r, const TValue *v) {
+  int h = gethome(T, r);
+  if (h < 0) return 0;
+  T->val[h] = *v;
+  T->flt[h] |= !ttisinteger(v);
+  return 1;
+}
+
+
+/* whether integer constant 'x' (if any) converts exactly to a float */
+static int exactk (TraceState *T, int x) {
+  const TValue *o;
+  if (!ISK(x)) return 1;
+  o = T->p->k + INDEXK(x);
+  return !ttisinteger(o) ||
+         cast(LUA_Integer, cast_num(ivalue(o))) == ivalue(o);
+}
+
+
+/*
+** registers that only ever hold integers live in general registers,
+** the index and the external index of the loop first (the limit and
+** the step are read once per iteration and stay out of the way)
+*/
+static void allocgpr (TraceState *T) {
+  static const int gprs[] = {RDX, R8, R9, R10, R11};
+  int ng = 0;
+  int pass, h;
+  for (h = 0; h < T->nreg; h++)
+    T->gpr[h] = -1;
+  for (pass = 0; pass < 2; pass++) {
+    for (h = 0; h < T->nreg && ng < cast_int(sizeof(gprs)/sizeof(gprs[0]));
+         h++) {
+      int ctl = (T->reg[h] == T->a + 1 || T->reg[h] == T->a + 2);
+      if (!T->flt[h] && T->gpr[h] < 0 && ctl == pass)
+        T->gpr[h] = gprs[ng++];
+    }
+  }
+}
+
+
+/*
+** record the path of the loop body from the values in 'base'; returns
+** 0 if it cannot be traced
+*/
+static int record (TraceState *T, StkId base) {
+  const Instruction *code = T->p->code;
+  int pc = T->start;
+  TValue vb, vc, vr;
+  int n, h;
+  for (n = 0; n < 4; n++)  /* control registers: all numbers now */
+    recread(T, base, T->a + n, &vb);
+  T->intloop = ttisinteger(base + T->a);
+  setivalue(&vr, 0);
+  T->stepgt0 = LUAV_lessthan(T->L, &vr, &T->val[T->home[T->a + 2]]);
+  while (pc != T->loop) {
+    Instruction i;
+    TraceIns *ti;
+    int a;
+    OpCode op;
+    if (pc < T->start || pc > T->loop || T->nins == MAXTRACE) return 0;
+    i = code[pc];
+    a = GETARG_A(i);
+    op = GET_BASEOP(i);
+    ti = &T->ins[T->nins++];
+    ti->i = i;
+    ti->pc = pc;
+    switch (op) {
+      case OP_MOVE:
+        if (!recread(T, base, GETARG_B(i), &vb) || !recwrite(T, a, &vb))
+          return 0;
+        pc++;
+        break;
+      case OP_LOADK: {
+        const TValue *o = T->p->k + GETARG_Bx(i);
+        if (!ttisnumber(o) || !recwrite(T, a, o)) return 0;
+        pc++;
+        break;
+      }
+      case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+        if (!recread(T, base, GETARG_B(i), &vb) ||
+            !recread(T, base, GETARG_C(i), &vc))
+          return 0;
+        foldarith(op, &vb, &vc, &vr);
+        if (!recwrite(T, a, &vr)) return 0;
+        pc++;
+        break;
+      case OP_UNM:
+        if (!recread(T, base, GETARG_B(i), &vb)) return 0;
+        foldarith(op, &vb, &vb, &vr);
+        if (!recwrite(T, a, &vr)) return 0;
+        pc++;
+        break;
+      case OP_EQ: case OP_LT: case OP_LE: {
+        Instruction j = code[pc + 1];
+        int target = pc + 2 + GETARG_sBx(j);
+        if (GET_OPCODE(j) != OP_JMP || GETARG_A(j) != 0 || target <= pc ||
+            !recread(T, base, GETARG_B(i), &vb) ||
+            !recread(T, base, GETARG_C(i), &vc) ||
+            !exactk(T, GETARG_B(i)) || !exactk(T, GETARG_C(i)))
+          return 0;
+        ti->res = (op == OP_EQ) ? LUAV_rawequalobj(&vb, &vc)
+                : (op == OP_LT) ? LUAV_lessthan(T->L, &vb, &vc)
+                : LUAV_lessequal(T->L, &vb, &vc);
+        if (ti->res != a) {  /* skip the jump */
+          ti->exitpc = target;
+          pc += 2;
+        }
+        else {
+          ti->exitpc = pc + 2;
+          pc = target;
+        }
+        break;
+      }
+      case OP_JMP: {
+        /* (upvalues of body locals are closed before every back edge,
+           and a trace opens none, so closing them here does nothing) */
+        int target = pc + 1 + GETARG_sBx(i);
+        if (target <= pc) return 0;
+        T->nins--;  /* nothing to generate */
+        pc = target;
+        break;
+      }
+      default:
+        return 0;
+    }
+  }
+  for (h = 0; h < T->nreg; h++) {  /* types must hold for every iteration */
+    int r = T->reg[h];
+    if (T->livein[h] && (r < T->a || r > T->a + 3) &&
+        ttisinteger(&T->val[h]) != T->entryint[h])
+      return 0;
+  }
+  allocgpr(T);
+  return 1;
+}
+
+
+/* load number 'o' into SSE register 'x' (through rax) */
+static void ldconst (JitState *J, int x, const TValue *o) {
+  size_t bits;
+  memcpy(&bits, &val_(o), sizeof(bits));
+  movi64(J, RAX, bits);
+  movqx(J, x, RAX);
+}
+
+
+/* load number 'o' into the home of index 'h' */
+static void ldhome (TraceState *T, int h, const TValue *o) {
+  if (T->gpr[h] >= 0)
+    movi64(&T->J, T->gpr[h], cast(size_t, ivalue(o)));
+  else
+    ldconst(&T->J, XMM(h), o);
+}
+
+
+/* leave the trace on condition 'cc' going to 'pc' */
+static void traceexit (TraceState *T, int cc, int pc) {
+  TraceExit *e = &T->exit[T->nexit++];
+  e->pos = jcc(&T->J, cc);
+  e->pc = pc;
+  e->s = T->cur;
+}
+
+
+static void setconst (TraceState *T, int r, const TValue *v) {
+  int h = T->home[r];
+  T->cur.valid[h] = 1;
+  T->cur.isint[h] = ttisinteger(v);
+  T->cur.isk[h] = 1;
+  T->cur.k[h] = *v;
+}
+
+
+static void setreg (TraceState *T, int r, int isint) {
+  int h = T->home[r];
+  T->cur.valid[h] = 1;
+  T->cur.isint[h] = cast_byte(isint);
+  T->cur.isk[h] = 0;
+}
+
+
+/* whether RK operand 'x' is a known constant (put in 'v') */
+static int traceconst (TraceState *T, int x, TValue *v) {
+  int h;
+  if (ISK(x)) {
+    *v = T->p->k[INDEXK(x)];
+    return 1;
+  }
+  h = T->home[x];
+  *v = T->cur.k[h];
+  return T->cur.isk[h];
+}
+
+
+/* whether RK operand 'x' is an integer */
+static int traceint (TraceState *T, int x) {
+  if (ISK(x)) return ttisinteger(T->p->k + INDEXK(x));
+  return T->cur.isint[T->home[x]];
+}
+
+
+/*
+** SSE register with RK operand 'x' as a float, converting integers and
+** loading constants into 'scratch'; with 'exitpc' >= 0, the trace
+** leaves there when an integer is not exact as a float
+*/
+static int tracearg (TraceState *T, int x, int scratch, int exitpc) {
+  JitState *J = &T->J;
+  TValue v;
+  if (traceconst(T, x, &v)) {
+    setnvalue(&v, nvalue(&v));
+    ldconst(J, scratch, &v);
+    return scratch;
+  }
+  else if (traceint(T, x)) {
+    int r = T->gpr[T->home[x]];
+    if (r < 0) {
+      r = RAX;
+      movqr(J, RAX, XMM(T->home[x]));
+    }
+    cvtsi2sd(J, scratch, r);
+    if (exitpc >= 0) {
+      cvttsd2si(J, RCX, scratch);
+      cmp64(J, RCX, r);
+      traceexit(T, CC_NE, exitpc);
+    }
+    return scratch;
+  }
+  return XMM(T->home[x]);
+}
+
+
+/* put integer RK operand 'x' into general register 'r' */
+static void intget (TraceState *T, int x, int r) {
+  TValue v;
+  if (traceconst(T, x, &v))
+    movi64(&T->J, r, cast(size_t, ivalue(&v)));
+  else if (T->gpr[T->home[x]] >= 0) {
+    if (T->gpr[T->home[x]] != r) mov64(&T->J, r, T->gpr[T->home[x]]);
+  }
+  else
+    movqr(&T->J, r, XMM(T->home[x]));
+}
+
+
+/* rax = rax 'iop' integer RK operand 'x' (an 'iop' of 0 compares) */
+static void intop (TraceState *T, int iop, int x) {
+  TValue v;
+  int r = (traceconst(T, x, &v)) ? -1 : T->gpr[T->home[x]];
+  if (r < 0) {
+    intget(T, x, RCX);
+    r = RCX;
+  }
+  if (iop == 0) cmp64(&T->J, RAX, r);
+  else ereg(&T->J, 0, 1, iop, RAX, r);
+}
+
+
+/* store integer in rax into register 'r' */
+static void intset (TraceState *T, int r) {
+  int h = T->home[r];
+  if (T->gpr[h] >= 0) mov64(&T->J, T->gpr[h], RAX);
+  else movqx(&T->J, XMM(h), RAX);
+  setreg(T, r, 1);
+}
+
+
+static void traceins (TraceState *T, const TraceIns *ti) {
+  static const int intcc[] = {CC_E, CC_L, CC_LE};
+  JitState *J = &T->J;
+  Instruction i = ti->i;
+  OpCode op = GET_BASEOP(i);
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  TValue vb, vc, vr;
+  switch (op) {
+    case OP_MOVE:
+      if (traceconst(T, b, &vb))
+        setconst(T, a, &vb);
+      else if (a == b)
+        break;
+      else if (T->gpr[T->home[a]] < 0 && T->gpr[T->home[b]] < 0) {
+        movapd(J, XMM(T->home[a]), XMM(T->home[b]));
+        setreg(T, a, T->cur.isint[T->home[b]]);
+      }
+      else {  /* (both hold integers) */
+        intget(T, b, RAX);
+        intset(T, a);
+      }
+      break;
+    case OP_LOADK:
+      setconst(T, a, T->p->k + GETARG_Bx(i));
+      break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+      if (traceconst(T, b, &vb) && traceconst(T, c, &vc)) {
+        foldarith(op, &vb, &vc, &vr);
+        setconst(T, a, &vr);
+      }
+      else if (op != OP_DIV && traceint(T, b) && traceint(T, c)) {
+        /* on overflow (or a zero product) the interpreter redoes it */
+        intget(T, b, RAX);
+        intop(T, (op == OP_ADD) ? I_ADD : (op == OP_SUB) ? I_SUB : I_MUL, c);
+        traceexit(T, CC_O, ti->pc);
+        if (op == OP_MUL) {
+          test64(J, RAX);
+          traceexit(T, CC_E, ti->pc);
+        }
+        intset(T, a);
+      }
+      else {
+        int x = tracearg(T, b, 0, -1);
+        if (x != 0) movapd(J, 0, x);
+        sdopr(J, sdcode(op), 0, tracearg(T, c, 1, -1));
+        movapd(J, XMM(T->home[a]), 0);
+        setreg(T, a, 0);
+      }
+      break;
+    case OP_UNM:
+      if (traceconst(T, b, &vb)) {
+        foldarith(op, &vb, &vb, &vr);
+        setconst(T, a, &vr);
+      }
+      else if (traceint(T, b)) {
+        intget(T, b, RAX);
+        neg64(J, RAX);
+        traceexit(T, CC_O, ti->pc);  /* minimum integer */
+        traceexit(T, CC_E, ti->pc);  /* -0 is a float */
+        intset(T, a);
+      }
+      else {
+        movapd(J, 0, XMM(T->home[b]));
+        movi64(J, RAX, cast(size_t, 1) << 63);
+        movqx(J, 1, RAX);
+        xorpd(J, 0, 1);  /* flip sign bit */
+        movapd(J, XMM(T->home[a]), 0);
+        setreg(T, a, 0);
+      }
+      break;
+    case OP_EQ: case OP_LT: case OP_LE: {
+      int x, y;
+      if (traceconst(T, b, &vb) && traceconst(T, c, &vc))
+        break;  /* outcome is the recorded one */
+      if (traceint(T, b) && traceint(T, c)) {
+        int cc = intcc[op - OP_EQ];
+        intget(T, b, RAX);
+        intop(T, 0, c);
+        traceexit(T, ti->res ? cc ^ 1 : cc, ti->exitpc);
+        break;
+      }
+      /* (an integer that is not exact as a float goes to the interpreter) */
+      x = tracearg(T, b, 0, ti->pc);
+      y = tracearg(T, c, 1, ti->pc);
+      if (op == OP_EQ) {
+        ucomisd(J, x, y);
+        if (ti->res) {
+          traceexit(T, CC_P, ti->exitpc);
+          traceexit(T, CC_NE, ti->exitpc);
+        }
+        else {
+          size_t nan = jcc(J, CC_P);
+          traceexit(T, CC_E, ti->exitpc);
+          patchhere(J, nan);
+        }
+      }
+      else {  /* compare 'c' against 'b' so that NaN gives false */
+        int cc = (op == OP_LT) ? CC_A : CC_AE;
+        ucomisd(J, y, x);
+        traceexit(T, ti->res ? cc ^ 1 : cc, ti->exitpc);
+      }
+      break;
+    }
+    default: LUA_assert(0);
+  }
+}
+
+
+/* end of an iteration: the FORLOOP itself */
+static void traceloop (TraceState *T) {
+  JitState *J = &T->J;
+  int a = T->a;
+  int idx = XMM(T->home[a]);
+  int limit = XMM(T->home[a + 1]);
+  int step = XMM(T->home[a + 2]);
+  int h;
+  for (h = 0; h < T->nreg; h++) {  /* next iteration needs all registers */
+    if (T->cur.isk[h]) {
+      ldhome(T, h, &T->cur.k[h]);
+      T->cur.isk[h] = 0;
+    }
+  }
+  if (T->intloop) {  /* (FORPREP ensured that the index cannot overflow) */
+    intget(T, a, RAX);
+    intop(T, I_ADD, a + 2);
+    intop(T, 0, a + 1);
+    traceexit(T, T->stepgt0 ? CC_G : CC_L, T->loop + 1);  /* loop ended? */
+    intset(T, a);  /* update internal index... */
+    intset(T, a + 3);  /* ...and external index */
+  }
+  else {
+    movapd(J, 0, idx);
+    sdopr(J, SD_ADD, 0, step);
+    if (T->stepgt0) ucomisd(J, limit, 0);
+    else ucomisd(J, 0, limit);
+    traceexit(T, CC_B, T->loop + 1);  /* loop ended (or NaN)? */
+    movapd(J, idx, 0);  /* update internal index... */
+    movapd(J, XMM(T->home[a + 3]), 0);  /* ...and external index */
+    setreg(T, a + 3, 0);
+  }
+  cmp8i(J, RSI, cast_int(offsetof(LUA_State, hookmask)), 0);
+  traceexit(T, CC_NE, T->start);
+}
+
+
+/* box the registers of exit 'e' back into the stack and return */
+static void tracestub (TraceState *T, const TraceExit *e) {
+  JitState *J = &T->J;
+  int h;
+  for (h = 0; h < T->nreg; h++) {
+    int d = T->reg[h] * TVSIZE;
+    if (!e->s.valid[h]) continue;
+    if (e->s.isk[h]) {
+      size_t bits;
+      memcpy(&bits, &val_(&e->s.k[h]), sizeof(bits));
+      movi64(J, RAX, bits);
+      st64(J, RDI, d, RAX);
+    }
+    else if (T->gpr[h] >= 0)
+      st64(J, RDI, d, T->gpr[h]);
+    else
+      movsdst(J, RDI, d, XMM(h));
+    st32i(J, RDI, d + TTOFF, e->s.isint[h] ? LUA_TNUMINT : LUA_TNUMFLT);
+  }
+  e8(J, 0xb8); e32(J, cast(lu_int32, e->pc));  /* mov eax, pc */
+  e8(J, 0xc3);  /* ret */
+}
+
+
+static void tracecode (TraceState *T, JitLoop *lp) {
+  JitState *J = &T->J;
+  size_t failed, head, pos;
+  int h, n;
+  memset(&T->cur, 0, sizeof(T->cur));
+  for (h = 0; h < T->nreg; h++) {  /* hoisted type guards */
+    int r = T->reg[h];
+    if (T->livein[h] && (r < T->a + 1 || r > T->a + 3)) {
+      cmp32i(J, RDI, r * TVSIZE + TTOFF,
+             T->entryint[h] ? LUA_TNUMINT : LUA_TNUMFLT);
+      traceexit(T, CC_NE, -1);
+    }
+  }
+  if (T->intloop) {  /* step sign guard */
+    ld64(J, RAX, RDI, (T->a + 2) * TVSIZE);
+    test64(J, RAX);
+    traceexit(T, T->stepgt0 ? CC_LE : CC_G, -1);
+  }
+  else {
+    xorpd(J, 0, 0);
+    movsdld(J, 1, RDI, (T->a + 2) * TVSIZE);
+    ucomisd(J, 1, 0);
+    traceexit(T, T->stepgt0 ? CC_BE : CC_A, -1);
+  }
+  for (h = 0; h < T->nreg; h++) {  /* unbox live-in registers */
+    if (T->livein[h]) {
+      if (T->gpr[h] >= 0) ld64(J, T->gpr[h], RDI, T->reg[h] * TVSIZE);
+      else movsdld(J, XMM(h), RDI, T->reg[h] * TVSIZE);
+      T->cur.valid[h] = 1;
+      T->cur.isint[h] = T->entryint[h];
+    }
+  }
+  for (n = 0; n < T->nins; n++)  /* peeled iteration */
+    traceins(T, &T->ins[n]);
+  traceloop(T);
+  head = J->n;
+  for (n = 0; n < T->nins; n++)  /* loop */
+    traceins(T, &T->ins[n]);
+  traceloop(T);
+  patchto(J, jmp(J), head);
+  /* a failed entry has nothing to store */
+  failed = J->n;
+  movi64(J, RAX, cast(size_t, lp));
+  emem(J, 0, 0, 0xff, 1, RAX, cast_int(offsetof(JitLoop, nexit)));  /* dec */
+  pos = jcc(J, CC_NE);
+  emem(J, 0, 1, 0xc7, 0, RAX, cast_int(offsetof(JitLoop, f)));  /* f = 0 */
+  e32(J, 0);
+  patchhere(J, pos);
+  e8(J, 0xb8); e32(J, cast(lu_int32, T->start));  /* mov eax, start */
+  e8(J, 0xc3);  /* ret */
+  for (n = 0; n < T->nexit; n++) {
+    TraceExit *e = &T->exit[n];
+    if (e->pc < 0)
+      patchto(J, e->pos, failed);
+    else {
+      patchhere(J, e->pos);
+      tracestub(T, e);
+    }
+  }
+}
+
+
+/*
+** try to record and compile a trace for loop 'lp' of the (native) frame
+** 'ci', which is at the back edge of that loop
+*/
+static void jit_record (LUA_State *L, CallInfo *ci, JitLoop *lp) {
+  const Proto *p = clLvalue(ci->func)->p;
+  Instruction i = p->code[lp->pc];
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  size_t size, used;
+  TraceState *T;
+  lu_byte *mem;
+  int n;
+  lp->hot = MAX_INT;  /* never try again */
+  T = LUAM_new(L, TraceState);
+  T->L = L;
+  T->p = p;
+  T->loop = lp->pc;
+  T->start = lp->pc + 1 + GETARG_sBx(i);
+  T->a = GETARG_A(i);
+  T->nins = T->nreg = T->nexit = 0;
+  for (n = 0; n < MAXSTACK; n++)
+    T->home[n] = -1;
+  if (!record(T, ci->u.l.base)) {
+    LUAM_free(L, T);
+    return;
+  }
+  size = 1024 + 2 * (T->nins * MAXTRACEINS + MAXTRACEREG * 16 + 128) +
+         (6 * T->nins + MAXTRACEREG + 8) * MAXTRACEEXIT;
+  size = (size + page - 1) & ~(page - 1);
+  mem = cast(lu_byte *, mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (mem == MAP_FAILED) {
+    LUAM_free(L, T);
+    return;
+  }
+  T->J.buf = mem;
+  T->J.n = 0;
+  T->J.p = p;
+  tracecode(T, lp);
+  LUA_assert(T->J.n <= size);
+  used = (T->J.n + page - 1) & ~(page - 1);
+  LUAM_free(L, T);
+  if (used < size) {
+    munmap(mem + used, size - used);
+    size = used;
+  }
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    return;
+  }
+  lp->mem = mem;
+  lp->size = size;
+  lp->nexit = MAXENTRYFAIL;
+  lp->f = mem;
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+/* address of register 'r' */
+#define REG(r)		RBX, (r) * TVSIZE
+
+
+/* base register and displacement of RK operand 'x' */
+static void rkaddr (int x, int *b, int *d) {
+  if (ISK(x)) { *b = RBP; *d = INDEXK(x) * TVSIZE; }
+  else { *b = RBX; *d = x * TVSIZE; }
+}
+
+
+/* copy a TValue through rcx/rdx */
+static void copytv (JitState *J, int db, int dd, int sb, int sd) {
+  ld64(J, RCX, sb, sd);
+  ld64(J, RDX, sb, sd + 8);
+  st64(J, db, dd, RCX);
+  st64(J, db, dd + 8, RDX);
+}
+
+
+/* leave native code, resuming the interpreter at instruction 'pc' */
+static void exitat (JitState *J, int pc) {
+  movi64(J, RAX, cast(size_t, J->p->code + pc));
+  jmpto(J, TO_EXIT);
+}
+
+
+/* call 'jit_op' for instruction 'pc'; reloads base afterwards */
+static void callop (JitState *J, int pc) {
+  mov64(J, RDI, R12);
+  mov64(J, RSI, R13);
+  movi64(J, RDX, cast(size_t, J->p->code + pc));
+  movi64(J, RAX, cast(size_t, &jit_op));
+  e8(J, 0xff); e8(J, 0xd0);  /* call rax */
+  ld64(J, RBX, R13, CI_BASE);
+}
+
+
+/* test eax, eax */
+static void testeax (JitState *J) {
+  e8(J, 0x85); e8(J, 0xc0);
+}
+
+
+/* jump back to instruction 'target', leaving if a hook was set */
+static void backedge (JitState *J, int target) {
+  size_t j;
+  cmp8i(J, R12, cast_int(offsetof(LUA_State, hookmask)), 0);
+  j = jcc(J, CC_E);
+  exitat(J, target);
+  patchhere(J, j);
+  jmpto(J, target);
+}
+
+
+/* type guard on a TValue; returns jump to be patched on failure */
+static size_t istag (JitState *J, int b, int d, int tag) {
+  cmp32i(J, b, d + TTOFF, tag);
+  return jcc(J, CC_NE);
+}
+
+
+static size_t isnum (JitState *J, int b, int d) {  /* float guard */
+  return istag(J, b, d, LUA_TNUMFLT);
+}
+
+
+static size_t isint (JitState *J, int b, int d) {
+  return istag(J, b, d, LUA_TNUMINT);
+}
+
+
+/*
+** arithmetic on two floats or, with integer opcode 'iop' (if not 0),
+** on two integers; an overflow (or a zero product, which could be -0)
+** goes to the slow path like any other operand
+*/
+static void arith (JitState *J, int pc, Instruction i, int sdcode, int iop) {
+  int bb, bd, cb, cd;
+  int a = GETARG_A(i);
+  size_t f1, f2, done, idone = 0, slow[4];
+  int n, ns = 0;
+  rkaddr(GETARG_B(i), &bb, &bd);
+  rkaddr(GETARG_C(i), &cb, &cd);
+  f1 = isnum(J, bb, bd);
+  f2 = isnum(J, cb, cd);
+  movsdld(J, 0, bb, bd);
+  sdop(J, sdcode, 0, cb, cd);
+  movsdst(J, REG(a), 0);
+  st32i(J, RBX, a * TVSIZE + TTOFF, LUA_TNUMFLT);
+  done = jmp(J);
+  patchhere(J, f1);
+  if (iop) {  /* two integers? */
+    slow[ns++] = isint(J, bb, bd);
+    slow[ns++] = isint(J, cb, cd);
+    ld64(J, RAX, bb, bd);
+    emem(J, 0, 1, iop, RAX, cb, cd);
+    slow[ns++] = jcc(J, CC_O);
+    if (iop == I_MUL) {
+      test64(J, RAX);
+      slow[ns++] = jcc(J, CC_E);
+    }
+    st64(J, REG(a), RAX);
+    st32i(J, RBX, a * TVSIZE + TTOFF, LUA_TNUMINT);
+    idone = jmp(J);
+  }
+  patchhere(J, f2);
+  for (n = 0; n < ns; n++)
+    patchhere(J, slow[n]);
+  callop(J, pc);
+  patchhere(J, done);
+  if (iop) patchhere(J, idone);
+}
+
+
+static void compare (JitState *J, int pc, Instruction i, OpCode op) {
+  static const int intcc[] = {CC_E, CC_L, CC_LE};
+  int bb, bd, cb, cd;
+  size_t f1, f2, f3;
+  /* a true comparison equal to A runs the following jump */
+  int ontrue = GETARG_A(i) ? pc + 1 : pc + 2;
+  int onfalse = GETARG_A(i) ? pc + 2 : pc + 1;
+  rkaddr(GETARG_B(i), &bb, &bd);
+  rkaddr(GETARG_C(i), &cb, &cd);
+  f1 = isnum(J, bb, bd);
+  f2 = isnum(J, cb, cd);
+  movsdld(J, 0, bb, bd);
+  movsdld(J, 1, cb, cd);
+  if (op == OP_EQ) {
+    ucomisd(J, 0, 1);
+    jccto(J, CC_P, onfalse);  /* NaN */
+    jccto(J, CC_E, ontrue);
+  }
+  else {  /* compare 'c' against 'b' so that NaN gives false */
+    ucomisd(J, 1, 0);
+    jccto(J, (op == OP_LT) ? CC_A : CC_AE, ontrue);
+  }
+  jmpto(J, onfalse);
+  patchhere(J, f1);  /* two integers? */
+  f1 = isint(J, bb, bd);
+  f3 = isint(J, cb, cd);
+  ld64(J, RAX, bb, bd);
+  emem(J, 0, 1, 0x3b, RAX, cb, cd);  /* cmp rax, [c] */
+  jccto(J, intcc[op - OP_EQ], ontrue);
+  jmpto(J, onfalse);
+  patchhere(J, f1); patchhere(J, f2); patchhere(J, f3);
+  callop(J, pc);
+  testeax(J);
+  jccto(J, CC_NE, ontrue);
+  jmpto(J, onfalse);
+}
+
+
+/*
+** jumps to 'onfalse' if value at [b + d] is false (nil or false) and
+** to 'ontrue' otherwise; 'copy' (if >= 0) is a register that gets the
+** value before going to 'copyon'
+*/
+static void branchtv (JitState *J, int b, int d, int ontrue, int onfalse,
+                      int copy, int copyon) {
+  size_t isnil, notbool, isfalse;
+  ld32(J, RAX, b, d + TTOFF);
+  testeax(J);
+  isnil = jcc(J, CC_E);  /* LUA_TNIL == 0 */
+  e8(J, 0x83); e8(J, 0xf8); e8(J, LUA_TBOOLEAN);  /* cmp eax, imm8 */
+  notbool = jcc(J, CC_NE);
+  cmp32i(J, b, d, 0);
+  isfalse = jcc(J, CC_E);
+  patchhere(J, notbool);
+  if (copy >= 0 && copyon == ontrue) copytv(J, REG(copy), b, d);
+  jmpto(J, ontrue);
+  patchhere(J, isnil); patchhere(J, isfalse);
+  if (copy >= 0 && copyon == onfalse) copytv(J, REG(copy), b, d);
+  jmpto(J, onfalse);
+}
+
+
+static void forloop (JitState *J, int pc, Instruction i) {
+  int a = GETARG_A(i);
+  int target = pc + 1 + GETARG_sBx(i);
+  size_t pos, l1, l2, flt, done;
+  JitLoop *lp;
+  flt = isint(J, REG(a));  /* (FORPREP makes all control values alike) */
+  ld64(J, RAX, REG(a));
+  ld64(J, RCX, REG(a + 2));
+  ereg(J, 0, 1, I_ADD, RAX, RCX);  /* idx += step (cannot overflow) */
+  test64(J, RCX);
+  pos = jcc(J, CC_G);  /* step > 0? */
+  emem(J, 0, 1, 0x3b, RAX, REG(a + 1));  /* cmp idx, limit */
+  jccto(J, CC_L, pc + 1);
+  l1 = jmp(J);
+  patchhere(J, pos);
+  emem(J, 0, 1, 0x3b, RAX, REG(a + 1));
+  jccto(J, CC_G, pc + 1);
+  patchhere(J, l1);
+  st64(J, REG(a), RAX);  /* update internal index... */
+  st64(J, REG(a + 3), RAX);  /* ...and external index */
+  st32i(J, RBX, (a + 3) * TVSIZE + TTOFF, LUA_TNUMINT);
+  done = jmp(J);
+  patchhere(J, flt);
+  movsdld(J, 0, REG(a));
+  movsdld(J, 1, REG(a + 2));
+  sdopr(J, SD_ADD, 0, 1);  /* idx += step */
+  movsdld(J, 3, REG(a + 1));
+  xorpd(J, 2, 2);
+  ucomisd(J, 1, 2);
+  pos = jcc(J, CC_A);  /* step > 0? */
+  ucomisd(J, 0, 3);
+  l1 = jcc(J, CC_AE);  /* idx >= limit? */
+  jmpto(J, pc + 1);
+  patchhere(J, pos);
+  ucomisd(J, 3, 0);
+  l2 = jcc(J, CC_AE);  /* limit >= idx? */
+  jmpto(J, pc + 1);
+  patchhere(J, l1); patchhere(J, l2);
+  movsdst(J, REG(a), 0);  /* update internal index... */
+  movsdst(J, REG(a + 3), 0);  /* ...and external index */
+  st32i(J, RBX, (a + 3) * TVSIZE + TTOFF, LUA_TNUMFLT);
+  patchhere(J, done);
+  if (J->loops == NULL) {
+    backedge(J, target);
+    return;
+  }
+  lp = J->loops++;
+  lp->pc = pc;
+  cmp8i(J, R12, cast_int(offsetof(LUA_State, hookmask)), 0);
+  pos = jcc(J, CC_E);
+  exitat(J, target);
+  patchhere(J, pos);
+  movi64(J, RAX, cast(size_t, lp));
+  ld64(J, RCX, RAX, cast_int(offsetof(JitLoop, f)));
+  e8(J, 0x48); e8(J, 0x85); e8(J, 0xc9);  /* test rcx, rcx */
+  pos = jcc(J, CC_E);
+  mov64(J, RDI, RBX);
+  mov64(J, RSI, R12);
+  e8(J, 0xff); e8(J, 0xd1);  /* call rcx */
+  /* go on at the instruction returned by the trace */
+  movi64(J, RCX, cast(size_t, J->entry));
+  e8(J, 0x8b); e8(J, 0x0c); e8(J, 0x81);  /* mov ecx, [rcx + rax*4] */
+  movi64(J, RDX, cast(size_t, J->buf));
+  e8(J, 0x48); e8(J, 0x01); e8(J, 0xd1);  /* add rcx, rdx */
+  e8(J, 0xff); e8(J, 0xe1);  /* jmp rcx */
+  patchhere(J, pos);
+  emem(J, 0, 0, 0xff, 1, RAX, cast_int(offsetof(JitLoop, hot)));  /* dec */
+  pos = jcc(J, CC_NE);
+  mov64(J, RDI, R12);
+  mov64(J, RSI, R13);
+  movi64(J, RDX, cast(size_t, lp));
+  movi64(J, RAX, cast(size_t, &jit_record));
+  e8(J, 0xff); e8(J, 0xd0);  /* call rax */
+  patchhere(J, pos);
+  jmpto(J, target);
+}
+
+
+static void forprep (JitState *J, int pc, Instruction i) {
+  int a = GETARG_A(i);
+  int target = pc + 1 + GETARG_sBx(i);
+  size_t f[3];
+  int n;
+  for (n = 0; n < 3; n++)
+    f[n] = isnum(J, REG(a + n));
+  movsdld(J, 0, REG(a));
+  sdop(J, SD_SUB, 0, REG(a + 2));
+  movsdst(J, REG(a), 0);
+  jmpto(J, target);
+  for (n = 0; n < 3; n++)
+    patchhere(J, f[n]);
+  callop(J, pc);  /* integers (or conversions and errors) */
+  jmpto(J, target);
+}
+
+
+static void instruction (JitState *J, int pc) {
+  Instruction i = J->p->code[pc];
+  OpCode op = GET_BASEOP(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_MOVE:
+      copytv(J, REG(a), REG(GETARG_B(i)));
+      break;
+    case OP_LOADK:
+      copytv(J, REG(a), RBP, GETARG_Bx(i) * TVSIZE);
+      break;
+    case OP_LOADBOOL:
+      st32i(J, REG(a), GETARG_B(i));
+      st32i(J, RBX, a * TVSIZE + TTOFF, LUA_TBOOLEAN);
+      if (GETARG_C(i)) jmpto(J, pc + 2);
+      break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do {
+        st32i(J, RBX, a++ * TVSIZE + TTOFF, LUA_TNIL);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL:
+      ld64(J, RAX, R14, cast_int(offsetof(LClosure, upvals)) +
+                        GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      ld64(J, RAX, RAX, cast_int(offsetof(UpVal, v)));
+      copytv(J, REG(a), RAX, 0);
+      break;
+    case OP_ADD: arith(J, pc, i, SD_ADD, I_ADD); break;
+    case OP_SUB: arith(J, pc, i, SD_SUB, I_SUB); break;
+    case OP_MUL: arith(J, pc, i, SD_MUL, I_MUL); break;
+    case OP_DIV: arith(J, pc, i, SD_DIV, 0); break;
+    case OP_UNM: {
+      size_t f, f1, f2, f3, done, idone;
+      f = isnum(J, REG(GETARG_B(i)));
+      ld64(J, RAX, REG(GETARG_B(i)));
+      movi64(J, RCX, cast(size_t, 1) << 63);
+      xor64(J, RAX, RCX);  /* flip sign bit */
+      st64(J, REG(a), RAX);
+      st32i(J, RBX, a * TVSIZE + TTOFF, LUA_TNUMFLT);
+      done = jmp(J);
+      patchhere(J, f);
+      f1 = isint(J, REG(GETARG_B(i)));
+      ld64(J, RAX, REG(GETARG_B(i)));
+      neg64(J, RAX);
+      f2 = jcc(J, CC_O);  /* minimum integer */
+      f3 = jcc(J, CC_E);  /* -0 is a float */
+      st64(J, REG(a), RAX);
+      st32i(J, RBX, a * TVSIZE + TTOFF, LUA_TNUMINT);
+      idone = jmp(J);
+      patchhere(J, f1); patchhere(J, f2); patchhere(J, f3);
+      callop(J, pc);
+      patchhere(J, done);
+      patchhere(J, idone);
+      break;
+    }
+    case OP_JMP: {
+      int target = pc + 1 + GETARG_sBx(i);
+      if (a > 0) {  /* close upvalues (if any is open) */
+        size_t none;
+        ld64(J, RAX, R12, cast_int(offsetof(LUA_State, openupval)));
+        e8(J, 0x48); e8(J, 0x85); e8(J, 0xc0);  /* test rax, rax */
+        none = jcc(J, CC_E);
+        callop(J, pc);
+        patchhere(J, none);
+      }
+      if (target <= pc) backedge(J, target);
+      else jmpto(J, target);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE:
+      compare(J, pc, i, op);
+      break;
+    case OP_TEST:
+      if (GETARG_C(i))
+        branchtv(J, REG(a), pc + 1, pc + 2, -1, 0);
+      else
+        branchtv(J, REG(a), pc + 2, pc + 1, -1, 0);
+      break;
+    case OP_TESTSET:
+      if (GETARG_C(i))
+        branchtv(J, REG(GETARG_B(i)), pc + 1, pc + 2, a, pc + 1);
+      else
+        branchtv(J, REG(GETARG_B(i)), pc + 2, pc + 1, a, pc + 1);
+      break;
+    case OP_FORLOOP:
+      forloop(J, pc, i);
+      break;
+    case OP_FORPREP:
+      forprep(J, pc, i);
+      break;
+    case OP_TFORCALL:
+      callop(J, pc);  /* then fall into its TFORLOOP */
+      break;
+    case OP_TFORLOOP: {
+      size_t f;
+      cmp32i(J, RBX, (a + 1) * TVSIZE + TTOFF, LUA_TNIL);
+      f = jcc(J, CC_E);
+      copytv(J, REG(a), REG(a + 1));  /* save control variable */
+      backedge(J, pc + 1 + GETARG_sBx(i));
+      patchhere(J, f);
+      break;
+    }
+    case OP_CALL:
+      callop(J, pc);
+      testeax(J);
+      jccto(J, CC_NE, TO_FRAME);
+      backedge(J, pc + 1);  /* stops if the callee set a hook */
+      break;
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SETTABUP:
+    case OP_SETUPVAL: case OP_SETTABLE: case OP_NEWTABLE: case OP_SELF:
+    case OP_MOD: case OP_POW: case OP_NOT: case OP_LEN: case OP_CONCAT:
+      callop(J, pc);
+      break;
+    case OP_NEWTABLEK:
+      if (GETARG_Bx(i) == MAXARG_Bx) exitat(J, pc);  /* needs EXTRAARG */
+      else callop(J, pc);
+      break;
+    default:  /* returns, LUA calls, closures, etc. */
+      exitat(J, pc);
+      break;
+  }
+}
+
+/* }====================================================== */
+
+
+
+static void prologue (JitState *J) {
+  static const int saved[] = {RBP, RBX, R12, R13, R14, R15};
+  int n;
+  for (n = 0; n < 6; n++) {  /* push callee-saved registers */
+    rex(J, 0, 0, saved[n]);
+    e8(J, 0x50 + (saved[n] & 7));
+  }
+  e8(J, 0x48); e8(J, 0x83); e8(J, 0xec); e8(J, 8);  /* sub rsp, 8 */
+  mov64(J, R12, RDI);
+  mov64(J, R13, RSI);
+  mov64(J, R14, RDX);
+  ld64(J, RBX, R13, CI_BASE);
+  ld64(J, RBP, R14, cast_int(offsetof(LClosure, p)));
+  ld64(J, RBP, RBP, cast_int(offsetof(Proto, k)));
+  e8(J, 0xff); e8(J, 0xe1);  /* jmp rcx */
+}
+
+
+static void epilogue (JitState *J) {
+  static const int saved[] = {R15, R14, R13, R12, RBX, RBP};
+  int n;
+  e8(J, 0x48); e8(J, 0x83); e8(J, 0xc4); e8(J, 8);  /* add rsp, 8 */
+  for (n = 0; n < 6; n++) {
+    rex(J, 0, 0, saved[n]);
+    e8(J, 0x58 + (saved[n] & 7));
+  }
+  e8(J, 0xc3);  /* ret */
+}
+
+
+static void stubs (JitState *J) {
+  J->exit = J->n;  /* return 0 with savedpc in rax */
+  st64(J, R13, CI_SAVEDPC, RAX);
+  e8(J, 0x31); e8(J, 0xc0);  /* xor eax, eax */
+  epilogue(J);
+  J->frame = J->n;  /* return 1 */
+  e8(J, 0xb8); e32(J, 1);  /* mov eax, 1 */
+  epilogue(J);
+}
+
+
+static void resolve (JitState *J) {
+  int n;
+  for (n = 0; n < J->nfix; n++) {
+    Fixup *f = &J->fix[n];
+    size_t to = (f->target == TO_EXIT) ? J->exit
+              : (f->target == TO_FRAME) ? J->frame
+              : J->entry[f->target];
+    patchto(J, f->pos, to);
+  }
+}
+
+
+/*
+** translate prototype 'p'; returns 0 (and never tries again) if it
+** cannot be done
+*/
+int LUAJ_compile (LUA_State *L, Proto *p) {
+  JitState J;
+  JitCode *jc;
+  size_t page = cast(size_t, sysconf(_SC_PAGESIZE));
+  size_t hsize = offsetof(JitCode, entry) + p->sizecode * sizeof(unsigned int);
+  size_t size, used;
+  JitLoop *loops = NULL;
+  int pc, nloops = 0;
+  hsize = (hsize + 15) & ~cast(size_t, 15);
+  size = hsize + MAXSTUBS + cast(size_t, p->sizecode) * MAXTEMPLATE;
+  size = (size + page - 1) & ~(page - 1);
+  p->jitcount = MAX_INT;  /* in case of failure */
+  for (pc = 0; pc < p->sizecode; pc++)
+    if (GET_OPCODE(p->code[pc]) == OP_FORLOOP) nloops++;
+  if (nloops > 0) {
+    loops = LUAM_newvector(L, nloops, JitLoop);
+    for (pc = 0; pc < nloops; pc++) {
+      loops[pc].f = loops[pc].mem = NULL;
+      loops[pc].hot = LUAI_TRACEHOT;
+    }
+  }
+  J.fix = LUAM_newvector(L, p->sizecode * 8, Fixup);
+  jc = cast(JitCode *, mmap(NULL, size, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (jc == MAP_FAILED) {
+    LUAM_freearray(L, J.fix, p->sizecode * 8);
+    LUAM_freearray(L, loops, nloops);
+    return 0;
+  }
+  jc->size = size;
+  jc->loops = J.loops = loops;
+  jc->nloops = nloops;
+  J.buf = cast(lu_byte *, jc);
+  J.n = hsize;
+  J.p = p;
+  J.nfix = 0;
+  J.entry = jc->entry;
+  jc->start = J.n;
+  prologue(&J);
+  stubs(&J);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    J.entry[pc] = cast(unsigned int, J.n);
+    instruction(&J, pc);
+    LUA_assert(J.n - J.entry[pc] <= MAXTEMPLATE);
+  }
+  resolve(&J);
+  LUAM_freearray(L, J.fix, p->sizecode * 8);
+  used = (J.n + page - 1) & ~(page - 1);
+  if (used < size) {  /* give back unused pages */
+    munmap(J.buf + used, size - used);
+    jc->size = used;
+  }
+  if (mprotect(jc, jc->size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(jc, jc->size);
+    LUAM_freearray(L, loops, nloops);
+    return 0;
+  }
+  p->jit = jc;
+  return 1;
+}
+
+
+/*
+** run native code of the closure in 'ci' from its current 'savedpc';
+** returns 1 if it stopped on a call to a LUA function (whose frame is
+** now L->ci), 0 if the interpreter must go on from 'savedpc'
+*/
+int LUAJ_run (LUA_State *L, CallInfo *ci, LClosure *cl) {
+  JitCode *jc = cl->p->jit;
+  union { lu_byte *p; JitEntry f; } u;
+  int pc = cast_int(ci->u.l.savedpc - cl->p->code);
+  u.p = cast(lu_byte *, jc) + jc->start;
+  return u.f(L, ci, cl, cast(lu_byte *, jc) + jc->entry[pc]);
+}
+
+
+void LUAJ_free (LUA_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  int n;
+  for (n = 0; n < jc->nloops; n++) {
+    if (jc->loops[n].mem != NULL)
+      munmap(jc->loops[n].mem, jc->loops[n].size);
+  }
+  LUAM_freearray(L, jc->loops, jc->nloops);
+  munmap(jc, jc->size);
+  p->jit = NULL;
+}
+
+#endif
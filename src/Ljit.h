@@ -0,0 +1,40 @@
+/*
+** $Id: Ljit.h $
+** Baseline native-code compiler (x86-64)
+** See Copyright Notice in LUA.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "Lobject.h"
+#include "Lstate.h"
+
+
+#if defined(LUA_USE_JIT)
+
+/*
+** number of calls plus loop iterations after which a prototype is
+** translated to native code
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	1000
+#endif
+
+/* number of iterations after which a FOR loop in native code is traced */
+#if !defined(LUAI_TRACEHOT)
+#define LUAI_TRACEHOT	50
+#endif
+
+
+#define LUAJ_ishot(L,p)	((p)->jit != NULL || \
+	(--(p)->jitcount <= 0 && LUAJ_compile(L, p)))
+
+
+LUAI_FUNC int LUAJ_compile (LUA_State *L, Proto *p);
+LUAI_FUNC int LUAJ_run (LUA_State *L, CallInfo *ci, LClosure *cl);
+LUAI_FUNC void LUAJ_free (LUA_State *L, Proto *p);
+
+#endif
+
+#endif
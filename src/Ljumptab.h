@@ -0,0 +1,80 @@
+/*
+** $Id: Ljumptab.h $
+** Jump table for the interpreter main loop (labels as values)
+** See Copyright Notice in LUA.h
+*/
+
+/*
+** This file is included inside 'LUAV_execute' when LUA_USE_JUMPTABLE
+** is defined. Each opcode handler ends with its own fetch and indirect
+** jump, so the branch predictor sees one dispatch point per opcode
+** instead of the single one of a 'switch'.
+*/
+
+#undef vmdispatch
+#undef vmcase
+#undef vmcasenb
+
+#define vmdispatch(o)	goto *disptab[o];
+
+#define vmcase(l,b)	L_##l: {b} vmfetch(); vmdispatch(GET_OPCODE(i))
+#define vmcasenb(l,b)	L_##l: {b}		/* nb = no break */
+
+
+/* ORDER OP */
+
+static const void *const disptab[NUM_OPCODES] = {
+&&L_OP_MOVE,
+&&L_OP_LOADK,
+&&L_OP_LOADKX,
+&&L_OP_LOADBOOL,
+&&L_OP_LOADNIL,
+&&L_OP_GETUPVAL,
+&&L_OP_GETTABUP,
+&&L_OP_GETTABLE,
+&&L_OP_SETTABUP,
+&&L_OP_SETUPVAL,
+&&L_OP_SETTABLE,
+&&L_OP_NEWTABLE,
+&&L_OP_SELF,
+&&L_OP_ADD,
+&&L_OP_SUB,
+&&L_OP_MUL,
+&&L_OP_DIV,
+&&L_OP_MOD,
+&&L_OP_POW,
+&&L_OP_UNM,
+&&L_OP_NOT,
+&&L_OP_LEN,
+&&L_OP_CONCAT,
+&&L_OP_JMP,
+&&L_OP_EQ,
+&&L_OP_LT,
+&&L_OP_LE,
+&&L_OP_TEST,
+&&L_OP_TESTSET,
+&&L_OP_CALL,
+&&L_OP_TAILCALL,
+&&L_OP_RETURN,
+&&L_OP_FORLOOP,
+&&L_OP_FORPREP,
+&&L_OP_TFORCALL,
+&&L_OP_TFORLOOP,
+&&L_OP_SETLIST,
+&&L_OP_CLOSURE,
+&&L_OP_VARARG,
+&&L_OP_EXTRAARG,
+&&L_OP_NEWTABLEK,
+&&L_OP_ADDNUM,
+&&L_OP_SUBNUM,
+&&L_OP_MULNUM,
+&&L_OP_DIVNUM,
+&&L_OP_MODNUM,
+&&L_OP_POWNUM,
+&&L_OP_EQNUM,
+&&L_OP_LTNUM,
+&&L_OP_LENUM,
+&&L_OP_CALLFOP,
+&&L_OP_GETTABUP2,
+&&L_OP_GETTABLE2
+};
@@ -62,6 +62,77 @@ static void save (LexState *ls, int c) {
 }
 
 
+/*
+** {======================================================
+** Bulk scanning: runs of characters of the same class (names, digits,
+** string contents) are scanned in place in the input buffer and saved
+** with a single copy, instead of one 'next' and one 'save' each
+** =======================================================
+*/
+
+/* kinds of runs */
+#define RUN_NAME	0	/* name characters */
+#define RUN_DIGITS	1	/* decimal digits and dots */
+#define RUN_TEXT	2	/* string contents before 'del', '\\' or newline */
+
+#define istext(c,del)	((c) != (del) && (c) != '\\' && \
+                         (c) != '\n' && (c) != '\r')
+
+#define inrun(r,c,del) \
+	((r) == RUN_NAME ? lislalnum(c) != 0 : \
+	 (r) == RUN_DIGITS ? (lisdigit(c) || (c) == '.') : \
+	 ((c) != EOZ && istext(c, del)))
+
+
+/* save 'c' followed by the 'n' characters at 's' */
+static void savespan (LexState *ls, int c, const char *s, size_t n) {
+  Mbuffer *b = ls->buff;
+  if (n >= LUAZ_sizebuffer(b) - LUAZ_bufflen(b)) {
+    size_t newsize = LUAZ_sizebuffer(b);
+    do {
+      if (newsize >= MAX_SIZET/2)
+        lexerror(ls, "lexical element too long", 0);
+      newsize *= 2;
+    } while (n >= newsize - LUAZ_bufflen(b));
+    LUAZ_resizebuffer(ls->L, b, newsize);
+  }
+  b->buffer[LUAZ_bufflen(b)++] = cast(char, c);
+  memcpy(b->buffer + LUAZ_bufflen(b), s, n);
+  LUAZ_bufflen(b) += n;
+}
+
+
+/*
+** skip (saving it if 'keep') the current character and the run of
+** kind 'r' following it, which may go on across buffer refills
+*/
+static void scanrun (LexState *ls, int r, int del, int keep) {
+  ZIO *z = ls->z;
+  do {
+    const char *p = z->p;
+    const char *e = p + z->n;
+    const char *q = p;
+    switch (r) {
+      case RUN_NAME:
+        while (q < e && lislalnum(cast_uchar(*q))) q++;
+        break;
+      case RUN_DIGITS:
+        while (q < e && (lisdigit(cast_uchar(*q)) || *q == '.')) q++;
+        break;
+      default:
+        while (q < e && istext(cast_uchar(*q), del)) q++;
+        break;
+    }
+    if (keep) savespan(ls, ls->current, p, q - p);
+    z->n -= q - p;
+    z->p = q;
+    next(ls);
+  } while (inrun(r, ls->current, del));
+}
+
+/* }====================================================== */
+
+
 void LUAX_init (LUA_State *L) {
   int i;
   for (i=0; i<NUM_RESERVED; i++) {
@@ -236,7 +307,9 @@ static void read_numeral (LexState *ls, SemInfo *seminfo) {
   for (;;) {
     if (check_next(ls, expo))  /* exponent part? */
       check_next(ls, "+-");  /* optional exponent sign */
-    if (lisxdigit(ls->current) || ls->current == '.')
+    if (lisdigit(ls->current) || ls->current == '.')
+      scanrun(ls, RUN_DIGITS, 0, 1);
+    else if (lisxdigit(ls->current))
       save_and_next(ls);
     else  break;
   }
@@ -288,8 +361,7 @@ static void read_long_string (LexState *ls, SemInfo *seminfo, int sep) {
         break;
       }
       default: {
-        if (seminfo) save_and_next(ls);
-        else next(ls);
+        scanrun(ls, RUN_TEXT, ']', seminfo != NULL);
       }
     }
   } endloop:
@@ -386,7 +458,7 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
        no_save: break;
       }
       default:
-        save_and_next(ls);
+        scanrun(ls, RUN_TEXT, del, 1);
     }
   }
   save_and_next(ls);  /* skip delimiter */
@@ -423,7 +495,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         }
         /* else short comment */
         while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+          scanrun(ls, RUN_TEXT, '\n', 0);  /* skip until end of line */
         break;
       }
       case '[': {  /* long string or simply '[' */
@@ -485,9 +557,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
-          do {
-            save_and_next(ls);
-          } while (lislalnum(ls->current));
+          scanrun(ls, RUN_NAME, 0, 1);
           ts = LUAX_newstring(ls, LUAZ_buffer(ls->buff),
                                   LUAZ_bufflen(ls->buff));
           seminfo->ts = ts;
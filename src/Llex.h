@@ -62,6 +62,8 @@ typedef struct LexState {
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
   char decpoint;  /* locale decimal point */
+  struct Table *assigned;  /* globals the chunk assigns ('g' load mode) */
+  lu_byte hoist;  /* hoist read-only globals ('g' load mode)? */
 } LexState;
 
 
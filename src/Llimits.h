@@ -36,6 +36,10 @@ typedef unsigned char lu_byte;
 
 #define MAX_INT (INT_MAX-2)  /* maximum value of an int (-2 for safety) */
 
+/* limits of a LUA_Integer (which has the width of a size_t) */
+#define MAX_LUAINTEGER	((LUA_Integer)(~(size_t)0 >> 1))
+#define MIN_LUAINTEGER	(-MAX_LUAINTEGER - 1)
+
 /*
 ** conversion of pointer to integer
 ** this is for hashing only; there is no problem if the integer
@@ -276,6 +280,38 @@ union LUAi_Cast { double l_d; LUA_INT32 l_p[2]; };
 
 
 
+/*
+** Integer operations for the integer variant of numbers. Each one
+** stores 'a op b' into 'r' and is true if that is exactly the value
+** the float operation would give, that is, when there is no overflow
+** and no negative zero; otherwise the caller redoes it with floats.
+** Wrapping arithmetic is done on size_t to avoid undefined behavior.
+*/
+#define l_castU(i)	((size_t)(i))
+#define l_castS(u)	((LUA_Integer)(u))
+
+#define LUAi_intadd(a,b,r) \
+	((r) = l_castS(l_castU(a) + l_castU(b)), (((a) ^ (r)) & ((b) ^ (r))) >= 0)
+#define LUAi_intsub(a,b,r) \
+	((r) = l_castS(l_castU(a) - l_castU(b)), (((a) ^ (b)) & ((a) ^ (r))) >= 0)
+/*
+** a zero product may be -0; operands up to half the width cannot
+** overflow, and the division checks the others
+*/
+#define LUAi_inthalf(a)	(l_castU(a) + HALFINTEGER <= 2 * HALFINTEGER)
+#define HALFINTEGER	(l_castU(1) << (sizeof(LUA_Integer) * CHAR_BIT / 2 - 1))
+#define LUAi_intmul(a,b,r) \
+	((r) = l_castS(l_castU(a) * l_castU(b)), (r) != 0 && \
+	 ((LUAi_inthalf(a) && LUAi_inthalf(b)) || \
+	  ((a) == -1 ? (b) != MIN_LUAINTEGER : (r) / (a) == (b))))
+#define LUAi_intmod(a,b,r) \
+	((b) != 0 && ((r) = ((b) == -1) ? 0 : (a) % (b), \
+	 (((r) ^ (b)) < 0 && (r) != 0) ? ((r) += (b)) : 0, 1))
+/* -0 is a float, and so is -MIN_LUAINTEGER */
+#define LUAi_intunm(a,r)	((r) = l_castS(0u - l_castU(a)), (r) != (a))
+
+
+
 #if defined(ltable_c) && !defined(LUAi_hashnum)
 
 #include <float.h>
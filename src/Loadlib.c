@@ -42,10 +42,20 @@
 #define LUA_CPATH	"LUA_CPATH"
 #endif
 
+/*
+** LUA_CACHE is the name of the environment variable that names the
+** directory where 'LUAL_loadfile' caches compiled chunks (no caching
+** if it is not set).
+*/
+#if !defined(LUA_CACHE)
+#define LUA_CACHE	"LUA_CACHE"
+#endif
+
 #define LUA_PATHSUFFIX		"_" LUA_VERSION_MAJOR "_" LUA_VERSION_MINOR
 
 #define LUA_PATHVERSION		LUA_PATH LUA_PATHSUFFIX
 #define LUA_CPATHVERSION	LUA_CPATH LUA_PATHSUFFIX
+#define LUA_CACHEVERSION	LUA_CACHE LUA_PATHSUFFIX
 
 /*
 ** LUA_PATH_SEP is the character that separates templates in a path.
@@ -653,6 +663,17 @@ static void setpath (LUA_State *L, const char *fieldname, const char *envname1,
 }
 
 
+static void setcache (LUA_State *L) {
+  const char *dir = getenv(LUA_CACHEVERSION);
+  if (dir == NULL)  /* no environment variable? */
+    dir = getenv(LUA_CACHE);  /* try alternative name */
+  if (dir != NULL && *dir != '\0' && !noenv(L)) {
+    LUA_pushstring(L, dir);
+    LUA_setfield(L, -2, "CACHE");
+  }
+}
+
+
 static const LUAL_Reg pk_funcs[] = {
   {"LOADLIB", ll_loadlib},
   {"SEARCHPATH", ll_searchpath},
@@ -706,6 +727,8 @@ LUAMOD_API int LUAopen_package (LUA_State *L) {
   setpath(L, "PATH", LUA_PATHVERSION, LUA_PATH, LUA_PATH_DEFAULT);
   /* set field 'cpath' */
   setpath(L, "CPATH", LUA_CPATHVERSION, LUA_CPATH, LUA_CPATH_DEFAULT);
+  /* set field 'cache' */
+  setcache(L);
   /* store config information */
   LUA_pushliteral(L, LUA_DIRSEP "\n" LUA_PATH_SEP "\n" LUA_PATH_MARK "\n"
                      LUA_EXEC_DIR "\n" LUA_IGMARK "\n");
@@ -28,6 +28,17 @@
 LUAI_DDEF const TValue LUAO_nilobject_ = {NILCONSTANT};
 
 
+#if defined(LUA_NANTRICK64)
+/* tag of each code of a value (see 'NaN Trick for 64-bit pointers') */
+LUAI_DDEF const lu_byte LUAO_nbtag[16] = {
+  LUA_TNUMBER, LUA_TNIL, LUA_TBOOLEAN, LUA_TLIGHTUSERDATA,
+  LUA_TLCF, LUA_TDEADKEY, 0, 0,  /* (unused codes) */
+  ctb(LUA_TSHRSTR), ctb(LUA_TLNGSTR), ctb(LUA_TLCL), ctb(LUA_TCCL),
+  ctb(LUA_TTABLE), ctb(LUA_TUSERDATA), ctb(LUA_TTHREAD), 0
+};
+#endif
+
+
 /*
 ** converts an integer to a "floating point byte", represented as
 ** (eeeeexxx), where the real value is (1xxx) * 2^(eeeee - 1) if
@@ -84,6 +95,60 @@ LUA_Number LUAO_arith (int op, LUA_Number v1, LUA_Number v2) {
 }
 
 
+/*
+** integer version of 'LUAO_arith'; returns 0 when the result does not
+** fit in an integer or is not exact (e.g. '/' and '^'), in which case
+** the caller must use floats
+*/
+int LUAO_intarith (int op, LUA_Integer v1, LUA_Integer v2,
+                   LUA_Integer *res) {
+  LUA_Integer r;
+  int ok;
+  switch (op) {
+    case LUA_OPADD: ok = LUAi_intadd(v1, v2, r); break;
+    case LUA_OPSUB: ok = LUAi_intsub(v1, v2, r); break;
+    case LUA_OPMUL: ok = LUAi_intmul(v1, v2, r); break;
+    case LUA_OPMOD: ok = LUAi_intmod(v1, v2, r); break;
+    case LUA_OPUNM: ok = LUAi_intunm(v1, r); break;
+    default: return 0;
+  }
+  if (ok) *res = r;
+  return ok;
+}
+
+
+/*
+** checks whether 'n' has an exact integer representation (-0 has none)
+*/
+int LUAO_num2int (LUA_Number n, LUA_Integer *p) {
+  LUA_Integer i;
+  if (!(n >= cast_num(MIN_LUAINTEGER) && n < -cast_num(MIN_LUAINTEGER)))
+    return 0;  /* out of range (or NaN) */
+  i = cast(LUA_Integer, n);
+  if (!LUAi_numeq(cast_num(i), n) ||
+      (i == 0 && LUAi_numdiv(NULL, cast_num(1), n) < 0))
+    return 0;  /* not integral, or -0 */
+  *p = i;
+  return 1;
+}
+
+
+/*
+** sets 'obj' to the number 'n', using the integer variant when it
+** represents 'n' exactly
+*/
+void LUAO_setnumber (TValue *obj, LUA_Number n) {
+#if defined(LUA_USE_INTEGERS)
+  LUA_Integer i;
+  if (LUAO_num2int(n, &i)) {
+    setivalue(obj, i);
+    return;
+  }
+#endif
+  setnvalue(obj, n);
+}
+
+
 int LUAO_hexavalue (int c) {
   if (lisdigit(c)) return c - '0';
   else return ltolower(c) - 'a' + 10;
@@ -52,6 +52,15 @@
 #define LUA_TCCL	(LUA_TFUNCTION | (2 << 4))  /* C closure */
 
 
+/*
+** LUA_TNUMBER variants (see LUA_USE_INTEGERS):
+** 0 - float
+** 1 - integer
+*/
+#define LUA_TNUMFLT	(LUA_TNUMBER | (0 << 4))  /* float numbers */
+#define LUA_TNUMINT	(LUA_TNUMBER | (1 << 4))  /* integer numbers */
+
+
 /* Variant tags for strings */
 #define LUA_TSHRSTR	(LUA_TSTRING | (0 << 4))  /* short strings */
 #define LUA_TLNGSTR	(LUA_TSTRING | (1 << 4))  /* long strings */
@@ -92,7 +101,8 @@ typedef struct GCheader {
 typedef union Value Value;
 
 
-#define numfield	LUA_Number n;    /* numbers */
+#define numfield	LUA_Number n;    /* numbers */ \
+			LUA_Integer i;   /* integer numbers */
 
 
 
@@ -130,7 +140,15 @@ typedef struct LUA_TValue TValue;
 /* Macros to test type */
 #define checktag(o,t)		(rttype(o) == (t))
 #define checktype(o,t)		(ttypenv(o) == (t))
+#if defined(LUA_USE_INTEGERS)
+#define ttisnumber(o)		checktype((o), LUA_TNUMBER)
+#define ttisfloat(o)		checktag((o), LUA_TNUMFLT)
+#define ttisinteger(o)		checktag((o), LUA_TNUMINT)
+#else
 #define ttisnumber(o)		checktag((o), LUA_TNUMBER)
+#define ttisfloat(o)		ttisnumber(o)
+#define ttisinteger(o)		0
+#endif
 #define ttisnil(o)		checktag((o), LUA_TNIL)
 #define ttisboolean(o)		checktag((o), LUA_TBOOLEAN)
 #define ttislightuserdata(o)	checktag((o), LUA_TLIGHTUSERDATA)
@@ -147,10 +165,23 @@ typedef struct LUA_TValue TValue;
 #define ttisthread(o)		checktag((o), ctb(LUA_TTHREAD))
 #define ttisdeadkey(o)		checktag((o), LUA_TDEADKEY)
 
+#if defined(LUA_USE_INTEGERS)
+#define ttisequal(o1,o2)  \
+	(rttype(o1) == rttype(o2) || (ttisnumber(o1) && ttisnumber(o2)))
+#else
 #define ttisequal(o1,o2)	(rttype(o1) == rttype(o2))
+#endif
 
 /* Macros to access values */
+#if defined(LUA_USE_INTEGERS)
+#define nvalue(o)	check_exp(ttisnumber(o), \
+			  ttisinteger(o) ? cast_num(val_(o).i) : num_(o))
+#define ivalue(o)	check_exp(ttisinteger(o), val_(o).i)
+#else
 #define nvalue(o)	check_exp(ttisnumber(o), num_(o))
+#define ivalue(o)	cast(LUA_Integer, nvalue(o))
+#endif
+#define fltvalue(o)	check_exp(ttisfloat(o), num_(o))
 #define gcvalue(o)	check_exp(iscollectable(o), val_(o).gc)
 #define pvalue(o)	check_exp(ttislightuserdata(o), val_(o).p)
 #define rawtsvalue(o)	check_exp(ttisstring(o), &val_(o).gc->ts)
@@ -187,6 +218,13 @@ typedef struct LUA_TValue TValue;
 #define setnvalue(obj,x) \
   { TValue *io=(obj); num_(io)=(x); settt_(io, LUA_TNUMBER); }
 
+#if defined(LUA_USE_INTEGERS)
+#define setivalue(obj,x) \
+  { TValue *io=(obj); val_(io).i=(x); settt_(io, LUA_TNUMINT); }
+#else
+#define setivalue(obj,x)	setnvalue(obj, cast_num(x))
+#endif
+
 #define setnilvalue(obj) settt_(obj, LUA_TNIL)
 
 #define setfvalue(obj,x) \
@@ -378,6 +416,195 @@ typedef struct LUA_TValue TValue;
 
 
 
+/*
+** {======================================================
+** NaN Trick for 64-bit pointers
+** =======================================================
+*/
+#if defined(LUA_NANTRICK64)
+
+/*
+** A value is a single 64-bit word. Numbers are stored as they are; any
+** other value is a negative quiet NaN with a (nonzero) code for its
+** tag in bits 47-50 and its pointer (or boolean) in bits 0-46. The CPU
+** only produces the canonical NaN (code 0), so arithmetic never builds
+** such a pattern; NaNs coming from outside are made canonical by
+** 'LUAi_checknum'. Collectable values have codes 8 and above.
+*/
+
+#define NB_NIL		1
+#define NB_BOOLEAN	2
+#define NB_LIGHTUD	3
+#define NB_LCF		4
+#define NB_DEADKEY	5
+#define NB_SHRSTR	8	/* (strings and closures come in pairs) */
+#define NB_LNGSTR	9
+#define NB_LCL		10
+#define NB_CCL		11
+#define NB_TABLE	12
+#define NB_USERDATA	13
+#define NB_THREAD	14
+
+#define NBSHIFT		47
+#define NBMARK		cast(size_t, 0x1FFF0)  /* bits 47-63 of a tagged value */
+#define NBPTRMASK	((cast(size_t, 1) << NBSHIFT) - 1)
+#define nbtag2u(c)	((NBMARK | (c)) << NBSHIFT)
+
+#undef TValuefields
+#undef NILCONSTANT
+#define TValuefields	union { size_t u__; double d__; } u
+#define NILCONSTANT	{nbtag2u(NB_NIL)}
+
+/* field-access macros */
+#define nbu(o)		((o)->u.u__)
+#define nbhi(o)		(nbu(o) >> NBSHIFT)
+#define nbis(o,c)	(nbhi(o) == (NBMARK | (c)))
+#define nbptr(o,t)	cast(t, nbu(o) & NBPTRMASK)
+
+#undef num_
+#define num_(o)		((o)->u.d__)
+
+#undef numfield
+#define numfield	/* no such field; numbers are the entire word */
+
+#undef rttype
+#define rttype(o)	(ttisnumber(o) ? LUA_TNUMBER : LUAO_nbtag[nbhi(o) & 0xF])
+
+#undef ttisnumber
+#undef ttisfloat
+#undef ttisnil
+#undef ttisboolean
+#undef ttislightuserdata
+#undef ttisstring
+#undef ttisshrstring
+#undef ttislngstring
+#undef ttistable
+#undef ttisfunction
+#undef ttisclosure
+#undef ttisCclosure
+#undef ttisLclosure
+#undef ttislcf
+#undef ttisuserdata
+#undef ttisthread
+#undef ttisdeadkey
+#define ttisnumber(o)		(nbu(o) < nbtag2u(NB_NIL))
+#define ttisfloat(o)		ttisnumber(o)
+#define ttisnil(o)		nbis(o, NB_NIL)
+#define ttisboolean(o)		nbis(o, NB_BOOLEAN)
+#define ttislightuserdata(o)	nbis(o, NB_LIGHTUD)
+#define ttisstring(o)		((nbhi(o) | 1) == (NBMARK | NB_LNGSTR))
+#define ttisshrstring(o)	nbis(o, NB_SHRSTR)
+#define ttislngstring(o)	nbis(o, NB_LNGSTR)
+#define ttistable(o)		nbis(o, NB_TABLE)
+#define ttisfunction(o)		(ttisclosure(o) || ttislcf(o))
+#define ttisclosure(o)		((nbhi(o) | 1) == (NBMARK | NB_CCL))
+#define ttisCclosure(o)		nbis(o, NB_CCL)
+#define ttisLclosure(o)		nbis(o, NB_LCL)
+#define ttislcf(o)		nbis(o, NB_LCF)
+#define ttisuserdata(o)		nbis(o, NB_USERDATA)
+#define ttisthread(o)		nbis(o, NB_THREAD)
+#define ttisdeadkey(o)		nbis(o, NB_DEADKEY)
+
+#undef ttisequal
+#define ttisequal(o1,o2)  \
+	(ttisnumber(o1) ? ttisnumber(o2) : (nbhi(o1) == nbhi(o2)))
+
+#undef iscollectable
+#define iscollectable(o)	(nbu(o) >= nbtag2u(NB_SHRSTR))
+
+#undef gcvalue
+#undef pvalue
+#undef rawtsvalue
+#undef rawuvalue
+#undef clvalue
+#undef clLvalue
+#undef clCvalue
+#undef fvalue
+#undef hvalue
+#undef bvalue
+#undef thvalue
+#undef deadvalue
+#define gcvalue(o)	check_exp(iscollectable(o), nbptr(o, GCObject *))
+#define pvalue(o)	check_exp(ttislightuserdata(o), nbptr(o, void *))
+#define rawtsvalue(o)	check_exp(ttisstring(o), &nbptr(o, GCObject *)->ts)
+#define rawuvalue(o)	check_exp(ttisuserdata(o), &nbptr(o, GCObject *)->u)
+#define clvalue(o)	check_exp(ttisclosure(o), &nbptr(o, GCObject *)->cl)
+#define clLvalue(o)	check_exp(ttisLclosure(o), \
+			  &nbptr(o, GCObject *)->cl.l)
+#define clCvalue(o)	check_exp(ttisCclosure(o), \
+			  &nbptr(o, GCObject *)->cl.c)
+#define fvalue(o)	check_exp(ttislcf(o), nbptr(o, LUA_CFunction))
+#define hvalue(o)	check_exp(ttistable(o), &nbptr(o, GCObject *)->h)
+#define bvalue(o)	check_exp(ttisboolean(o), cast_int(nbu(o) & 1))
+#define thvalue(o)	check_exp(ttisthread(o), &nbptr(o, GCObject *)->th)
+#define deadvalue(o)	check_exp(ttisdeadkey(o), nbptr(o, void *))
+
+#undef settt_  /* tag and payload are set together */
+
+#define nbset(obj,c,x) \
+  { TValue *io_=(obj); nbu(io_)=nbtag2u(c) | cast(size_t, (x)); }
+
+/* code of a collectable tag (with its variant bits) */
+#define nbgccode(t) \
+	(novariant(t) == LUA_TSTRING ? NB_SHRSTR + ((t) >> 4) : \
+	 novariant(t) == LUA_TTABLE ? NB_TABLE : \
+	 novariant(t) == LUA_TUSERDATA ? NB_USERDATA : \
+	 novariant(t) == LUA_TTHREAD ? NB_THREAD : \
+	 (t) == LUA_TLCL ? NB_LCL : NB_CCL)
+
+#undef setnvalue
+#undef setnilvalue
+#undef setfvalue
+#undef setpvalue
+#undef setbvalue
+#undef setgcovalue
+#undef setsvalue
+#undef setuvalue
+#undef setthvalue
+#undef setclLvalue
+#undef setclCvalue
+#undef sethvalue
+#undef setdeadvalue
+#define setnvalue(obj,x) \
+  { TValue *io_=(obj); num_(io_)=(x); }
+#define setnilvalue(obj)	(nbu(obj)=nbtag2u(NB_NIL))
+#define setfvalue(obj,x)	nbset(obj, NB_LCF, x)
+#define setpvalue(obj,x)	nbset(obj, NB_LIGHTUD, x)
+#define setbvalue(obj,x)	nbset(obj, NB_BOOLEAN, (x) != 0)
+#define setgcovalue(L,obj,x) \
+  { GCObject *i_g=(x); nbset(obj, nbgccode(gch(i_g)->tt), i_g); }
+#define setsvalue(L,obj,x) \
+  { TValue *io=(obj); TString *x_ = (x); \
+    nbset(io, NB_SHRSTR + (x_->tsv.tt >> 4), x_); \
+    checkliveness(G(L),io); }
+#define setuvalue(L,obj,x) \
+  { TValue *io=(obj); nbset(io, NB_USERDATA, x); checkliveness(G(L),io); }
+#define setthvalue(L,obj,x) \
+  { TValue *io=(obj); nbset(io, NB_THREAD, x); checkliveness(G(L),io); }
+#define setclLvalue(L,obj,x) \
+  { TValue *io=(obj); nbset(io, NB_LCL, x); checkliveness(G(L),io); }
+#define setclCvalue(L,obj,x) \
+  { TValue *io=(obj); nbset(io, NB_CCL, x); checkliveness(G(L),io); }
+#define sethvalue(L,obj,x) \
+  { TValue *io=(obj); nbset(io, NB_TABLE, x); checkliveness(G(L),io); }
+#define setdeadvalue(obj) \
+	(nbu(obj) = (nbu(obj) & NBPTRMASK) | nbtag2u(NB_DEADKEY))
+
+#undef setobj
+#define setobj(L,obj1,obj2) \
+	{ const TValue *o2_=(obj2); TValue *o1_=(obj1); \
+	  o1_->u = o2_->u; \
+	  checkliveness(G(L),o1_); }
+
+/* a NaN with a tag pattern becomes the canonical NaN */
+#undef LUAi_checknum
+#define LUAi_checknum(L,o,c)	{ if (!ttisnumber(o)) nbu(o) = nbtag2u(0); }
+
+#endif
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** types and prototypes
@@ -461,6 +688,20 @@ typedef struct LocVar {
 } LocVar;
 
 
+/*
+** Memory image of a precompiled chunk, kept while prototypes loaded
+** from it still have their code or their body there
+** (see 'LUA_loadimage')
+*/
+typedef struct Image {
+  char *p;
+  size_t size;
+  int nref;  /* number of such prototypes (plus one while loading) */
+  LUA_Unmap unmap;  /* releases 'p' when 'nref' drops to 0 */
+  void *ud;
+} Image;
+
+
 /*
 ** Function Prototypes
 */
@@ -473,7 +714,14 @@ typedef struct Proto {
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
   union Closure *cache;  /* last created closure with this prototype */
+  int *icache;  /* node-slot hints for table accesses (created on demand) */
+#if defined(LUA_USE_JIT)
+  struct JitCode *jit;  /* native code (see Ljit.c) */
+  int jitcount;  /* countdown to translation */
+#endif
   TString  *source;  /* used for debug information */
+  Image *image;  /* image holding 'code' or 'lazy' (one reference to it) */
+  const char *lazy;  /* body not loaded yet (see 'LUAU_materialize') */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of `k' */
   int sizecode;
@@ -557,16 +805,51 @@ typedef struct Node {
 } Node;
 
 
+#if defined(LUA_USE_SHAPES)
+
+/*
+** Shapes: key layouts shared by tables whose hash keys are all short
+** strings (see Ltable.c)
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *child;  /* first shape that extends this one */
+  struct Shape *sibling;  /* next shape that extends 'parent' */
+  int nkeys;  /* number of keys */
+  TString *keys[1];  /* keys, in the order they were added */
+} Shape;
+
+#endif
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of `node' array */
+#if defined(LUA_USE_SHAPES)
+  lu_byte sizefields;  /* size of 'fields' */
+#endif
+#if defined(LUA_USE_PACKEDARRAYS)
+  lu_byte packed;  /* tag of the elements of a packed array part, or 0 */
+#endif
   struct Table *metatable;
   TValue *array;  /* array part */
   Node *node;
+#if defined(LUA_USE_SWISSTABLE)
+  int growth;  /* number of empty slots that new keys may still take */
+#else
   Node *lastfree;  /* any free position is before this position */
+#endif
+#if defined(LUA_USE_SHAPES)
+  struct Shape *shape;  /* key layout of the record part, or NULL */
+  TValue *fields;  /* values of the keys in 'shape' */
+#endif
   GCObject *gclist;
   int sizearray;  /* size of `array' array */
+  unsigned int lenhint;  /* last border found by 'LUAH_getn' */
+#if defined(LUA_USE_PACKEDARRAYS)
+  int npacked;  /* number of elements in a packed array part */
+#endif
 } Table;
 
 
@@ -589,12 +872,19 @@ typedef struct Table {
 
 
 LUAI_DDEC const TValue LUAO_nilobject_;
+#if defined(LUA_NANTRICK64)
+LUAI_DDEC const lu_byte LUAO_nbtag[16];
+#endif
 
 
 LUAI_FUNC int LUAO_int2fb (unsigned int x);
 LUAI_FUNC int LUAO_fb2int (int x);
 LUAI_FUNC int LUAO_ceillog2 (unsigned int x);
 LUAI_FUNC LUA_Number LUAO_arith (int op, LUA_Number v1, LUA_Number v2);
+LUAI_FUNC int LUAO_intarith (int op, LUA_Integer v1, LUA_Integer v2,
+                             LUA_Integer *res);
+LUAI_FUNC int LUAO_num2int (LUA_Number n, LUA_Integer *p);
+LUAI_FUNC void LUAO_setnumber (TValue *obj, LUA_Number n);
 LUAI_FUNC int LUAO_str2d (const char *s, size_t len, LUA_Number *result);
 LUAI_FUNC int LUAO_hexavalue (int c);
 LUAI_FUNC const char *LUAO_pushvfstring (LUA_State *L, const char *fmt,
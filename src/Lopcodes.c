@@ -55,6 +55,19 @@ LUAI_DDEF const char *const LUAP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "NEWTABLEK",
+  "ADDNUM",
+  "SUBNUM",
+  "MULNUM",
+  "DIVNUM",
+  "MODNUM",
+  "POWNUM",
+  "EQNUM",
+  "LTNUM",
+  "LENUM",
+  "CALLFOP",
+  "GETTABUP2",
+  "GETTABLE2",
   NULL
 };
 
@@ -103,5 +116,55 @@ LUAI_DDEF const lu_byte LUAP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_NEWTABLEK */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADDNUM */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUBNUM */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MULNUM */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_DIVNUM */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MODNUM */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_POWNUM */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_EQNUM */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LTNUM */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LENUM */
+ ,opmode(0, 1, OpArgU, OpArgU, iABC)		/* OP_CALLFOP */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUP2 */
+ ,opmode(0, 1, OpArgR, OpArgK, iABC)		/* OP_GETTABLE2 */
 };
 
+
+LUAI_DDEF const lu_byte LUAP_opbase[NUM_OPCODES] = {
+  OP_MOVE, OP_LOADK, OP_LOADKX, OP_LOADBOOL, OP_LOADNIL, OP_GETUPVAL,
+  OP_GETTABUP, OP_GETTABLE, OP_SETTABUP, OP_SETUPVAL, OP_SETTABLE,
+  OP_NEWTABLE, OP_SELF, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+  OP_UNM, OP_NOT, OP_LEN, OP_CONCAT, OP_JMP, OP_EQ, OP_LT, OP_LE,
+  OP_TEST, OP_TESTSET, OP_CALL, OP_TAILCALL, OP_RETURN, OP_FORLOOP,
+  OP_FORPREP, OP_TFORCALL, OP_TFORLOOP, OP_SETLIST, OP_CLOSURE,
+  OP_VARARG, OP_EXTRAARG, OP_NEWTABLEK,
+  OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,	/* OP_ADDNUM... */
+  OP_EQ, OP_LT, OP_LE,	/* OP_EQNUM, OP_LTNUM, OP_LENUM */
+  OP_CALL,	/* OP_CALLFOP */
+  OP_GETTABUP, OP_GETTABLE	/* OP_GETTABUP2, OP_GETTABLE2 */
+};
+
+
+/*
+** peephole pass that turns pairs of instructions into fused opcodes
+*/
+void LUAP_fuse (Instruction *code, int n) {
+#if defined(LUA_USE_FUSEDOPS)
+  int pc;
+  for (pc = 0; pc + 1 < n; pc++) {
+    Instruction i = code[pc];
+    Instruction next = code[pc + 1];
+    if (GET_OPCODE(next) == OP_GETTABLE && GETARG_B(next) == GETARG_A(i)) {
+      if (GET_OPCODE(i) == OP_GETTABUP)
+        SET_OPCODE(code[pc], OP_GETTABUP2);
+      else if (GET_OPCODE(i) == OP_GETTABLE)
+        SET_OPCODE(code[pc], OP_GETTABLE2);
+    }
+  }
+#else
+  (void)code; (void)n;
+#endif
+}
+
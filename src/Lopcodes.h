@@ -221,11 +221,29 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_NEWTABLEK,/*	A Bx	R(A) := copy of Kst(Bx)	(see note)		*/
+
+/* quickened opcodes (see notes) */
+OP_ADDNUM,/*	A B C	R(A) := RK(B) + RK(C)		(numbers)	*/
+OP_SUBNUM,/*	A B C	R(A) := RK(B) - RK(C)		(numbers)	*/
+OP_MULNUM,/*	A B C	R(A) := RK(B) * RK(C)		(numbers)	*/
+OP_DIVNUM,/*	A B C	R(A) := RK(B) / RK(C)		(numbers)	*/
+OP_MODNUM,/*	A B C	R(A) := RK(B) % RK(C)		(numbers)	*/
+OP_POWNUM,/*	A B C	R(A) := RK(B) ^ RK(C)		(numbers)	*/
+OP_EQNUM,/*	A B C	if ((RK(B) == RK(C)) ~= A) then pc++	(numbers)	*/
+OP_LTNUM,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++	(numbers)	*/
+OP_LENUM,/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++	(numbers)	*/
+OP_CALLFOP,/*	A B C	R(A) := R(A)(R(A+1), ... ,R(A+B-1))	(operators)	*/
+
+/* fused opcodes (see notes) */
+OP_GETTABUP2,/*	A B C	R(A) := UpValue[B][RK(C)]; then GETTABLE	*/
+OP_GETTABLE2/*	A B C	R(A) := R(B)[RK(C)]; then GETTABLE		*/
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_GETTABLE2) + 1)
 
 
 
@@ -245,11 +263,33 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) In OP_LOADKX, the next 'instruction' is always EXTRAARG.
 
+  (*) OP_NEWTABLEK replaces the code of a constructor that stores only
+  constants; Kst(Bx) is a template table built by the compiler, copied
+  along with the templates it holds. If (Bx == MAXARG_Bx) then the
+  constant index is in the next 'instruction', which is EXTRAARG.
+
   (*) For comparisons, A specifies what condition the test should accept
   (true or false).
 
   (*) All `skips' (pc++) assume that next instruction is a jump.
 
+  (*) Quickened opcodes are never generated by the compiler. The
+  interpreter rewrites an instruction in place into its quickened form
+  after running it over operands of the expected types, and back into
+  its original form as soon as the operands do not fit (before calling
+  any metamethod). Anything that inspects or saves code should look at
+  the original form, given by GET_BASEOP.
+
+  (*) OP_CALLFOP is set by the operator functions (see 'LUA_pushfop')
+  on the OP_CALL that calls them for one result; it runs them inline
+  when their operands need no metamethods.
+
+  (*) Fused opcodes are set by 'LUAP_fuse' on an instruction followed
+  by a GETTABLE that indexes its result. They run both instructions
+  with a single dispatch (unless line or count hooks are active); the
+  second instruction is left intact, so it can still be the target of
+  a jump. Their original form is also given by GET_BASEOP.
+
 ===========================================================================*/
 
 
@@ -280,6 +320,12 @@ LUAI_DDEC const lu_byte LUAP_opmodes[NUM_OPCODES];
 
 LUAI_DDEC const char *const LUAP_opnames[NUM_OPCODES+1];  /* opcode names */
 
+LUAI_DDEC const lu_byte LUAP_opbase[NUM_OPCODES];  /* original forms */
+
+#define GET_BASEOP(i)	(cast(OpCode, LUAP_opbase[GET_OPCODE(i)]))
+
+LUAI_FUNC void LUAP_fuse (Instruction *code, int n);
+
 
 /* number of list items to accumulate before a SETLIST instruction */
 #define LFIELDS_PER_FLUSH	50
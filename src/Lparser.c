@@ -299,6 +299,301 @@ static int singlevaraux (FuncState *fs, TString *n, expdesc *var, int base, int
 }
 
 
+/*
+** {======================================================================
+** Read-only globals ('g' load mode)
+** In this mode a global that names a function or a table in the global
+** table at compile time, and a field of such a table that is itself a
+** function or a table ('STRING.FORMAT'), are taken to be read-only,
+** unless the chunk assigns them (or its environment) somewhere. Each
+** one becomes an upvalue of the main function, named after it, that
+** its first read fills from the environment; nested functions reach it
+** as an ordinary upvalue. As the parser cannot see the assignments that
+** come after a read, a scan over the tokens of the chunk collects first
+** the names that start assignment targets. The scan follows only
+** brackets and blocks, so it may take more names (which are then not
+** hoisted) than the parser would, but never fewer.
+** =======================================================================
+*/
+
+
+/* push a name that may start an assignment target */
+static void pushroot (LexState *ls, TString *name) {
+  LUA_State *L = ls->L;
+  setsvalue2s(L, L->top, name);
+  incr_top(L);
+}
+
+
+/* pop the names pushed since 'base', marking them assigned if 'assign' */
+static void poproots (LexState *ls, ptrdiff_t base, int assign) {
+  LUA_State *L = ls->L;
+  StkId o;
+  for (o = restorestack(L, base); assign && o < L->top; o++)
+    setbvalue(LUAH_set(L, ls->assigned, o), 1);
+  L->top = restorestack(L, base);
+}
+
+
+static void scanblock (LexState *ls, int nested);
+
+
+static void enterscan (LexState *ls) {
+  if (++ls->L->nCcalls > LUAI_MAXCCALLS)
+    LUAX_syntaxerror(ls, "chunk has too many syntax levels");
+}
+
+
+/*
+** skip a bracketed expression (the current token opens it) up to the
+** matching 'close'; with 'collect' set, push the names in it, which may
+** be the target of an assignment through parentheses
+*/
+static void scanexp (LexState *ls, int close, int collect) {
+  enterscan(ls);
+  LUAX_next(ls);  /* skip opening bracket */
+  while (ls->t.token != close && ls->t.token != TK_EOS) {
+    switch (ls->t.token) {
+      case '(': scanexp(ls, ')', collect); break;
+      case '[': scanexp(ls, ']', collect); break;
+      case '{': scanexp(ls, '}', collect); break;
+      case TK_FUNCTION: case TK_DO: scanblock(ls, 1); break;
+      case '.': case ':': {  /* a field or method name is not a variable */
+        LUAX_next(ls);
+        if (ls->t.token == TK_NAME) LUAX_next(ls);
+        break;
+      }
+      case TK_NAME: {
+        if (collect) pushroot(ls, ls->t.seminfo.ts);
+        LUAX_next(ls);
+        break;
+      }
+      default: LUAX_next(ls); break;
+    }
+  }
+  LUAX_next(ls);  /* skip closing bracket */
+  ls->L->nCcalls--;
+}
+
+
+/*
+** skip a suffixed expression in a block, pushing the variable it starts
+** with; it is assigned if an '=' follows (after a list of others)
+*/
+static void scanchain (LexState *ls, ptrdiff_t base) {
+  if (ls->t.token == '(')
+    scanexp(ls, ')', 1);
+  else {
+    while (ls->t.token == '@') LUAX_next(ls);
+    if (ls->t.token != TK_NAME) return;
+    pushroot(ls, ls->t.seminfo.ts);
+    LUAX_next(ls);
+  }
+  for (;;) {
+    switch (ls->t.token) {
+      case '.': case ':': {
+        LUAX_next(ls);
+        if (ls->t.token == TK_NAME) LUAX_next(ls);
+        break;
+      }
+      case '[': scanexp(ls, ']', 0); break;
+      case '(': scanexp(ls, ')', 0); break;
+      case '{': scanexp(ls, '}', 0); break;
+      case TK_STRING: LUAX_next(ls); break;
+      case ',': LUAX_next(ls); return;  /* maybe more targets */
+      case '=': LUAX_next(ls); poproots(ls, base, 1); return;
+      default: poproots(ls, base, 0); return;
+    }
+  }
+}
+
+
+/* skip the parameters of a function, if the current token opens them */
+static void scanparams (LexState *ls) {
+  if (ls->t.token == '(') scanexp(ls, ')', 0);
+}
+
+
+/* skip names declared by LOCAL or FOR */
+static void scannames (LexState *ls) {
+  while (ls->t.token == TK_NAME) {
+    LUAX_next(ls);
+    if (ls->t.token != ',') break;
+    LUAX_next(ls);
+  }
+}
+
+
+/*
+** scan the statements of the chunk or, if 'nested', of the body opened
+** by the current token (FUNCTION or DO) up to its END
+*/
+static void scanblock (LexState *ls, int nested) {
+  LUA_State *L = ls->L;
+  ptrdiff_t base = savestack(L, L->top);
+  int depth = 0;
+  enterscan(ls);
+  if (nested) {
+    int isfunc = (ls->t.token == TK_FUNCTION);
+    depth = 1;
+    LUAX_next(ls);  /* skip FUNCTION or DO */
+    if (isfunc) scanparams(ls);
+  }
+  while (ls->t.token != TK_EOS) {
+    switch (ls->t.token) {
+      case TK_NAME: case '@': case '(': {
+        scanchain(ls, base);
+        continue;  /* keep the names of a list of targets */
+      }
+      case TK_IF: case TK_DO: case TK_REPEAT: {
+        depth++;
+        LUAX_next(ls);
+        break;
+      }
+      case TK_END: case TK_UNTIL: {
+        LUAX_next(ls);
+        if (--depth == 0 && nested) {
+          poproots(ls, base, 0);
+          L->nCcalls--;
+          return;
+        }
+        break;
+      }
+      case TK_FUNCTION: {
+        depth++;
+        LUAX_next(ls);
+        if (ls->t.token == TK_NAME) {  /* function statement */
+          pushroot(ls, ls->t.seminfo.ts);
+          poproots(ls, base, 1);
+          LUAX_next(ls);
+          while (ls->t.token == '.' || ls->t.token == ':') {
+            LUAX_next(ls);
+            if (ls->t.token == TK_NAME) LUAX_next(ls);
+          }
+        }
+        scanparams(ls);
+        break;
+      }
+      case TK_LOCAL: {
+        LUAX_next(ls);
+        if (ls->t.token == TK_FUNCTION) {
+          depth++;
+          LUAX_next(ls);
+          if (ls->t.token == TK_NAME) LUAX_next(ls);
+          scanparams(ls);
+        }
+        else scannames(ls);
+        break;
+      }
+      case TK_FOR: {
+        LUAX_next(ls);
+        scannames(ls);
+        break;
+      }
+      case '[': scanexp(ls, ']', 0); break;
+      case '{': scanexp(ls, '}', 0); break;
+      default: LUAX_next(ls); break;
+    }
+    poproots(ls, base, 0);  /* not a list of targets */
+  }
+  poproots(ls, base, 0);
+  L->nCcalls--;
+}
+
+
+static int isassigned (LexState *ls, TString *name) {
+  TValue key;
+  setsvalue(ls->L, &key, name);
+  return !ttisnil(LUAH_get(ls->assigned, &key));
+}
+
+
+static int isbinding (LexState *ls, TString *name, TString *field) {
+  Table *reg = hvalue(&G(ls->L)->l_registry);
+  const TValue *o = LUAH_getint(reg, LUA_RIDX_GLOBALS);
+  TValue key;
+  if (!ttistable(o)) return 0;
+  setsvalue(ls->L, &key, name);
+  o = LUAH_get(hvalue(o), &key);
+  if (field != NULL) {
+    if (!ttistable(o)) return 0;
+    setsvalue(ls->L, &key, field);
+    o = LUAH_get(hvalue(o), &key);
+  }
+  return ttisfunction(o) || ttistable(o);
+}
+
+
+/*
+** code a read of hoisted global 'name' (with 'field', if not NULL)
+** through its upvalue 'var'; while the upvalue is nil or false, the
+** read takes the value from the environment and stores it there
+** ('getobjname' names the value after that refill, so errors still
+** call it a global or a field)
+*/
+static void loadhoisted (LexState *ls, expdesc *var, TString *name,
+                                                     TString *field) {
+  FuncState *fs = ls->fs;
+  int up = var->u.info;
+  int reg, skip;
+  expdesc e, key;
+  LUAK_exp2nextreg(fs, var);
+  reg = var->u.info;
+  LUAK_codeABC(fs, OP_TEST, reg, 0, 1);
+  skip = LUAK_jump(fs);  /* already filled */
+  fs->freereg--;  /* the value from the environment goes to 'reg' too */
+  singlevaraux(fs, ls->envn, &e, 1, 0);
+  codestring(ls, &key, name);
+  LUAK_indexed(fs, &e, &key);
+  if (field != NULL) {
+    LUAK_exp2anyregup(fs, &e);
+    codestring(ls, &key, field);
+    LUAK_indexed(fs, &e, &key);
+  }
+  LUAK_exp2nextreg(fs, &e);
+  LUA_assert(e.u.info == reg);
+  LUAK_codeABC(fs, OP_SETUPVAL, reg, up, 0);
+  LUAK_patchtohere(fs, skip);
+}
+
+
+/* try to compile global 'name' (and a field after it) as a hoisted one */
+static int hoistglobal (LexState *ls, expdesc *var, TString *name) {
+  FuncState *fs;
+  TString *field = NULL;
+  TString *upname = name;
+  if (isassigned(ls, name) || isassigned(ls, ls->envn))
+    return 0;  /* the chunk changes the global or the environment */
+  for (fs = ls->fs; ; fs = fs->prev) {
+    if (searchvar(fs, ls->envn) >= 0 || fs->nups >= MAXUPVAL - 1)
+      return 0;  /* not the global environment or no room for the upvalue */
+    if (fs->prev == NULL) break;  /* 'fs' is the main function */
+  }
+  if (ls->t.token == '.' && LUAX_lookahead(ls) == TK_NAME &&
+      isbinding(ls, name, ls->lookahead.seminfo.ts)) {
+    const char *s;
+    field = ls->lookahead.seminfo.ts;
+    s = LUAO_pushfstring(ls->L, "%s.%s", getstr(name), getstr(field));
+    upname = LUAX_newstring(ls, s, strlen(s));
+    ls->L->top--;
+    LUAX_next(ls);  /* skip '.' */
+    LUAX_next(ls);  /* skip field name */
+  }
+  else if (!isbinding(ls, name, NULL))
+    return 0;
+  if (searchupvalue(fs, upname) < 0) {  /* first use? */
+    expdesc v;
+    init_exp(&v, VUPVAL, 0);
+    newupvalue(fs, upname, &v);
+  }
+  singlevaraux(ls->fs, upname, var, 1, 0);
+  loadhoisted(ls, var, name, field);
+  return 1;
+}
+
+/* }====================================================================== */
+
+
 static void singlevar (LexState *ls, expdesc *var) {
   int mindepth = 0;
   while(ls->t.token == '@') {
@@ -309,6 +604,8 @@ static void singlevar (LexState *ls, expdesc *var) {
   TString *varname = str_checkname(ls);
   if (singlevaraux(fs, varname, var, 0, mindepth) == VVOID) {  /* global name? */
     expdesc key;
+    if (ls->hoist && mindepth == 0 && hoistglobal(ls, var, varname))
+      return;
     singlevaraux(fs, ls->envn, var, 1, 0);  /* get environment variable */
     LUA_assert(var->k == VLOCAL || var->k == VUPVAL);
     codestring(ls, &key, varname);  /* key is variable name */
@@ -568,8 +865,10 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   LUAK_ret(fs, 0, 0);  /* final return */
   leaveblock(fs);
+  if (G(L)->optimize) LUAK_optimize(fs);
   LUAM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
+  LUAP_fuse(f->code, f->sizecode);
   LUAM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
   f->sizelineinfo = fs->pc;
   LUAM_reallocvector(L, f->k, f->sizek, fs->nk, TValue);
@@ -743,6 +1042,7 @@ static void constructor (LexState *ls, expdesc *t) {
      sep -> ',' | ';' */
   FuncState *fs = ls->fs;
   int line = ls->linenumber;
+  int nk = fs->nk;
   int pc = LUAK_codeABC(fs, OP_NEWTABLE, 0, 0, 0);
   struct ConsControl cc;
   cc.na = cc.nh = cc.tostore = 0;
@@ -761,6 +1061,7 @@ static void constructor (LexState *ls, expdesc *t) {
   lastlistfield(fs, &cc);
   SETARG_B(fs->f->code[pc], LUAO_int2fb(cc.na)); /* set initial array size */
   SETARG_C(fs->f->code[pc], LUAO_int2fb(cc.nh));  /* set initial table size */
+  LUAK_tabletemplate(fs, pc, nk);  /* only constants? */
 }
 
 /* }====================================================================== */
@@ -1648,8 +1949,9 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 }
 
 
-Closure *LUAY_parser (LUA_State *L, ZIO *z, Mbuffer *buff,
-                      Dyndata *dyd, const char *name, int firstchar) {
+static Closure *parsechunk (LUA_State *L, ZIO *z, Mbuffer *buff,
+                            Dyndata *dyd, const char *name, int firstchar,
+                            Table *assigned, int hoist) {
   LexState lexstate;
   FuncState funcstate;
   Closure *cl = LUAF_newLclosure(L, 1);  /* create main closure */
@@ -1660,12 +1962,120 @@ Closure *LUAY_parser (LUA_State *L, ZIO *z, Mbuffer *buff,
   funcstate.f->source = LUAS_new(L, name);  /* create and anchor TString */
   lexstate.buff = buff;
   lexstate.dyd = dyd;
+  lexstate.assigned = assigned;
+  lexstate.hoist = cast_byte(hoist);
   dyd->actvar.n = dyd->gt.n = dyd->comefrom.n = 0;
   LUAX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
-  LUA_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
+  if (funcstate.nups > 1) {  /* hoisted globals? */
+    cl = LUAF_newLclosure(L, funcstate.nups);  /* main closure needs more */
+    cl->l.p = funcstate.f;
+    setclLvalue(L, L->top - 1, cl);
+  }
+  LUA_assert(!funcstate.prev && cl->l.nupvalues == funcstate.nups &&
+             !lexstate.fs);
   /* all scopes should be correctly finished */
   LUA_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->comefrom.n == 0);
   return cl;  /* it's on the stack too */
 }
 
+
+/* reads the rest of a chunk, from its first character 'c', to a string */
+static TString *readchunk (LUA_State *L, ZIO *z, Mbuffer *b, int c) {
+  size_t n = 0;
+  TString *ts;
+  for (; c != EOZ; c = zgetc(z)) {
+    size_t k = z->n;  /* bytes left in the block of 'c' */
+    if (k >= MAX_SIZET - n - 1) LUAM_toobig(L);
+    if (n + 1 + k > LUAZ_sizebuffer(b)) {
+      size_t size = (LUAZ_sizebuffer(b) < MAX_SIZET/2) ?
+                    LUAZ_sizebuffer(b) * 2 : MAX_SIZET;
+      LUAZ_resizebuffer(L, b, (size < n + 1 + k) ? n + 1 + k : size);
+    }
+    LUAZ_buffer(b)[n++] = cast(char, c);
+    memcpy(LUAZ_buffer(b) + n, z->p, k);
+    n += k;
+    z->p += k;
+    z->n = 0;
+  }
+  ts = LUAS_newlstr(L, LUAZ_buffer(b), n);
+  setsvalue2s(L, L->top, ts);  /* anchor it */
+  incr_top(L);
+  return ts;
+}
+
+
+typedef struct LoadS {
+  const char *s;
+  size_t size;
+} LoadS;
+
+
+static const char *getS (LUA_State *L, void *ud, size_t *size) {
+  LoadS *ls = (LoadS *)ud;
+  UNUSED(L);
+  if (ls->size == 0) return NULL;
+  *size = ls->size;
+  ls->size = 0;
+  return ls->s;
+}
+
+
+/* state of the scan that collects assigned names ('g' load mode) */
+typedef struct ScanS {
+  ZIO *z;
+  Mbuffer *buff;
+  Table *assigned;
+  const char *name;
+  int firstchar;
+} ScanS;
+
+
+static void f_scan (LUA_State *L, void *ud) {
+  ScanS *ss = cast(ScanS *, ud);
+  LexState lexstate;
+  FuncState funcstate;  /* only its table of strings is used */
+  TString *source = LUAS_new(L, ss->name);
+  setsvalue2s(L, L->top, source);  /* anchor it */
+  incr_top(L);
+  funcstate.h = LUAH_new(L);
+  sethvalue2s(L, L->top, funcstate.h);  /* anchor it */
+  incr_top(L);
+  lexstate.buff = ss->buff;
+  lexstate.assigned = ss->assigned;
+  LUAX_setinput(L, &lexstate, ss->z, source, ss->firstchar);
+  lexstate.fs = &funcstate;
+  LUAX_next(&lexstate);  /* read first token */
+  scanblock(&lexstate, 0);
+  L->top -= 2;
+}
+
+
+Closure *LUAY_parser (LUA_State *L, ZIO *z, Mbuffer *buff,
+                      Dyndata *dyd, const char *name, int firstchar,
+                      int hoist) {
+  TString *src;
+  ScanS ss;
+  Closure *cl;
+  LoadS ls;
+  ZIO zs;
+  if (!hoist)
+    return parsechunk(L, z, buff, dyd, name, firstchar, NULL, 0);
+  src = readchunk(L, z, buff, firstchar);  /* it is read twice */
+  ss.assigned = LUAH_new(L);
+  sethvalue(L, L->top, ss.assigned);  /* anchor it */
+  incr_top(L);
+  ls.s = getstr(src); ls.size = src->tsv.len;
+  LUAZ_init(L, &zs, getS, &ls);
+  ss.z = &zs; ss.buff = buff; ss.name = name; ss.firstchar = zgetc(&zs);
+  if (LUAD_pcall(L, f_scan, &ss, savestack(L, L->top), 0) != LUA_OK) {
+    L->top--;  /* remove error message */
+    hoist = 0;  /* leave the error to the parser */
+  }
+  ls.s = getstr(src); ls.size = src->tsv.len;
+  LUAZ_init(L, &zs, getS, &ls);
+  cl = parsechunk(L, &zs, buff, dyd, name, zgetc(&zs), ss.assigned, hoist);
+  setobjs2s(L, L->top - 3, L->top - 1);  /* closure replaces the anchors */
+  L->top -= 2;
+  return cl;
+}
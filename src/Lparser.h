@@ -113,7 +113,8 @@ typedef struct FuncState {
 
 
 LUAI_FUNC Closure *LUAY_parser (LUA_State *L, ZIO *z, Mbuffer *buff,
-                                Dyndata *dyd, const char *name, int firstchar);
+                                Dyndata *dyd, const char *name, int firstchar,
+                                int hoist);
 
 
 #endif
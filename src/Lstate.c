@@ -223,6 +223,9 @@ static void close_state (LUA_State *L) {
   LUAF_close(L, L->stack);  /* close all upvalues for this thread */
   LUAC_freeallobjects(L);  /* collect all objects */
   LUAM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+#if defined(LUA_USE_SHAPES)
+  LUAH_freeshapes(L);
+#endif
   LUAZ_freebuffer(L, &g->buff);
   freestack(L);
   LUA_assert(gettotalbytes(g) == sizeof(LG));
@@ -280,6 +283,7 @@ LUA_API LUA_State *LUA_newstate (LUA_Alloc f, void *ud) {
   g->uvhead.u.l.prev = &g->uvhead;
   g->uvhead.u.l.next = &g->uvhead;
   g->gcrunning = 0;  /* no GC while building state */
+  g->optimize = 0;
   g->GCestimate = 0;
   g->strt.size = 0;
   g->strt.nuse = 0;
@@ -301,6 +305,10 @@ LUA_API LUA_State *LUA_newstate (LUA_Alloc f, void *ud) {
   g->gcmajorinc = LUAI_GCMAJOR;
   g->gcstepmul = LUAI_GCMUL;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+#if defined(LUA_USE_SHAPES)
+  g->rootshape = NULL;
+  g->nshapes = 0;
+#endif
   if (LUAD_rawrunprotected(L, f_LUAopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -123,6 +123,7 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte optimize;  /* true if the parser optimizes new functions */
   int sweepstrgc;  /* position of sweep in `strt' */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -145,6 +146,10 @@ typedef struct global_State {
   TString *memerrmsg;  /* memory-error message */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
+#if defined(LUA_USE_SHAPES)
+  struct Shape *rootshape;  /* shape without keys (created on demand) */
+  int nshapes;  /* number of shapes */
+#endif
 } global_State;
 
 
@@ -920,6 +920,8 @@ static int str_format (LUA_State *L) {
           LUA_Number diff = n - (LUA_Number)ni;
           LUAL_argcheck(L, -1 < diff && diff < 1, arg,
                         "not a number in proper range");
+          if (sizeof(LUA_Integer) == sizeof(LUA_INTFRM_T))
+            ni = (LUA_INTFRM_T)LUA_tointeger(L, arg);  /* exact for integers */
           addlenmod(form, LUA_INTFRMLEN);
           nb = sprintf(buff, form, ni);
           break;
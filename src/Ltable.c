@@ -16,10 +16,23 @@
 ** in its main position (i.e. the `original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** With LUA_USE_SWISSTABLE, the hash part uses open addressing instead:
+** slots come in groups of GROUP, each slot with a control byte that is
+** either empty or 7 bits of the hash of its key; a lookup matches the
+** control bytes of a whole group at once and compares only the keys of
+** the matching slots, going on to other groups (quadratic probing)
+** until a group with an empty slot. A key keeps its slot until the
+** next rehash, even after its value becomes nil, so that searches for
+** other keys still go past it.
 */
 
 #include <string.h>
 
+#if defined(LUA_USE_SWISSTABLE) && defined(__SSE2__) && !defined(LUA_ANSI)
+#include <emmintrin.h>
+#define SSE2GROUPS
+#endif
+
 #define ltable_c
 #define LUA_CORE
 
@@ -48,6 +61,261 @@
 #define MAXASIZE	(1 << MAXBITS)
 
 
+#if defined(LUA_USE_SWISSTABLE)	/* { */
+
+#define LGROUP		4
+#define GROUP		(1 << LGROUP)	/* slots probed at once */
+
+#define CEMPTY		0x80	/* control byte of a slot without a key */
+#define CSENTINEL	0xFF	/* control byte past the last slot */
+
+/* control bytes follow the nodes; a vector has at least one group */
+#define ctrlsize(lsize)	((lsize) < LGROUP ? GROUP : twoto(lsize))
+#define gctrl(t)	(cast(lu_byte *, (t)->node + sizenode(t)))
+#define groupmask(t)	\
+	((t)->lsizenode <= LGROUP ? 0u : twoto((t)->lsizenode - LGROUP) - 1u)
+
+#define nodevectorsize(lsize)	\
+	(sizeof(Node) * twoto(lsize) + cast(size_t, ctrlsize(lsize)))
+
+#define newnodevector(L,lsize)	\
+	cast(Node *, LUAM_malloc(L, nodevectorsize(lsize)))
+#define freenodevector(L,n,lsize)	LUAM_freemem(L, n, nodevectorsize(lsize))
+
+/*
+** number of keys a vector of 2^lsize nodes may take; a single group may
+** be full, as probing it is bounded anyway, but larger vectors keep
+** 1/8 of their slots empty to end unsuccessful searches early
+*/
+#define capacity(lsize)	\
+	((lsize) <= LGROUP ? twoto(lsize) : twoto(lsize) - twoto((lsize) - 3))
+
+/* leave room for the keys that replace dead ones before the next rehash */
+#define rehashsize(n)	((n) + (n)/4)
+
+#define hashgroup(h)	((h) >> 7)
+#define hashctrl(h)	cast(int, (h) & 0x7f)
+
+
+#define dummynode		(&dummynode_.n)
+
+#define isdummy(n)		((n) == dummynode)
+
+static const struct {
+  Node n;
+  lu_byte ctrl[GROUP];  /* must come right after 'n', as for any vector */
+} dummynode_ = {
+  {{NILCONSTANT},  /* value */
+   {{NILCONSTANT, NULL}}},  /* key */
+  {CEMPTY, CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL,
+   CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL, CSENTINEL,
+   CSENTINEL, CSENTINEL, CSENTINEL}
+};
+
+
+/*
+** returns a bit mask of the slots in group 'c' whose control bytes are 'b'
+*/
+#if defined(SSE2GROUPS)
+
+static unsigned int matchgroup (const lu_byte *c, int b) {
+  __m128i g = _mm_loadu_si128(cast(const __m128i *, c));
+  return cast(unsigned int,
+              _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(cast(char, b)))));
+}
+
+#else
+
+static unsigned int matchgroup (const lu_byte *c, int b) {
+  unsigned int m = 0;
+  int i;
+  for (i = 0; i < GROUP; i++) {
+    if (c[i] == b) m |= 1u << i;
+  }
+  return m;
+}
+
+#endif
+
+
+/* index of the lowest slot in a (non-empty) mask */
+#if defined(__GNUC__)
+
+#define lowslot(m)	__builtin_ctz(m)
+
+#else
+
+static int lowslot (unsigned int m) {
+  int i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+
+#endif
+
+
+/*
+** scramble the raw hash of a key, as pointer and number hashes keep
+** some of their bits alike; the product spreads the low bits upwards
+** and the shift brings the mixed high bits back to the control byte
+*/
+static unsigned int mixhash (unsigned int h) {
+  h *= 0x9e3779b1u;
+  return h ^ (h >> 15);
+}
+
+
+/*
+** hash for LUA_Numbers
+*/
+static unsigned int hashnum (LUA_Number n) {
+  int i;
+  LUAi_hashnum(i, n);
+  return cast(unsigned int, i);
+}
+
+
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMFLT:
+      return mixhash(hashnum(fltvalue(key)));
+    case LUA_TNUMINT:  /* same hash as the equal float */
+      return mixhash(hashnum(cast_num(ivalue(key))));
+    case LUA_TLNGSTR: {
+      TString *s = rawtsvalue(key);
+      if (s->tsv.extra == 0) {  /* no hash? */
+        s->tsv.hash = LUAS_hash(getstr(s), s->tsv.len, s->tsv.hash);
+        s->tsv.extra = 1;  /* now it has its hash */
+      }
+      return mixhash(s->tsv.hash);
+    }
+    case LUA_TSHRSTR:
+      return mixhash(rawtsvalue(key)->tsv.hash);
+    case LUA_TBOOLEAN:
+      return mixhash(bvalue(key));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(IntPoint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(IntPoint(fvalue(key)));
+    default:
+      return mixhash(IntPoint(gcvalue(key)));
+  }
+}
+
+
+/*
+** marks all slots of a new node vector as empty
+*/
+static void clearctrl (Table *t) {
+  if (isdummy(t->node))
+    t->growth = 0;  /* any new key rehashes */
+  else {
+    int size = sizenode(t);
+    memset(gctrl(t), CEMPTY, size);
+    memset(gctrl(t) + size, CSENTINEL, ctrlsize(t->lsizenode) - size);
+    t->growth = capacity(t->lsizenode);
+  }
+}
+
+
+/*
+** Searches go through the probe sequence of their hash, which visits
+** every group once starting at its home group ('hashgroup'); they stop
+** at the first group with an empty slot, as an insertion of the key
+** would have taken that slot.
+*/
+#define nextgroup(g,step,mask)	(((g) + (step)) & (mask))
+
+
+static Node *findstr (const Table *t, TString *key) {
+  unsigned int h = mixhash(key->tsv.hash);
+  unsigned int mask = groupmask(t), step = 0;
+  unsigned int g = hashgroup(h) & mask;
+  for (;;) {
+    const lu_byte *c = gctrl(t) + g * GROUP;
+    unsigned int m;
+    for (m = matchgroup(c, hashctrl(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, g * GROUP + lowslot(m));
+      if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
+        return n;
+    }
+    if (matchgroup(c, CEMPTY) != 0 || step == mask)
+      return NULL;  /* not found */
+    g = nextgroup(g, ++step, mask);
+  }
+}
+
+
+static Node *findint (const Table *t, int key) {
+  LUA_Number nk = cast_num(key);
+  unsigned int h = mixhash(hashnum(nk));
+  unsigned int mask = groupmask(t), step = 0;
+  unsigned int g = hashgroup(h) & mask;
+  for (;;) {
+    const lu_byte *c = gctrl(t) + g * GROUP;
+    unsigned int m;
+    for (m = matchgroup(c, hashctrl(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, g * GROUP + lowslot(m));
+      if (ttisinteger(gkey(n)) ? ivalue(gkey(n)) == key :
+          (ttisnumber(gkey(n)) && LUAi_numeq(nvalue(gkey(n)), nk)))
+        return n;
+    }
+    if (matchgroup(c, CEMPTY) != 0 || step == mask)
+      return NULL;  /* not found */
+    g = nextgroup(g, ++step, mask);
+  }
+}
+
+
+/*
+** search for any key; with 'dead' set, a dead key of the same object
+** also matches (which is ok in traversals)
+*/
+static Node *findnode (const Table *t, const TValue *key, int dead) {
+  unsigned int h = hashkey(key);
+  unsigned int mask = groupmask(t), step = 0;
+  unsigned int g = hashgroup(h) & mask;
+  for (;;) {
+    const lu_byte *c = gctrl(t) + g * GROUP;
+    unsigned int m;
+    for (m = matchgroup(c, hashctrl(h)); m != 0; m &= m - 1) {
+      Node *n = gnode(t, g * GROUP + lowslot(m));
+      if (LUAV_rawequalobj(gkey(n), key) ||
+            (dead && ttisdeadkey(gkey(n)) && iscollectable(key) &&
+             deadvalue(gkey(n)) == gcvalue(key)))
+        return n;
+    }
+    if (matchgroup(c, CEMPTY) != 0 || step == mask)
+      return NULL;  /* not found */
+    g = nextgroup(g, ++step, mask);
+  }
+}
+
+
+/*
+** takes the first empty slot in the probe sequence of hash 'h' (there
+** must be one, as 't->growth' is positive) for a key with that hash
+*/
+static Node *takeslot (Table *t, unsigned int h) {
+  unsigned int mask = groupmask(t), step = 0;
+  unsigned int g = hashgroup(h) & mask;
+  LUA_assert(t->growth > 0);
+  for (;;) {
+    lu_byte *c = gctrl(t) + g * GROUP;
+    unsigned int m = matchgroup(c, CEMPTY);
+    if (m != 0) {
+      int i = lowslot(m);
+      c[i] = cast_byte(hashctrl(h));
+      t->growth--;
+      return gnode(t, g * GROUP + i);
+    }
+    LUA_assert(step < mask);
+    g = nextgroup(g, ++step, mask);
+  }
+}
+
+#else							/* }{ */
+
 #define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
 #define hashstr(t,str)		hashpow2(t, (str)->tsv.hash)
@@ -96,8 +364,10 @@ static Node *hashnum (const Table *t, LUA_Number n) {
 */
 static Node *mainposition (const Table *t, const TValue *key) {
   switch (ttype(key)) {
-    case LUA_TNUMBER:
-      return hashnum(t, nvalue(key));
+    case LUA_TNUMFLT:
+      return hashnum(t, fltvalue(key));
+    case LUA_TNUMINT:  /* same hash as the equal float */
+      return hashnum(t, cast_num(ivalue(key)));
     case LUA_TLNGSTR: {
       TString *s = rawtsvalue(key);
       if (s->tsv.extra == 0) {  /* no hash? */
@@ -119,13 +389,26 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#define newnodevector(L,lsize)	LUAM_newvector(L, twoto(lsize), Node)
+#define freenodevector(L,n,lsize)	\
+	LUAM_freearray(L, n, cast(size_t, twoto(lsize)))
+
+#define rehashsize(n)	(n)
+
+#endif							/* } */
+
 
 /*
 ** returns the index for `key' if `key' is an appropriate key to live in
 ** the array part of the table, -1 otherwise.
 */
 static int arrayindex (const TValue *key) {
-  if (ttisnumber(key)) {
+  if (ttisinteger(key)) {
+    LUA_Integer i = ivalue(key);
+    if (cast(LUA_Integer, cast_int(i)) == i)
+      return cast_int(i);
+  }
+  else if (ttisnumber(key)) {
     LUA_Number n = nvalue(key);
     int k;
     LUA_number2int(k, n);
@@ -136,10 +419,348 @@ static int arrayindex (const TValue *key) {
 }
 
 
+#if defined(LUA_USE_PACKEDARRAYS)	/* { */
+
+/*
+** {=============================================================
+** Packed arrays
+** An array part whose first 'npacked' slots hold numbers with the same
+** tag, and whose other slots are nil, may keep just the values of those
+** numbers, with 'packed' set to their tag. The values come after one
+** TValue, where 'LUAH_getint' (and so 'LUAH_get') copies the element it
+** returns, as there is no TValue in the array to point to; its callers
+** only read it, before touching the table again. Stores that keep the
+** array part packed go through 'LUAH_setpacked' or 'LUAH_setint';
+** 'LUAH_set' and explicit resizes unpack it, as their callers store in
+** place. An array part is packed when an append grows it while it is
+** full of numbers of one kind.
+** ==============================================================
+*/
+
+/* smallest array part worth packing */
+#if !defined(LUAI_MINPACKED)
+#define LUAI_MINPACKED		64
+#endif
+
+#define packedsize(n)	(sizeof(TValue) + cast(size_t, n) * sizeof(Value))
+
+/* true if slot `i' of the array part of `t' is not nil */
+#define arrayinuse(t,i)	\
+	(ispacked(t) ? cast_int(i) < (t)->npacked : !ttisnil(&(t)->array[i]))
+
+/* value in slot `i' of the array part of `t' */
+#define arrayslot(t,i)	(ispacked(t) ? packedslot(t, i) : &(t)->array[i])
+
+
+static const TValue *packedslot (Table *t, int i) {
+  TValue *o = t->array;  /* the TValue before the elements */
+  if (i >= t->npacked) return LUAO_nilobject;
+  val_(o) = packedarray(t)[i];
+  settt_(o, t->packed);
+  return o;
+}
+
+
+static void setpackedvector (LUA_State *L, Table *t, int size) {
+  if (cast(size_t, size) >= (MAX_SIZET - sizeof(TValue)) / sizeof(Value))
+    LUAM_toobig(L);
+  t->array = cast(TValue *, LUAM_realloc_(L, t->array,
+                                packedsize(t->sizearray), packedsize(size)));
+  t->sizearray = size;
+}
+
+
+/* packs the array part of `t', full of numbers with tag `tag' */
+static void pack (LUA_State *L, Table *t, int tag) {
+  int i, n = t->sizearray;
+  TValue *v = cast(TValue *, LUAM_malloc(L, packedsize(n)));
+  for (i = 0; i < n; i++)
+    cast(Value *, v + 1)[i] = val_(&t->array[i]);
+  LUAM_freearray(L, t->array, n);
+  t->array = v;
+  t->packed = cast_byte(tag);
+  t->npacked = n;
+}
+
+
+void LUAH_unpack (LUA_State *L, Table *t) {
+  int i, n = t->sizearray;
+  TValue *v = LUAM_newvector(L, n, TValue);
+  for (i = 0; i < t->npacked; i++) {
+    val_(&v[i]) = packedarray(t)[i];
+    settt_(&v[i], t->packed);
+  }
+  for (; i < n; i++)
+    setnilvalue(&v[i]);
+  LUAM_freemem(L, t->array, packedsize(n));
+  t->array = v;
+  t->packed = 0;
+}
+
+
+/*
+** stores `val' in slot `i' of the packed array part of `t', unless that
+** would leave a hole or a value of another kind there; returns 0 then
+*/
+static int packedset (Table *t, int i, const TValue *val) {
+  if (ttisnil(val)) {
+    if (i == t->npacked - 1) t->npacked--;  /* removing the last element */
+    return (i >= t->npacked);
+  }
+  else if (rttype(val) != t->packed || i > t->npacked)
+    return 0;
+  if (i == t->npacked) t->npacked++;  /* appending */
+  packedarray(t)[i] = val_(val);
+  return 1;
+}
+
+
+/* true if the hash part of `t' has keys for array slots `from' to `to'-1 */
+static int keysinrange (const Table *t, int from, int to) {
+  int i;
+  for (i = 0; i < sizenode(t); i++) {
+    const Node *n = gnode(t, i);
+    if (!ttisnil(gval(n)) && ttisnumber(gkey(n))) {
+      int k = arrayindex(gkey(n)) + 1;
+      if (from <= k && k < to) return 1;
+    }
+  }
+  return 0;
+}
+
+/* }============================================================= */
+
+#else							/* }{ */
+
+#define arrayinuse(t,i)	(!ttisnil(&(t)->array[i]))
+#define arrayslot(t,i)	(&(t)->array[i])
+
+#endif							/* } */
+
+
+#if defined(LUA_USE_SHAPES)	/* { */
+
+/*
+** {=============================================================
+** Shapes
+** A table whose non-array keys are all short strings (a record) keeps
+** them in a shape instead of a hash part: an immutable list of keys,
+** shared by the tables that got the same keys in the same order, with
+** the value of each key in the vector 'fields' at the key's position.
+** Shapes form a tree, each one extending its parent by a key, and live
+** until the state is closed; so their keys are fixed strings. A field
+** set to nil keeps its position, like a dead key in a hash part. A
+** record gets a hash part instead of its shape when it gets another
+** kind of key, when its new key would pass the limits below, or when
+** it gets a new key while most of its fields are nil (as a map with
+** removals does).
+** ==============================================================
+*/
+
+/* maximum number of keys in a shape */
+#if !defined(LUAI_MAXSHAPEKEYS)
+#define LUAI_MAXSHAPEKEYS	16
+#endif
+
+/* maximum number of shapes in a state */
+#if !defined(LUAI_MAXSHAPES)
+#define LUAI_MAXSHAPES		1000
+#endif
+
+#define sizeshape(n)	(offsetof(Shape, keys) + (n) * sizeof(TString *))
+
+
+static void resize (LUA_State *L, Table *t, int nasize, int nhsize);
+
+
+static Shape *newshape (LUA_State *L, Shape *parent, TString *key) {
+  int n = (parent == NULL) ? 0 : parent->nkeys + 1;
+  Shape *s = cast(Shape *, LUAM_malloc(L, sizeshape(n)));
+  s->parent = parent;
+  s->child = NULL;
+  s->sibling = NULL;
+  s->nkeys = n;
+  if (parent != NULL) {
+    memcpy(s->keys, parent->keys, parent->nkeys * sizeof(TString *));
+    s->keys[n - 1] = key;
+    LUAS_fix(key);  /* shapes are never collected, so neither are keys */
+    s->sibling = parent->child;
+    parent->child = s;
+  }
+  G(L)->nshapes++;
+  return s;
+}
+
+
+static Shape *rootshape (LUA_State *L) {
+  global_State *g = G(L);
+  if (g->rootshape == NULL)
+    g->rootshape = newshape(L, NULL, NULL);
+  return g->rootshape;
+}
+
+
+/*
+** returns the shape that extends 's' with 'key', or NULL if there is
+** none and there is no room for a new one; the shape found goes to the
+** front of the extensions of 's', as tables built alike come in a row
+*/
+static Shape *nextshape (LUA_State *L, Shape *s, TString *key) {
+  Shape **p = &s->child;
+  Shape *c;
+  for (c = *p; c != NULL; p = &c->sibling, c = *p) {
+    if (c->keys[c->nkeys - 1] == key) {
+      *p = c->sibling;
+      c->sibling = s->child;
+      s->child = c;
+      return c;
+    }
+  }
+  if (s->nkeys >= LUAI_MAXSHAPEKEYS || G(L)->nshapes >= LUAI_MAXSHAPES)
+    return NULL;
+  return newshape(L, s, key);
+}
+
+
+/* frees 's', its siblings and their extensions (the tree is shallow) */
+static void freeshapes (LUA_State *L, Shape *s) {
+  while (s != NULL) {
+    Shape *next = s->sibling;
+    freeshapes(L, s->child);
+    LUAM_freemem(L, s, sizeshape(s->nkeys));
+    s = next;
+  }
+}
+
+
+void LUAH_freeshapes (LUA_State *L) {
+  freeshapes(L, G(L)->rootshape);
+  G(L)->rootshape = NULL;
+}
+
+
+/* position of 'key' in shape 's', or -1 */
+static int fieldindex (const Shape *s, const TString *key) {
+  int i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key) return i;
+  }
+  return -1;
+}
+
+
+static const TValue *getfield (Table *t, TString *key) {
+  int i = fieldindex(t->shape, key);
+  return (i >= 0) ? &t->fields[i] : LUAO_nilobject;
+}
+
+
+/* 'getfield' for 'LUAH_getstrhint', where hints are field positions */
+static const TValue *getfieldhint (Table *t, TString *key, int *slot) {
+  Shape *s = t->shape;
+  int i = *slot;
+  if (cast(unsigned int, i) >= cast(unsigned int, s->nkeys) ||
+      s->keys[i] != key) {  /* wrong hint? */
+    i = fieldindex(s, key);
+    if (i < 0) return LUAO_nilobject;
+    *slot = i;  /* remember it for next time */
+  }
+  return &t->fields[i];
+}
+
+
+static void setfieldvector (LUA_State *L, Table *t, int size) {
+  int i;
+  LUAM_reallocvector(L, t->fields, t->sizefields, size, TValue);
+  for (i = t->sizefields; i < size; i++)
+    setnilvalue(&t->fields[i]);
+  t->sizefields = cast_byte(size);
+}
+
+
+/*
+** makes 't', a new table, a record without keys with room for 'size'
+** fields (the size hint of its constructor)
+*/
+static void newrecord (LUA_State *L, Table *t, int size) {
+  Shape *root = rootshape(L);
+  setfieldvector(L, t, size);
+  t->shape = root;
+}
+
+
+/*
+** gives record 't' a hash part with its fields (and room for one more
+** key) instead of its shape
+*/
+static void unshape (LUA_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *f = t->fields;
+  int size = t->sizefields;
+  int i, n = 0;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!ttisnil(&f[i])) n++;
+  }
+  /* fields stay reachable while the hash part is allocated */
+  resize(L, t, t->sizearray, n + 1);
+  t->shape = NULL;
+  t->fields = NULL;
+  t->sizefields = 0;
+  for (i = 0; i < s->nkeys; i++) {  /* no allocations from here on */
+    if (!ttisnil(&f[i])) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      setobjt2t(L, LUAH_set(L, t, &k), &f[i]);
+    }
+  }
+  LUAM_freearray(L, f, size);
+}
+
+
+/* true if more than half of the fields of record 't' are nil */
+static int mostlynil (const Table *t) {
+  int i, n = 0;
+  for (i = 0; i < t->shape->nkeys; i++) {
+    if (ttisnil(&t->fields[i])) n++;
+  }
+  return (2 * n > t->shape->nkeys);
+}
+
+
+/*
+** adds 'key' to record 't' (or to 't' without a hash part, which then
+** becomes a record) and returns its field; otherwise returns NULL, and
+** a record has a hash part instead of its shape
+*/
+static TValue *newfield (LUA_State *L, Table *t, const TValue *key) {
+  Shape *s = t->shape;
+  if (ttisshrstring(key) && (s == NULL || !mostlynil(t))) {
+    s = nextshape(L, (s != NULL) ? s : rootshape(L), rawtsvalue(key));
+    if (s != NULL) {
+      if (s->nkeys > t->sizefields) {  /* no room for the new field? */
+        int size = 2 * t->sizefields;
+        if (size < 4) size = 4;
+        if (size > LUAI_MAXSHAPEKEYS) size = LUAI_MAXSHAPEKEYS;
+        setfieldvector(L, t, size);
+      }
+      t->shape = s;
+      return &t->fields[s->nkeys - 1];
+    }
+  }
+  if (t->shape != NULL)
+    unshape(L, t);
+  return NULL;
+}
+
+/* }============================================================= */
+
+#endif							/* } */
+
+
 /*
 ** returns the index of a `key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by -1.
+** elements in the array part, then fields of a record, then elements
+** in the hash part. The beginning of a traversal is signaled by -1.
 */
 static int findindex (LUA_State *L, Table *t, StkId key) {
   int i;
@@ -147,7 +768,20 @@ static int findindex (LUA_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (-1 <= i && i < t->sizearray-1)  /* is `key' inside array part? */
     return i+1;  /* yes; that's the index (corrected to C) */
+#if defined(LUA_USE_SHAPES)
+  else if (t->shape != NULL && ttisshrstring(key) &&
+           (i = fieldindex(t->shape, rawtsvalue(key))) >= 0)
+    return i + t->sizearray;  /* fields are numbered after array ones */
+#endif
   else {
+#if defined(LUA_USE_SWISSTABLE)
+    /* key may be dead already, but it is ok to use it in `next' */
+    Node *n = findnode(t, key, 1);
+    if (n == NULL)
+      LUAG_runerror(L, "invalid key to " LUA_QL("NEXT"));  /* key not found */
+    /* hash elements are numbered after array ones */
+    return cast_int(n - gnode(t, 0)) + t->sizearray + nfields(t);
+#else
     Node *n = mainposition(t, key);
     for (;;) {  /* check whether `key' is somewhere in the chain */
       /* key may be dead already, but it is ok to use it in `next' */
@@ -156,12 +790,13 @@ static int findindex (LUA_State *L, Table *t, StkId key) {
              deadvalue(gkey(n)) == gcvalue(key))) {
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */
         /* hash elements are numbered after array ones */
-        return i + t->sizearray;
+        return i + t->sizearray + nfields(t);
       }
       else n = gnext(n);
       if (n == NULL)
         LUAG_runerror(L, "invalid key to " LUA_QL("NEXT"));  /* key not found */
     }
+#endif
   }
 }
 
@@ -169,13 +804,24 @@ static int findindex (LUA_State *L, Table *t, StkId key) {
 int LUAH_next (LUA_State *L, Table *t, StkId key) {
   int i = findindex(L, t, key);  /* find original element */
   for (i++; i < t->sizearray; i++) {  /* try first array part */
-    if (!ttisnil(&t->array[i])) {  /* a non-nil value? */
-      setnvalue(key, cast_num(i-1));
-      setobj2s(L, key+1, &t->array[i]);
+    if (arrayinuse(t, i)) {  /* a non-nil value? */
+      setivalue(key, i-1);
+      setobj2s(L, key+1, arrayslot(t, i));
       return 1;
     }
   }
-  for (i -= t->sizearray; i < sizenode(t); i++) {  /* then hash part */
+  i -= t->sizearray;
+#if defined(LUA_USE_SHAPES)
+  for (; i < nfields(t); i++) {  /* then fields */
+    if (!ttisnil(&t->fields[i])) {  /* a non-nil value? */
+      setsvalue2s(L, key, t->shape->keys[i]);
+      setobj2s(L, key+1, &t->fields[i]);
+      return 1;
+    }
+  }
+  i -= nfields(t);
+#endif
+  for (; i < sizenode(t); i++) {  /* then hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
@@ -217,7 +863,8 @@ static int computesizes (int nums[], int *narray) {
 
 static int countint (const TValue *key, int *nums) {
   int k = arrayindex(key);
-  if (0 < k && k <= MAXASIZE) {  /* is `key' an appropriate array index? */
+  /* array keys start at -1, so key `k' is counted at position k+2 */
+  if (-1 <= k && k <= MAXASIZE - 2) {  /* is `key' an appropriate array index? */
     nums[LUAO_ceillog2(k+2)]++;  /* count as such */
     return 1;
   }
@@ -241,7 +888,7 @@ static int numusearray (const Table *t, int *nums) {
     }
     /* count elements in range (2^(lg-1), 2^lg] */
     for (; i <= lim; i++) {
-      if (!ttisnil(&t->array[i-1]))
+      if (arrayinuse(t, i-1))
         lc++;
     }
     nums[lg] += lc;
@@ -285,10 +932,13 @@ static void setnodevector (LUA_State *L, Table *t, int size) {
   else {
     int i;
     lsize = LUAO_ceillog2(size);
+#if defined(LUA_USE_SWISSTABLE)
+    if (capacity(lsize) < size) lsize++;  /* keep some slots empty */
+#endif
     if (lsize > MAXBITS)
       LUAG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = LUAM_newvector(L, size, Node);
+    t->node = newnodevector(L, lsize);
     for (i=0; i<size; i++) {
       Node *n = gnode(t, i);
       gnext(n) = NULL;
@@ -297,15 +947,59 @@ static void setnodevector (LUA_State *L, Table *t, int size) {
     }
   }
   t->lsizenode = cast_byte(lsize);
+#if defined(LUA_USE_SWISSTABLE)
+  clearctrl(t);
+#else
   t->lastfree = gnode(t, size);  /* all positions are free */
+#endif
 }
 
 
-void LUAH_resize (LUA_State *L, Table *t, int nasize, int nhsize) {
+#if defined(LUA_USE_SWISSTABLE)
+
+/*
+** returns the cell for a key that moves into a resized table (so that
+** it is not there yet), taking a hash slot without searching for it
+*/
+static TValue *reinsert (LUA_State *L, Table *t, const TValue *key) {
+  int k = arrayindex(key);
+  Node *n;
+  UNUSED(L);
+  if (-1 <= k && k < t->sizearray-1) {
+    LUA_assert(!ispacked(t));  /* (see 'resize') */
+    return &t->array[k+1];
+  }
+  n = takeslot(t, hashkey(key));
+  setobj2t(L, gkey(n), key);
+  return gval(n);
+}
+
+#else
+
+#define reinsert(L,t,k)		LUAH_set(L, t, k)
+
+#endif
+
+
+static void resize (LUA_State *L, Table *t, int nasize, int nhsize) {
   int i;
   int oldasize = t->sizearray;
   int oldhsize = t->lsizenode;
   Node *nold = t->node;  /* save old hash ... */
+#if defined(LUA_USE_SHAPES)
+  /* records have no hash part and cannot take keys from the array */
+  LUA_assert(t->shape == NULL || (isdummy(nold) && nasize >= oldasize));
+#endif
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (ispacked(t)) {
+    if (nasize < t->npacked || keysinrange(t, oldasize, nasize))
+      LUAH_unpack(L, t);  /* elements change parts; resize it as usual */
+    else {  /* elements stay; free slots need no values */
+      setpackedvector(L, t, nasize);
+      oldasize = nasize;  /* array part is done */
+    }
+  }
+#endif
   if (nasize > oldasize)  /* array part must grow? */
     setarrayvector(L, t, nasize);
   /* create new hash part with appropriate size */
@@ -315,7 +1009,7 @@ void LUAH_resize (LUA_State *L, Table *t, int nasize, int nhsize) {
     /* re-insert elements from vanishing slice */
     for (i=nasize; i<oldasize; i++) {
       if (!ttisnil(&t->array[i]))
-        LUAH_setint(L, t, i + 1, &t->array[i]);
+        LUAH_setint(L, t, i - 1, &t->array[i]);
     }
     /* shrink array */
     LUAM_reallocvector(L, t->array, oldasize, nasize, TValue);
@@ -326,11 +1020,29 @@ void LUAH_resize (LUA_State *L, Table *t, int nasize, int nhsize) {
     if (!ttisnil(gval(old))) {
       /* doesn't need barrier/invalidate cache, as entry was
          already present in the table */
-      setobjt2t(L, LUAH_set(L, t, gkey(old)), gval(old));
+      setobjt2t(L, reinsert(L, t, gkey(old)), gval(old));
     }
   }
   if (!isdummy(nold))
-    LUAM_freearray(L, nold, cast(size_t, twoto(oldhsize))); /* free old array */
+    freenodevector(L, nold, oldhsize);  /* free old array */
+}
+
+
+void LUAH_resize (LUA_State *L, Table *t, int nasize, int nhsize) {
+#if defined(LUA_USE_SHAPES)
+  if (t->shape == NULL && isdummy(t->node) &&
+      0 < nhsize && nhsize <= LUAI_MAXSHAPEKEYS) {
+    newrecord(L, t, nhsize);  /* a constructor; expect a record */
+    nhsize = 0;
+  }
+  else if (t->shape != NULL)
+    nhsize = 0;  /* records keep their keys in fields */
+#endif
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (ispacked(t))
+    LUAH_unpack(L, t);  /* callers store into the array part in place */
+#endif
+  resize(L, t, nasize, nhsize);
 }
 
 
@@ -342,7 +1054,7 @@ void LUAH_resizearray (LUA_State *L, Table *t, int nasize) {
 
 static void rehash (LUA_State *L, Table *t, const TValue *ek) {
   int nasize, na;
-  int nums[MAXBITS+1];  /* nums[i] = number of keys with 2^(i-1) < k <= 2^i */
+  int nums[MAXBITS+1];  /* nums[i] = number of keys with 2^(i-1) < k+2 <= 2^i */
   int i;
   int totaluse;
   for (i=0; i<=MAXBITS; i++) nums[i] = 0;  /* reset counts */
@@ -355,9 +1067,55 @@ static void rehash (LUA_State *L, Table *t, const TValue *ek) {
   /* compute new size for array part */
   na = computesizes(nums, &nasize);
   /* resize the table to new computed sizes */
-  LUAH_resize(L, t, nasize, totaluse - na);
+  resize(L, t, nasize, rehashsize(totaluse - na));
+}
+
+
+#if defined(LUA_USE_PACKEDARRAYS)
+
+/*
+** grows the array part of `t', full of numbers with the tag of `val',
+** packing it first if needed, to store `val' at `key' right after its
+** elements; returns 0 if that cannot be done keeping it packed
+*/
+static int packedgrow (LUA_State *L, Table *t, const TValue *key,
+                                               const TValue *val) {
+  int i, n = t->sizearray;
+  int tag = rttype(val);
+  if (2 * n < LUAI_MINPACKED || !ttisnil(LUAH_getint(t, n - 1)))
+    return 0;  /* too small, or `key' is in the hash part */
+  if (ispacked(t)) {
+    if (t->npacked < n || t->packed != tag) return 0;
+  }
+  else {
+    for (i = 0; i < n; i++) {
+      if (rttype(&t->array[i]) != tag) return 0;
+    }
+    pack(L, t, tag);
+  }
+  rehash(L, t, key);
+  return (ispacked(t) && n < t->sizearray && packedset(t, n, val));
+}
+
+
+/*
+** stores `val' at `key' in `t' if its array part is packed and stays
+** so, or if an append packs it; otherwise returns 0, and the caller
+** stores it as usual, the array part being unpacked if `key' is there
+*/
+int LUAH_setpacked (LUA_State *L, Table *t, const TValue *key,
+                                            const TValue *val) {
+  int i = arrayindex(key) + 1;  /* slot of `key' in the array part */
+  if (ispacked(t) && 0 <= i && i < t->sizearray) {
+    if (packedset(t, i, val)) return 1;
+    LUAH_unpack(L, t);
+    return 0;
+  }
+  return (i == t->sizearray && ttisnumber(val) && packedgrow(L, t, key, val));
 }
 
+#endif
+
 
 
 /*
@@ -371,19 +1129,197 @@ Table *LUAH_new (LUA_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->lenhint = 0;
+#if defined(LUA_USE_PACKEDARRAYS)
+  t->packed = 0;
+  t->npacked = 0;
+#endif
   setnodevector(L, t, 0);
+#if defined(LUA_USE_SHAPES)
+  t->shape = NULL;
+  t->fields = NULL;
+  t->sizefields = 0;
+#endif
   return t;
 }
 
 
 void LUAH_free (LUA_State *L, Table *t) {
   if (!isdummy(t->node))
-    LUAM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    freenodevector(L, t->node, t->lsizenode);
+#if defined(LUA_USE_SHAPES)
+  LUAM_freearray(L, t->fields, t->sizefields);
+#endif
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (ispacked(t))
+    LUAM_freemem(L, t->array, packedsize(t->sizearray));
+  else
+#endif
   LUAM_freearray(L, t->array, t->sizearray);
   LUAM_free(L, t);
 }
 
 
+static void copynested (LUA_State *L, TValue *o) {
+  Table *from = hvalue(o);
+  Table *t = LUAH_new(L);
+  sethvalue(L, o, t);
+  LUAH_copy(L, t, from);
+}
+
+
+/*
+** fill the new table 't' with a copy of template 'from' (see
+** OP_NEWTABLEK); tables in a template are templates of nested
+** constructors, so they are copied too (they are never keys; see
+** 'runconstructor')
+*/
+void LUAH_copy (LUA_State *L, Table *t, Table *from) {
+  int size = isdummy(from->node) ? 0 : sizenode(from);
+  int i;
+  LUA_assert(t->sizearray == 0 && isdummy(t->node));
+  LUA_assert(!ispacked(from));  /* templates are built with 'LUAH_set' */
+  if (from->sizearray > 0) {
+    t->array = LUAM_newvector(L, from->sizearray, TValue);
+    memcpy(t->array, from->array, from->sizearray * sizeof(TValue));
+    t->sizearray = from->sizearray;
+  }
+  if (size > 0) {
+#if defined(LUA_USE_SWISSTABLE)
+    t->node = newnodevector(L, from->lsizenode);
+    memcpy(t->node, from->node, nodevectorsize(from->lsizenode));
+    t->lsizenode = from->lsizenode;
+    t->growth = from->growth;
+#else
+    Node *n = LUAM_newvector(L, size, Node);
+    memcpy(n, from->node, size * sizeof(Node));
+    for (i = 0; i < size; i++) {  /* relocate chains */
+      if (gnext(&n[i]) != NULL)
+        gnext(&n[i]) = n + (gnext(&n[i]) - from->node);
+    }
+    t->node = n;
+    t->lsizenode = from->lsizenode;
+    t->lastfree = n + (from->lastfree - from->node);
+#endif
+    invalidateTMcache(t);  /* keys may name metamethods */
+  }
+#if defined(LUA_USE_SHAPES)
+  if (from->shape != NULL) {  /* a record? share its shape */
+    t->fields = LUAM_newvector(L, from->sizefields, TValue);
+    memcpy(t->fields, from->fields, from->sizefields * sizeof(TValue));
+    t->sizefields = from->sizefields;
+    t->shape = from->shape;
+    invalidateTMcache(t);  /* keys may name metamethods */
+  }
+  for (i = 0; i < nfields(t); i++) {
+    if (ttistable(&t->fields[i])) copynested(L, &t->fields[i]);
+  }
+#endif
+  for (i = 0; i < t->sizearray; i++) {
+    if (ttistable(&t->array[i])) copynested(L, &t->array[i]);
+  }
+  for (i = 0; i < size; i++) {
+    if (ttistable(gval(gnode(t, i)))) copynested(L, gval(gnode(t, i)));
+  }
+}
+
+
+#if defined(LUA_USE_SWISSTABLE)	/* { */
+
+/*
+** inserts a new key into a hash table, in the first empty slot of its
+** probe sequence; when no more slots may be taken, rehashes the table
+** first, which also drops the keys whose values are nil. A dead key of
+** the same object gets it back instead, as 'findindex' would match that
+** slot too, and a traversal would then visit the key twice.
+*/
+TValue *LUAH_newkey (LUA_State *L, Table *t, const TValue *key) {
+  Node *n;
+  if (ttisnil(key)) LUAG_runerror(L, "table index is NIL");
+  else if (ttisnumber(key) && LUAi_numisnan(L, nvalue(key)))
+    LUAG_runerror(L, "table index is NaN");
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL || isdummy(t->node)) {  /* record (or may become)? */
+    TValue *f = newfield(L, t, key);
+    if (f != NULL) return f;
+  }
+#endif
+  if (iscollectable(key) && (n = findnode(t, key, 1)) != NULL)
+    LUA_assert(ttisdeadkey(gkey(n)) && ttisnil(gval(n)));  /* revive it */
+  else if (t->growth == 0) {  /* cannot take a free place? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' take care of TM cache and GC barrier */
+    return LUAH_set(L, t, key);  /* insert key into grown table */
+  }
+  else
+    n = takeslot(t, hashkey(key));
+  setobj2t(L, gkey(n), key);
+  LUAC_barrierback(L, obj2gco(t), key);
+  LUA_assert(ttisnil(gval(n)));
+  return gval(n);
+}
+
+
+/*
+** search function for integers
+*/
+const TValue *LUAH_getint (Table *t, int key) {
+  if (-1 <= key && key < t->sizearray-1)
+    return arrayslot(t, key+1);
+  else {
+    Node *n = findint(t, key);
+    return (n != NULL) ? gval(n) : LUAO_nilobject;
+  }
+}
+
+
+/*
+** search function for short strings
+*/
+const TValue *LUAH_getstr (Table *t, TString *key) {
+  Node *n;
+  LUA_assert(key->tsv.tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) return getfield(t, key);
+#endif
+  n = findstr(t, key);
+  return (n != NULL) ? gval(n) : LUAO_nilobject;
+}
+
+
+/*
+** search function for short strings that first tries node 'slot'
+** (see the chained version below)
+*/
+const TValue *LUAH_getstrhint (Table *t, TString *key, int *slot) {
+  Node *n;
+  LUA_assert(key->tsv.tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) return getfieldhint(t, key, slot);
+#endif
+  if (cast(unsigned int, *slot) < cast(unsigned int, sizenode(t))) {
+    n = gnode(t, *slot);
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
+      return gval(n);  /* hint was right */
+  }
+  n = findstr(t, key);
+  if (n == NULL)
+    return LUAO_nilobject;
+  *slot = cast_int(n - gnode(t, 0));  /* remember it for next time */
+  return gval(n);
+}
+
+
+/*
+** search function for any key
+*/
+static const TValue *getgeneric (Table *t, const TValue *key) {
+  Node *n = findnode(t, key, 0);
+  return (n != NULL) ? gval(n) : LUAO_nilobject;
+}
+
+#else							/* }{ */
+
 static Node *getfreepos (Table *t) {
   while (t->lastfree > t->node) {
     t->lastfree--;
@@ -407,6 +1343,12 @@ TValue *LUAH_newkey (LUA_State *L, Table *t, const TValue *key) {
   if (ttisnil(key)) LUAG_runerror(L, "table index is NIL");
   else if (ttisnumber(key) && LUAi_numisnan(L, nvalue(key)))
     LUAG_runerror(L, "table index is NaN");
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL || isdummy(t->node)) {  /* record (or may become)? */
+    TValue *f = newfield(L, t, key);
+    if (f != NULL) return f;
+  }
+#endif
   mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(mp)) {  /* main position is taken? */
     Node *othern;
@@ -445,12 +1387,13 @@ TValue *LUAH_newkey (LUA_State *L, Table *t, const TValue *key) {
 */
 const TValue *LUAH_getint (Table *t, int key) {
   if (-1 <= key && key < t->sizearray-1)
-    return &t->array[key+1];
+    return arrayslot(t, key+1);
   else {
     LUA_Number nk = cast_num(key);
     Node *n = hashnum(t, nk);
     do {  /* check whether `key' is somewhere in the chain */
-      if (ttisnumber(gkey(n)) && LUAi_numeq(nvalue(gkey(n)), nk))
+      if (ttisinteger(gkey(n)) ? ivalue(gkey(n)) == key :
+          (ttisnumber(gkey(n)) && LUAi_numeq(nvalue(gkey(n)), nk)))
         return gval(n);  /* that's it */
       else n = gnext(n);
     } while (n);
@@ -465,6 +1408,9 @@ const TValue *LUAH_getint (Table *t, int key) {
 const TValue *LUAH_getstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
   LUA_assert(key->tsv.tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) return getfield(t, key);
+#endif
   do {  /* check whether `key' is somewhere in the chain */
     if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
       return gval(n);  /* that's it */
@@ -474,6 +1420,53 @@ const TValue *LUAH_getstr (Table *t, TString *key) {
 }
 
 
+/*
+** search function for short strings that first tries node 'slot'
+** (a hint from a previous search); on a hit elsewhere, 'slot' is
+** updated. Any value is a valid hint, as it is checked against the
+** current node vector; so hints survive (or simply miss after) a
+** 'LUAH_resize' without explicit invalidation. In records, hints are
+** positions of fields.
+*/
+const TValue *LUAH_getstrhint (Table *t, TString *key, int *slot) {
+  Node *n;
+  LUA_assert(key->tsv.tt == LUA_TSHRSTR);
+#if defined(LUA_USE_SHAPES)
+  if (t->shape != NULL) return getfieldhint(t, key, slot);
+#endif
+  if (cast(unsigned int, *slot) < cast(unsigned int, sizenode(t))) {
+    n = gnode(t, *slot);
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key))
+      return gval(n);  /* hint was right */
+  }
+  n = hashstr(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (ttisshrstring(gkey(n)) && eqshrstr(rawtsvalue(gkey(n)), key)) {
+      *slot = cast_int(n - gnode(t, 0));  /* remember it for next time */
+      return gval(n);
+    }
+    else n = gnext(n);
+  } while (n);
+  return LUAO_nilobject;
+}
+
+
+/*
+** search function for any key
+*/
+static const TValue *getgeneric (Table *t, const TValue *key) {
+  Node *n = mainposition(t, key);
+  do {  /* check whether `key' is somewhere in the chain */
+    if (LUAV_rawequalobj(gkey(n), key))
+      return gval(n);  /* that's it */
+    else n = gnext(n);
+  } while (n);
+  return LUAO_nilobject;
+}
+
+#endif							/* } */
+
+
 /*
 ** main search function
 */
@@ -481,23 +1474,21 @@ const TValue *LUAH_get (Table *t, const TValue *key) {
   switch (ttype(key)) {
     case LUA_TSHRSTR: return LUAH_getstr(t, rawtsvalue(key));
     case LUA_TNIL: return LUAO_nilobject;
-    case LUA_TNUMBER: {
+    case LUA_TNUMINT: {
+      LUA_Integer i = ivalue(key);
+      if (cast(LUA_Integer, cast_int(i)) == i)  /* fits in an int? */
+        return LUAH_getint(t, cast_int(i));  /* no conversion needed */
+      return getgeneric(t, key);
+    }
+    case LUA_TNUMFLT: {
       int k;
-      LUA_Number n = nvalue(key);
+      LUA_Number n = fltvalue(key);
       LUA_number2int(k, n);
       if (LUAi_numeq(cast_num(k), n)) /* index is int? */
         return LUAH_getint(t, k);  /* use specialized version */
-      /* else go through */
-    }
-    default: {
-      Node *n = mainposition(t, key);
-      do {  /* check whether `key' is somewhere in the chain */
-        if (LUAV_rawequalobj(gkey(n), key))
-          return gval(n);  /* that's it */
-        else n = gnext(n);
-      } while (n);
-      return LUAO_nilobject;
+      return getgeneric(t, key);
     }
+    default: return getgeneric(t, key);
   }
 }
 
@@ -507,7 +1498,14 @@ const TValue *LUAH_get (Table *t, const TValue *key) {
 ** barrier and invalidate the TM cache.
 */
 TValue *LUAH_set (LUA_State *L, Table *t, const TValue *key) {
-  const TValue *p = LUAH_get(t, key);
+  const TValue *p;
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (ispacked(t)) {  /* no cell to return from a packed array part */
+    int i = arrayindex(key) + 1;
+    if (0 <= i && i < t->sizearray) LUAH_unpack(L, t);
+  }
+#endif
+  p = LUAH_get(t, key);
   if (p != LUAO_nilobject)
     return cast(TValue *, p);
   else return LUAH_newkey(L, t, key);
@@ -515,13 +1513,20 @@ TValue *LUAH_set (LUA_State *L, Table *t, const TValue *key) {
 
 
 void LUAH_setint (LUA_State *L, Table *t, int key, TValue *value) {
-  const TValue *p = LUAH_getint(t, key);
+  const TValue *p;
   TValue *cell;
+#if defined(LUA_USE_PACKEDARRAYS)
+  if (ispacked(t) && -1 <= key && key < t->sizearray-1) {
+    if (packedset(t, key+1, value)) return;
+    LUAH_unpack(L, t);
+  }
+#endif
+  p = LUAH_getint(t, key);
   if (p != LUAO_nilobject)
     cell = cast(TValue *, p);
   else {
     TValue k;
-    setnvalue(&k, cast_num(key));
+    setivalue(&k, key);
     cell = LUAH_newkey(L, t, &k);
   }
   setobj2t(L, cell, value);
@@ -552,26 +1557,56 @@ static int unbound_search (Table *t, int j) {
 }
 
 
+/*
+** true if `n' (below the size of the array part) is a non-zero boundary
+** of `t'; a zero boundary is left to the search, which may find another
+** one past a nil t[-1] (and a new table has not set its hint)
+*/
+#define isarrayborder(t,n)	((n) > 0 && arrayinuse(t, (n) - 1) && \
+				 !arrayinuse(t, n))
+
+
+/* true if `n' is a non-zero boundary of `t' (see 'isarrayborder') */
+static int isborder (Table *t, unsigned int n) {
+  return n > 0 && !ttisnil(LUAH_getint(t, cast_int(n) - 2)) &&
+         ttisnil(LUAH_getint(t, cast_int(n) - 1));
+}
+
+
 /*
 ** Try to find a boundary in table `t'. A `boundary' is an integer index
 ** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** The last boundary found is tried first, and then its neighbours, as
+** appending to or popping from a sequence moves it by one; any of them
+** is in the same part (array or hash) where the search would look.
 */
 int LUAH_getn (Table *t) {
   unsigned int j = t->sizearray;
-  if (j > 0 && ttisnil(&t->array[j - 1])) {
+  unsigned int h = t->lenhint;
+  if (j > 0 && !arrayinuse(t, j - 1)) {
     /* there is a boundary in the array part: (binary) search for it */
     unsigned int i = 0;
+    if (h < j) {
+      if (isarrayborder(t, h)) return h;
+      if (h + 1 < j && isarrayborder(t, h + 1)) return t->lenhint = h + 1;
+      if (h > 1 && isarrayborder(t, h - 1)) return t->lenhint = h - 1;
+    }
     while (j - i > 1) {
       unsigned int m = (i+j)/2;
-      if (ttisnil(&t->array[m - 1])) j = m;
+      if (!arrayinuse(t, m - 1)) j = m;
       else i = m;
     }
-    return i;
+    return t->lenhint = i;
   }
   /* else must find a boundary in hash part */
   else if (isdummy(t->node))  /* hash part is empty? */
-    return j;  /* that is easy... */
-  else return unbound_search(t, (int)j>0 ? (int)j-2 : -2);
+    return t->lenhint = j;  /* that is easy... */
+  if (h >= j && h < cast(unsigned int, MAX_INT)) {
+    if (isborder(t, h)) return h;
+    if (isborder(t, h + 1)) return t->lenhint = h + 1;
+    if (h > j && isborder(t, h - 1)) return t->lenhint = h - 1;
+  }
+  return t->lenhint = unbound_search(t, (int)j>0 ? (int)j-2 : -2);
 }
 
 
@@ -579,7 +1614,12 @@ int LUAH_getn (Table *t) {
 #if defined(LUA_DEBUG)
 
 Node *LUAH_mainposition (const Table *t, const TValue *key) {
+#if defined(LUA_USE_SWISSTABLE)
+  /* first slot of the home group */
+  return gnode(t, (hashgroup(hashkey(key)) & groupmask(t)) * GROUP);
+#else
   return mainposition(t, key);
+#endif
 }
 
 int LUAH_isdummy (Node *n) { return isdummy(n); }
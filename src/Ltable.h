@@ -17,10 +17,29 @@
 
 #define invalidateTMcache(t)	((t)->flags = 0)
 
+/*
+** a packed array part keeps its elements (all numbers with tag 'packed')
+** as bare values after a TValue that 'LUAH_getint' fills for its callers
+*/
+#if defined(LUA_USE_PACKEDARRAYS)
+#define ispacked(t)	((t)->packed != 0)
+#define packedarray(t)	cast(Value *, (t)->array + 1)
+#else
+#define ispacked(t)	0
+#endif
+
+/* number of keys in the record part of table 't' */
+#if defined(LUA_USE_SHAPES)
+#define nfields(t)	((t)->shape == NULL ? 0 : (t)->shape->nkeys)
+#else
+#define nfields(t)	0
+#endif
+
 
 LUAI_FUNC const TValue *LUAH_getint (Table *t, int key);
 LUAI_FUNC void LUAH_setint (LUA_State *L, Table *t, int key, TValue *value);
 LUAI_FUNC const TValue *LUAH_getstr (Table *t, TString *key);
+LUAI_FUNC const TValue *LUAH_getstrhint (Table *t, TString *key, int *slot);
 LUAI_FUNC const TValue *LUAH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *LUAH_newkey (LUA_State *L, Table *t, const TValue *key);
 LUAI_FUNC TValue *LUAH_set (LUA_State *L, Table *t, const TValue *key);
@@ -28,8 +47,17 @@ LUAI_FUNC Table *LUAH_new (LUA_State *L);
 LUAI_FUNC void LUAH_resize (LUA_State *L, Table *t, int nasize, int nhsize);
 LUAI_FUNC void LUAH_resizearray (LUA_State *L, Table *t, int nasize);
 LUAI_FUNC void LUAH_free (LUA_State *L, Table *t);
+LUAI_FUNC void LUAH_copy (LUA_State *L, Table *t, Table *from);
 LUAI_FUNC int LUAH_next (LUA_State *L, Table *t, StkId key);
 LUAI_FUNC int LUAH_getn (Table *t);
+#if defined(LUA_USE_SHAPES)
+LUAI_FUNC void LUAH_freeshapes (LUA_State *L);
+#endif
+#if defined(LUA_USE_PACKEDARRAYS)
+LUAI_FUNC int LUAH_setpacked (LUA_State *L, Table *t, const TValue *key,
+                                                      const TValue *val);
+LUAI_FUNC void LUAH_unpack (LUA_State *L, Table *t);
+#endif
 
 
 #if defined(LUA_DEBUG)
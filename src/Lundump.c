@@ -14,9 +14,13 @@
 #include "Ldebug.h"
 #include "Ldo.h"
 #include "Lfunc.h"
+#include "Lgc.h"
 #include "Lmem.h"
 #include "Lobject.h"
+#include "Lopcodes.h"
+#include "Lstate.h"
 #include "Lstring.h"
+#include "Ltable.h"
 #include "Lundump.h"
 #include "Lzio.h"
 
@@ -25,6 +29,7 @@ typedef struct {
  ZIO* Z;
  Mbuffer* b;
  const char* name;
+ Image* image;		/* if not NULL, Z holds all of it as its one block */
 } LoadState;
 
 static l_noret error(LoadState* S, const char* why)
@@ -47,6 +52,30 @@ static void LoadBlock(LoadState* S, void* b, size_t size)
  if (LUAZ_read(S->Z,b,size)!=0) error(S,"truncated");
 }
 
+/* skip 'size' bytes of an image */
+static void SkipBlock(LoadState* S, size_t size)
+{
+ if (size>S->Z->n) error(S,"truncated");
+ S->Z->p+=size;
+ S->Z->n-=size;
+}
+
+static void SkipVector(LoadState* S, int n, size_t size)
+{
+ if ((size_t)n>S->Z->n/size) error(S,"truncated");
+ SkipBlock(S,n*size);
+}
+
+/* make 'f' refer to the image being loaded */
+static void Refer(LoadState* S, Proto* f)
+{
+ if (f->image==NULL)
+ {
+  f->image=S->image;
+  S->image->nref++;
+ }
+}
+
 static int LoadChar(LoadState* S)
 {
  char x;
@@ -75,6 +104,12 @@ static TString* LoadString(LoadState* S)
  LoadVar(S,size);
  if (size==0)
   return NULL;
+ else if (S->image!=NULL)		/* read it in place */
+ {
+  const char* s=S->Z->p;
+  SkipBlock(S,size);
+  return LUAS_newlstr(S->L,s,size-1);
+ }
  else
  {
   char* s=LUAZ_openspace(S->L,S->b,size);
@@ -86,41 +121,121 @@ static TString* LoadString(LoadState* S)
 static void LoadCode(LoadState* S, Proto* f)
 {
  int n=LoadInt(S);
- f->code=LUAM_newvector(S->L,n,Instruction);
- f->sizecode=n;
- LoadVector(S,f->code,n,sizeof(Instruction));
+ if (S->image!=NULL && n>0 && IntPoint(S->Z->p)%sizeof(Instruction)==0)
+ {					/* use the instructions in place */
+  Instruction* code=cast(Instruction*,S->Z->p);
+  SkipVector(S,n,sizeof(Instruction));
+  Refer(S,f);
+  f->code=code;
+  f->sizecode=n;
+ }
+ else
+ {
+  f->code=LUAM_newvector(S->L,n,Instruction);
+  f->sizecode=n;
+  LoadVector(S,f->code,n,sizeof(Instruction));
+ }
+ LUAP_fuse(f->code,n);
 }
 
+static void SkipFunction(LoadState* S);
+
 static void LoadFunction(LoadState* S, Proto* f);
 
-static void LoadConstants(LoadState* S, Proto* f)
+static void LoadConstant(LoadState* S, TValue* o);
+
+/* template of a constant constructor (see DumpTemplate); 'o' anchors it */
+static void LoadTemplate(LoadState* S, TValue* o)
 {
+ LUA_State* L=S->L;
+ Table* t=LUAH_new(L);
  int i,n;
+ sethvalue(L,o,t);
  n=LoadInt(S);
- f->k=LUAM_newvector(S->L,n,TValue);
- f->sizek=n;
- for (i=0; i<n; i++) setnilvalue(&f->k[i]);
+ LUAH_resize(L,t,n,0);
+ for (i=0; i<n; i++) LoadConstant(S,&t->array[i]);
+ n=LoadInt(S);
+ LUAH_resize(L,t,t->sizearray,n);
  for (i=0; i<n; i++)
  {
-  TValue* o=&f->k[i];
-  int t=LoadChar(S);
-  switch (t)
-  {
-   case LUA_TNIL:
+  setnilvalue(L->top); incr_top(L);	/* anchor key and value */
+  LoadConstant(S,L->top-1);
+  setnilvalue(L->top); incr_top(L);
+  LoadConstant(S,L->top-1);
+  setobj2t(L,LUAH_set(L,t,L->top-2),L->top-1);
+  L->top-=2;
+ }
+}
+
+static void LoadConstant(LoadState* S, TValue* o)
+{
+ int t=LoadChar(S);
+ switch (t)
+ {
+  case LUA_TNIL:
 	setnilvalue(o);
 	break;
-   case LUA_TBOOLEAN:
+  case LUA_TBOOLEAN:
 	setbvalue(o,LoadChar(S));
 	break;
-   case LUA_TNUMBER:
-	setnvalue(o,LoadNumber(S));
+  case LUA_TNUMBER:
+	LUAO_setnumber(o,LoadNumber(S));
+	LUAi_checknum(S->L,o,error(S,"corrupted"));
 	break;
-   case LUA_TSTRING:
+  case LUA_TSTRING:
 	setsvalue2n(S->L,o,LoadString(S));
 	break;
-    default: LUA_assert(0);
-  }
+  case LUA_TTABLE:
+	LoadTemplate(S,o);
+	break;
+   default: LUA_assert(0);
+ }
+}
+
+static void SkipString(LoadState* S)
+{
+ size_t size;
+ LoadVar(S,size);
+ SkipBlock(S,size);
+}
+
+/* skip a constant, checking it as LoadConstant would */
+static void SkipConstant(LoadState* S)
+{
+ TValue o;
+ int i,n;
+ switch (LoadChar(S))
+ {
+  case LUA_TNIL:
+	break;
+  case LUA_TBOOLEAN:
+	LoadChar(S);
+	break;
+  case LUA_TNUMBER:
+	LUAO_setnumber(&o,LoadNumber(S));
+	LUAi_checknum(S->L,&o,error(S,"corrupted"));
+	break;
+  case LUA_TSTRING:
+	SkipString(S);
+	break;
+  case LUA_TTABLE:
+	n=LoadInt(S);
+	for (i=0; i<n; i++) SkipConstant(S);
+	n=LoadInt(S);
+	for (i=0; i<2*n; i++) SkipConstant(S);
+	break;
+  default: error(S,"corrupted");
  }
+}
+
+static void LoadConstants(LoadState* S, Proto* f)
+{
+ int i,n;
+ n=LoadInt(S);
+ f->k=LUAM_newvector(S->L,n,TValue);
+ f->sizek=n;
+ for (i=0; i<n; i++) setnilvalue(&f->k[i]);
+ for (i=0; i<n; i++) LoadConstant(S,&f->k[i]);
  n=LoadInt(S);
  f->p=LUAM_newvector(S->L,n,Proto*);
  f->sizep=n;
@@ -128,7 +243,14 @@ static void LoadConstants(LoadState* S, Proto* f)
  for (i=0; i<n; i++)
  {
   f->p[i]=LUAF_newproto(S->L);
-  LoadFunction(S,f->p[i]);
+  if (S->image!=NULL)		/* load it when a closure needs it */
+  {
+   Refer(S,f->p[i]);
+   f->p[i]->lazy=S->Z->p;
+   SkipFunction(S);
+  }
+  else
+   LoadFunction(S,f->p[i]);
  }
 }
 
@@ -181,6 +303,32 @@ static void LoadFunction(LoadState* S, Proto* f)
  LoadDebug(S,f);
 }
 
+/* skip a function, checking its structure as LoadFunction would */
+static void SkipFunction(LoadState* S)
+{
+ int i,n;
+ LoadInt(S);				/* linedefined */
+ LoadInt(S);				/* lastlinedefined */
+ SkipBlock(S,3);			/* numparams, is_vararg, maxstacksize */
+ SkipVector(S,LoadInt(S),sizeof(Instruction));
+ n=LoadInt(S);
+ for (i=0; i<n; i++) SkipConstant(S);
+ n=LoadInt(S);
+ for (i=0; i<n; i++) SkipFunction(S);
+ SkipVector(S,LoadInt(S),2);		/* upvalues */
+ SkipString(S);				/* source */
+ SkipVector(S,LoadInt(S),sizeof(int));	/* lineinfo */
+ n=LoadInt(S);
+ for (i=0; i<n; i++)
+ {
+  SkipString(S);
+  LoadInt(S);
+  LoadInt(S);
+ }
+ n=LoadInt(S);
+ for (i=0; i<n; i++) SkipString(S);
+}
+
 /* the code below must be consistent with the code in LUAU_header */
 #define N0	LUAC_HEADERSIZE
 #define N1	(sizeof(LUA_SIGNATURE)-sizeof(char))
@@ -203,7 +351,7 @@ static void LoadHeader(LoadState* S)
 /*
 ** load precompiled chunk
 */
-Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name)
+Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name, Image* image)
 {
  LoadState S;
  Closure* cl;
@@ -216,6 +364,7 @@ Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name)
  S.L=L;
  S.Z=Z;
  S.b=buff;
+ S.image=image;
  LoadHeader(&S);
  cl=LUAF_newLclosure(L,1);
  setclLvalue(L,L->top,cl); incr_top(L);
@@ -232,6 +381,67 @@ Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name)
  return cl;
 }
 
+static const char* NoMore(LUA_State* L, void* ud, size_t* size)
+{
+ UNUSED(L); UNUSED(ud); UNUSED(size);
+ return NULL;
+}
+
+/*
+** load the body of prototype 'f->p[i]', left in its image when 'f' was
+** loaded; the new prototype replaces it
+*/
+Proto* LUAU_materialize (LUA_State* L, Proto* f, int i)
+{
+ Image* image=f->p[i]->image;
+ LoadState S;
+ ZIO Z;
+ Closure* cl;
+ Proto* p;
+ LUA_assert(f->p[i]->lazy!=NULL);
+ S.L=L;
+ S.Z=&Z;
+ S.b=NULL;
+ S.name="binary image";
+ S.image=image;
+ LUAZ_init(L,&Z,NoMore,NULL);
+ Z.p=f->p[i]->lazy;
+ Z.n=image->size-(Z.p-image->p);
+ cl=LUAF_newLclosure(L,0);		/* anchors the new prototype */
+ setclLvalue(L,L->top,cl); incr_top(L);
+ cl->l.p=p=LUAF_newproto(L);
+ LoadFunction(&S,p);
+ f->p[i]=p;				/* old one is garbage now */
+ LUAC_objbarrier(L,f,p);
+ L->top--;
+ return p;
+}
+
+Image* LUAU_newimage (LUA_State* L, void* p, size_t size, LUA_Unmap unmap, void* ud)
+{
+ global_State* g=G(L);
+ Image* image=cast(Image*,(*g->frealloc)(g->ud,NULL,0,sizeof(Image)));
+ if (image!=NULL)
+ {
+  image->p=cast(char*,p);
+  image->size=size;
+  image->nref=1;			/* for the loader */
+  image->unmap=unmap;
+  image->ud=ud;
+ }
+ return image;
+}
+
+void LUAU_unrefimage (LUA_State* L, Image* image)
+{
+ global_State* g=G(L);
+ if (--image->nref==0)
+ {
+  (*image->unmap)(image->ud,image->p,image->size);
+  (*g->frealloc)(g->ud,image,sizeof(Image),0);
+ }
+}
+
 #define MYINT(s)	(s[0]-'0')
 #define VERSION		MYINT(LUA_VERSION_MAJOR)*16+MYINT(LUA_VERSION_MINOR)
 #define FORMAT		0		/* this is the official format */
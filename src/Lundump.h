@@ -10,8 +10,18 @@
 #include "Lobject.h"
 #include "Lzio.h"
 
-/* load one chunk; from lundump.c */
-LUAI_FUNC Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name);
+/* load one chunk (from an image if 'image' is not NULL); from lundump.c */
+LUAI_FUNC Closure* LUAU_undump (LUA_State* L, ZIO* Z, Mbuffer* buff, const char* name, Image* image);
+
+/* load the body of a prototype left in its image; from lundump.c */
+LUAI_FUNC Proto* LUAU_materialize (LUA_State* L, Proto* f, int i);
+
+/* create and release images of chunks; from lundump.c */
+LUAI_FUNC Image* LUAU_newimage (LUA_State* L, void* p, size_t size, LUA_Unmap unmap, void* ud);
+LUAI_FUNC void LUAU_unrefimage (LUA_State* L, Image* image);
+
+#define LUAU_inimage(i,x) \
+	(cast(const char*,x)>=(i)->p && cast(const char*,x)<(i)->p+(i)->size)
 
 /* make header; from lundump.c */
 LUAI_FUNC void LUAU_header (lu_byte* h);
@@ -14,16 +14,19 @@
 
 #include "LUA.h"
 
+#include "Lapi.h"
 #include "Ldebug.h"
 #include "Ldo.h"
 #include "Lfunc.h"
 #include "Lgc.h"
+#include "Ljit.h"
 #include "Lobject.h"
 #include "Lopcodes.h"
 #include "Lstate.h"
 #include "Lstring.h"
 #include "Ltable.h"
 #include "Ltm.h"
+#include "Lundump.h"
 #include "Lvm.h"
 
 
@@ -133,13 +136,64 @@ void LUAV_gettable (LUA_State *L, const TValue *t, TValue *key, StkId val) {
 }
 
 
+/*
+** variant of 'LUAV_gettable' for a short-string key, using 'slot' as
+** a node hint for every table along the '__INDEX' chain (see
+** 'LUAH_getstrhint')
+*/
+static void gettablehint (LUA_State *L, const TValue *t, TValue *key,
+                          StkId val, int *slot) {
+  int loop;
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm;
+    if (ttistable(t)) {  /* `t' is a table? */
+      Table *h = hvalue(t);
+      const TValue *res = LUAH_getstrhint(h, rawtsvalue(key), slot);
+      if (!ttisnil(res) ||  /* result is not nil? */
+          (tm = fasttm(L, h->metatable, TM_INDEX)) == NULL) { /* or no TM? */
+        setobj2s(L, val, res);
+        return;
+      }
+      /* else will try the tag method */
+    }
+    else if (ttisnil(tm = LUAT_gettmbyobj(L, t, TM_INDEX)))
+      LUAG_typeerror(L, t, "index");
+    if (ttisfunction(tm)) {
+      callTM(L, tm, t, key, val, 1);
+      return;
+    }
+    t = tm;  /* else repeat with 'tm' */
+  }
+  LUAG_runerror(L, "loop in gettable");
+}
+
+
+/*
+** creates the inline-cache vector of a prototype (on first use)
+*/
+static void newicache (LUA_State *L, Proto *p) {
+  int *ic = LUAM_newvector(L, p->sizecode, int);
+  memset(ic, 0, p->sizecode * sizeof(int));
+  p->icache = ic;
+}
+
+
 void LUAV_settable (LUA_State *L, const TValue *t, TValue *key, StkId val) {
   int loop;
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;
     if (ttistable(t)) {  /* `t' is a table? */
       Table *h = hvalue(t);
-      TValue *oldval = cast(TValue *, LUAH_get(h, key));
+      TValue *oldval;
+#if defined(LUA_USE_PACKEDARRAYS)
+      /* numbers may be stored into (or append to) a packed array part */
+      if ((ispacked(h) || ttisnumber(val)) && ttisnumber(key) &&
+          (fasttm(L, h->metatable, TM_NEWINDEX) == NULL ||
+           !ttisnil(LUAH_get(h, key))) &&
+          LUAH_setpacked(L, h, key, val))
+        return;
+#endif
+      oldval = cast(TValue *, LUAH_get(h, key));
       /* if previous value is not nil, there must be a previous entry
          in the table; moreover, a metamethod has no relevance */
       if (!ttisnil(oldval) ||
@@ -228,10 +282,67 @@ static int l_strcmp (const TString *ls, const TString *rs) {
 }
 
 
+/*
+** compares integer 'i' with float 'f' exactly (converting 'i' to a
+** float may round it): returns -1, 0 or 1, or 2 when 'f' is NaN
+*/
+static int intfltcmp (LUA_Integer i, LUA_Number f) {
+  LUA_Number fi = cast_num(i);
+  LUA_Integer j;
+  if (LUAi_numlt(NULL, fi, f)) return -1;
+  else if (LUAi_numlt(NULL, f, fi)) return 1;
+  else if (!LUAi_numeq(fi, f)) return 2;  /* NaN */
+  else if (!(f < -cast_num(MIN_LUAINTEGER))) return -1;  /* 'i' rounded up */
+  j = cast(LUA_Integer, f);
+  return (i > j) - (i < j);
+}
+
+
+/*
+** order and equality of two numbers, of any variant
+*/
+static int numlt (LUA_State *L, const TValue *l, const TValue *r) {
+  UNUSED(L);
+  if (ttisinteger(l))
+    return ttisinteger(r) ? ivalue(l) < ivalue(r)
+                          : intfltcmp(ivalue(l), fltvalue(r)) == -1;
+  else if (ttisinteger(r))
+    return intfltcmp(ivalue(r), fltvalue(l)) == 1;
+  else
+    return LUAi_numlt(L, fltvalue(l), fltvalue(r));
+}
+
+
+static int numle (LUA_State *L, const TValue *l, const TValue *r) {
+  UNUSED(L);
+  if (ttisinteger(l))
+    return ttisinteger(r) ? ivalue(l) <= ivalue(r)
+                          : intfltcmp(ivalue(l), fltvalue(r)) <= 0;
+  else if (ttisinteger(r)) {
+    int c = intfltcmp(ivalue(r), fltvalue(l));
+    return c == 0 || c == 1;
+  }
+  else
+    return LUAi_numle(L, fltvalue(l), fltvalue(r));
+}
+
+
+static int numeq (LUA_State *L, const TValue *l, const TValue *r) {
+  UNUSED(L);
+  if (ttisinteger(l))
+    return ttisinteger(r) ? ivalue(l) == ivalue(r)
+                          : intfltcmp(ivalue(l), fltvalue(r)) == 0;
+  else if (ttisinteger(r))
+    return intfltcmp(ivalue(r), fltvalue(l)) == 0;
+  else
+    return LUAi_numeq(fltvalue(l), fltvalue(r));
+}
+
+
 int LUAV_lessthan (LUA_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttisnumber(l) && ttisnumber(r))
-    return LUAi_numlt(L, nvalue(l), nvalue(r));
+    return numlt(L, l, r);
   else if (ttisstring(l) && ttisstring(r))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) < 0;
   else if ((res = call_orderTM(L, l, r, TM_LT)) < 0)
@@ -243,7 +354,7 @@ int LUAV_lessthan (LUA_State *L, const TValue *l, const TValue *r) {
 int LUAV_lessequal (LUA_State *L, const TValue *l, const TValue *r) {
   int res;
   if (ttisnumber(l) && ttisnumber(r))
-    return LUAi_numle(L, nvalue(l), nvalue(r));
+    return numle(L, l, r);
   else if (ttisstring(l) && ttisstring(r))
     return l_strcmp(rawtsvalue(l), rawtsvalue(r)) <= 0;
   else if ((res = call_orderTM(L, l, r, TM_LE)) >= 0)  /* first try `le' */
@@ -262,7 +373,7 @@ int LUAV_equalobj_ (LUA_State *L, const TValue *t1, const TValue *t2) {
   LUA_assert(ttisequal(t1, t2));
   switch (ttype(t1)) {
     case LUA_TNIL: return 1;
-    case LUA_TNUMBER: return LUAi_numeq(nvalue(t1), nvalue(t2));
+    case LUA_TNUMFLT: case LUA_TNUMINT: return numeq(L, t1, t2);
     case LUA_TBOOLEAN: return bvalue(t1) == bvalue(t2);  /* true must be 1 !! */
     case LUA_TLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
     case LUA_TLCF: return fvalue(t1) == fvalue(t2);
@@ -290,6 +401,106 @@ int LUAV_equalobj_ (LUA_State *L, const TValue *t1, const TValue *t2) {
 }
 
 
+/*
+** computes the integer limit of a FOR loop with integer initial value
+** and step, so that no increment of the index can overflow. A float
+** limit is rounded towards the initial value; one beyond the integers
+** (which the loop would never reach) is clipped. Fails when the loop
+** must run on floats instead.
+*/
+static int forlimit (const TValue *lim, LUA_Integer init, LUA_Integer step,
+                     LUA_Integer *p) {
+  LUA_Integer l;
+  if (ttisinteger(lim))
+    l = ivalue(lim);
+  else {
+    LUA_Number f = fltvalue(lim);
+    f = (step > 0) ? l_mathop(floor)(f) : l_mathop(ceil)(f);
+    if (f >= cast_num(MIN_LUAINTEGER) && f < -cast_num(MIN_LUAINTEGER))
+      l = cast(LUA_Integer, f);
+    else if (step > 0 && f > 0)
+      l = MAX_LUAINTEGER - step;
+    else if (step < 0 && f < 0)
+      l = MIN_LUAINTEGER - step;
+    else
+      return 0;  /* NaN, or a loop that does not run */
+  }
+  if (step > 0 ? (l > MAX_LUAINTEGER - step || init < MIN_LUAINTEGER + step)
+               : (l < MIN_LUAINTEGER - step || init > MAX_LUAINTEGER + step))
+    return 0;  /* index could overflow */
+  *p = l;
+  return 1;
+}
+
+
+/*
+** prepares the control registers 'ra' (index), 'ra+1' (limit) and
+** 'ra+2' (step) of a numeric FOR loop: all integers or all floats
+*/
+void LUAV_forprep (LUA_State *L, StkId ra) {
+  const TValue *init = ra;
+  const TValue *plimit = ra+1;
+  const TValue *pstep = ra+2;
+  LUA_Integer ilimit;
+  if (!tonumber(init, ra))
+    LUAG_runerror(L, LUA_QL("FOR") " initial value must be a number");
+  else if (!tonumber(plimit, ra+1))
+    LUAG_runerror(L, LUA_QL("FOR") " limit must be a number");
+  else if (!tonumber(pstep, ra+2))
+    LUAG_runerror(L, LUA_QL("FOR") " step must be a number");
+  if (ttisinteger(init) && ttisinteger(pstep) &&
+      forlimit(plimit, ivalue(init), ivalue(pstep), &ilimit)) {
+    setivalue(ra+1, ilimit);
+    setivalue(ra, ivalue(init) - ivalue(pstep));
+  }
+  else {  /* loop runs on floats */
+    LUA_Number ninit = nvalue(init);
+    LUA_Number nstep = nvalue(pstep);
+    setnvalue(ra+1, nvalue(plimit));
+    setnvalue(ra+2, nstep);
+    setnvalue(ra, LUAi_numsub(L, ninit, nstep));
+  }
+}
+
+
+/*
+** calls the light C function 'func' (see 'LUAV_fastlcf'): the same as
+** 'LUAD_precall' plus 'LUAD_poscall', without the dispatch on the type,
+** the stack growth (and so the GC step) and the hooks
+*/
+void LUAV_calllcf (LUA_State *L, StkId func, int nresults) {
+  CallInfo *ci = next_ci(L);
+  StkId res, first;
+  int n;
+  ci->nresults = nresults;
+  ci->func = func;
+  ci->top = L->top + LUA_MINSTACK;
+  ci->callstatus = 0;
+  LUA_unlock(L);
+  n = (*fvalue(func))(L);
+  LUA_lock(L);
+  api_checknelems(L, n);
+  first = L->top - n;
+  if (L->hookmask) {  /* function set a hook? */
+    LUAD_poscall(L, first);
+    return;
+  }
+  res = ci->func;  /* (the stack may have moved) */
+  L->ci = ci->previous;
+  if (nresults == 1) {  /* usual case */
+    setobjs2s(L, res++, (n > 0) ? first : LUAO_nilobject);
+  }
+  else {
+    if (nresults == LUA_MULTRET) nresults = n;
+    for (; nresults > 0 && first < L->top; nresults--)
+      setobjs2s(L, res++, first++);
+    for (; nresults > 0; nresults--)
+      setnilvalue(res++);
+  }
+  L->top = res;
+}
+
+
 void LUAV_concat (LUA_State *L, int total) {
   LUA_assert(total >= 2);
   do {
@@ -339,11 +550,11 @@ void LUAV_objlen (LUA_State *L, StkId ra, const TValue *rb) {
       Table *h = hvalue(rb);
       tm = fasttm(L, h->metatable, TM_LEN);
       if (tm) break;  /* metamethod? break switch to call it */
-      setnvalue(ra, cast_num(LUAH_getn(h)));  /* else primitive len */
+      setivalue(ra, LUAH_getn(h));  /* else primitive len */
       return;
     }
     case LUA_TSTRING: {
-      setnvalue(ra, cast_num(tsvalue(rb)->len));
+      setivalue(ra, cast(LUA_Integer, tsvalue(rb)->len));
       return;
     }
     default: {  /* try metamethod */
@@ -363,8 +574,16 @@ void LUAV_arith (LUA_State *L, StkId ra, const TValue *rb,
   const TValue *b, *c;
   if ((b = LUAV_tonumber(rb, &tempb)) != NULL &&
       (c = LUAV_tonumber(rc, &tempc)) != NULL) {
-    LUA_Number res = LUAO_arith(op - TM_ADD + LUA_OPADD, nvalue(b), nvalue(c));
-    setnvalue(ra, res);
+    int aop = op - TM_ADD + LUA_OPADD;
+    LUA_Integer ires;
+    if (ttisinteger(b) && ttisinteger(c) &&
+        LUAO_intarith(aop, ivalue(b), ivalue(c), &ires)) {
+      setivalue(ra, ires);
+    }
+    else {
+      LUA_Number res = LUAO_arith(aop, nvalue(b), nvalue(c));
+      setnvalue(ra, res);
+    }
   }
   else if (!call_binTM(L, rb, rc, ra, op))
     LUAG_aritherror(L, rb, rc);
@@ -424,7 +643,7 @@ void LUAV_finishOp (LUA_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOP(inst);
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
     case OP_MOD: case OP_POW: case OP_UNM: case OP_LEN:
@@ -517,16 +736,251 @@ void LUAV_finishOp (LUA_State *L) {
            LUAi_threadyield(L); )
 
 
-#define arith_op(op,tm) { \
+/* rewrite the instruction being executed into opcode 'o' */
+#define quicken(o)	SET_OPCODE(*cast(Instruction *, ci->u.l.savedpc - 1), o)
+
+
+/*
+** 'ra = rb op rc' for two numbers; two integers give an integer when
+** 'iop' (one of the 'LUAi_int*' operations) gets the exact result
+*/
+#define numarith(op,iop,rb,rc) { \
+        LUA_Integer ir; \
+        if (ttisinteger(rb) && ttisinteger(rc) && \
+            iop(ivalue(rb), ivalue(rc), ir)) { \
+          setivalue(ra, ir); \
+        } \
+        else { \
+          LUA_Number nb = nvalue(rb), nc = nvalue(rc); \
+          setnvalue(ra, op(L, nb, nc)); \
+        } }
+
+/* 'iop' for operations whose result is always a float */
+#define LUAi_intnone(a,b,r)	0
+
+
+/* body of 'LUAV_fastfop' for an arithmetic operator */
+#define fop_arith(op,iop) { \
+        if (nargs < 2 || !ttisnumber(rb) || !ttisnumber(rc)) return 0; \
+        numarith(op, iop, rb, rc); \
+        return 1; }
+
+
+/*
+** Run an operator function (see 'LUAA_fops') called with 1 result
+** over operands that need no metamethods, without the call. Return 0
+** if the function must be called, -1 if it is not an operator function.
+*/
+int LUAV_fastfop (LUA_State *L, StkId func) {
+  LUA_CFunction f = fvalue(func);
+  StkId ra = func;
+  StkId rb = func + 1;
+  StkId rc = func + 2;
+  int nargs = cast_int(L->top - rb);
+  int op;
+  for (op = 0; op < FOP_N; op++)
+    if (f == LUAA_fops[op]) break;
+  switch (op) {
+    case FOP_ADD: fop_arith(LUAi_numadd, LUAi_intadd);
+    case FOP_SUB: fop_arith(LUAi_numsub, LUAi_intsub);
+    case FOP_MUL: fop_arith(LUAi_nummul, LUAi_intmul);
+    case FOP_DIV: fop_arith(LUAi_numdiv, LUAi_intnone);
+    case FOP_MOD: fop_arith(LUAi_nummod, LUAi_intmod);
+    case FOP_POW: fop_arith(LUAi_numpow, LUAi_intnone);
+    case FOP_UNM: {
+      if (nargs < 1 || !ttisnumber(rb)) return 0;
+      LUAV_arith(L, ra, rb, rb, TM_UNM);
+      return 1;
+    }
+    case FOP_IDX: {
+      const TValue *v;
+      if (nargs < 2 || !ttistable(rb)) return 0;
+      v = LUAH_get(hvalue(rb), rc);
+      if (ttisnil(v) && fasttm(L, hvalue(rb)->metatable, TM_INDEX) != NULL)
+        return 0;
+      setobj2s(L, ra, v);
+      return 1;
+    }
+    case FOP_EQ: {
+      int res;
+      if (nargs < 2 ||
+          (ttistable(rb) && ttistable(rc)) ||
+          (ttisuserdata(rb) && ttisuserdata(rc)))
+        return 0;  /* may need '__EQ' */
+      res = LUAV_rawequalobj(rb, rc);
+      setbvalue(ra, res);
+      return 1;
+    }
+    case FOP_LT: case FOP_GT: {
+      int res;
+      if (nargs < 2) return 0;
+      if (!(ttisnumber(rb) && ttisnumber(rc)) &&
+          !(ttisstring(rb) && ttisstring(rc)))
+        return 0;  /* may need '__LT' or '__LE' */
+      res = (op == FOP_LT) ? LUAV_lessthan(L, rb, rc)
+                           : !LUAV_lessequal(L, rb, rc);
+      setbvalue(ra, res);
+      return 1;
+    }
+    default: return -1;
+  }
+}
+
+
+/*
+** called by the operator functions in 'LUAA_fops': turn the OP_CALL
+** that called them (for one result) into OP_CALLFOP
+*/
+void LUAV_quickenfop (LUA_State *L) {
+  CallInfo *ci = L->ci->previous;
+  if (isLUA(ci)) {
+    Instruction *pc = cast(Instruction *, ci->u.l.savedpc - 1);
+    if (GET_OPCODE(*pc) == OP_CALL && GETARG_C(*pc) == 2)
+      SET_OPCODE(*pc, OP_CALLFOP);
+  }
+}
+
+
+#define arith_op(op,iop,tm,qop) { \
         TValue *rb = RKB(i); \
         TValue *rc = RKC(i); \
         if (ttisnumber(rb) && ttisnumber(rc)) { \
-          LUA_Number nb = nvalue(rb), nc = nvalue(rc); \
-          setnvalue(ra, op(L, nb, nc)); \
+          numarith(op, iop, rb, rc); \
+          quicken(qop); \
         } \
         else { Protect(LUAV_arith(L, ra, rb, rc, tm)); } }
 
 
+/* quickened form of 'arith_op'; 'bop' is the original opcode */
+#define arith_opnum(op,iop,tm,bop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) { \
+          numarith(op, iop, rb, rc); \
+        } \
+        else { quicken(bop); Protect(LUAV_arith(L, ra, rb, rc, tm)); } }
+
+
+/* quickened form of a comparison; 'bop' is the original opcode */
+#define cmp_opnum(op,bop) { \
+        TValue *rb = RKB(i); \
+        TValue *rc = RKC(i); \
+        if (ttisnumber(rb) && ttisnumber(rc)) { \
+          if (op(L, rb, rc) != GETARG_A(i)) \
+            ci->u.l.savedpc++; \
+          else \
+            donextjump(ci); \
+        } \
+        else { quicken(bop); goto l_##bop; } }
+
+
+/*
+** second half of a fused opcode: unless hooks need to see it, fetch
+** the next instruction (which is kept intact) and run it here
+*/
+#define fusednext() \
+  (!(L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+   (i = *(ci->u.l.savedpc++), ra = RA(i), 1))
+
+
+/* fetch an instruction and prepare its execution */
+#define vmfetch()	{ \
+  i = *(ci->u.l.savedpc++); \
+  if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) && \
+      (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) { \
+    Protect(traceexec(L)); \
+  } \
+  /* WARNING: several calls may realloc the stack and invalidate `ra' */ \
+  ra = RA(i); \
+  LUA_assert(base == ci->u.l.base); \
+  LUA_assert(base <= L->top && L->top < L->stack + L->stacksize); \
+}
+
+#if defined(LUA_USE_SHAPES)
+/* field of record 'h' at hint 's' if it holds key 'k', or NULL */
+#define hintedfield(h,s,k) \
+  ((h)->shape != NULL && \
+   cast(unsigned int, s) < cast(unsigned int, (h)->shape->nkeys) && \
+   (h)->shape->keys[s] == (k) && !ttisnil(&(h)->fields[s]) \
+     ? &(h)->fields[s] : NULL)
+#else
+#define hintedfield(h,s,k)	cast(const TValue *, NULL)
+#endif
+
+/* access to the element at integer key 'k' of a packed array part */
+#if defined(LUA_USE_PACKEDARRAYS)
+#define inpacked(h,k)	\
+	(ispacked(h) && l_castU(k) + 1 < cast(size_t, (h)->npacked))
+#define getpacked(h,k,v) \
+  { TValue *io_ = (v); \
+    val_(io_) = packedarray(h)[(k) + 1]; settt_(io_, (h)->packed); }
+#define packedkind(h,v)	(rttype(v) == (h)->packed)
+#define setpacked(h,k,v)	(packedarray(h)[(k) + 1] = val_(v))
+#else
+#define inpacked(h,k)	0
+#define packedkind(h,v)	0
+#define getpacked(h,k,v)	{ }
+#define setpacked(h,k,v)	((void)0)
+#endif
+
+/*
+** table access with a constant key; a short-string key uses the
+** inline cache of the instruction, trying its hinted field or node in
+** place before going through 'gettablehint'
+*/
+#define gettableK(t,i,v) { \
+  const TValue *t_ = (t); \
+  TValue *rc = RKC(i); \
+  if (ttisshrstring(rc)) { \
+    int *slot; \
+    const TValue *f_; \
+    if (cl->p->icache == NULL) Protect(newicache(L, cl->p)); \
+    slot = &cl->p->icache[pcRel(ci->u.l.savedpc, cl->p)]; \
+    if (ttistable(t_) && \
+        (f_ = hintedfield(hvalue(t_), *slot, rawtsvalue(rc))) != NULL) { \
+      setobj2s(L, v, f_); \
+    } \
+    else if (ttistable(t_) && \
+        cast(unsigned int, *slot) < cast(unsigned int, sizenode(hvalue(t_))) && \
+        ttisshrstring(gkey(gnode(hvalue(t_), *slot))) && \
+        rawtsvalue(gkey(gnode(hvalue(t_), *slot))) == rawtsvalue(rc) && \
+        !ttisnil(gval(gnode(hvalue(t_), *slot)))) { \
+      setobj2s(L, v, gval(gnode(hvalue(t_), *slot))); \
+    } \
+    else Protect(gettablehint(L, t_, rc, v, slot)); \
+  } \
+  else if (ttisinteger(rc) && ttistable(t_) && !ispacked(hvalue(t_)) && \
+           l_castU(ivalue(rc)) + 1 < cast(size_t, hvalue(t_)->sizearray) && \
+           !ttisnil(&hvalue(t_)->array[ivalue(rc) + 1])) { \
+    setobj2s(L, v, &hvalue(t_)->array[ivalue(rc) + 1]); \
+  } \
+  else if (ttisinteger(rc) && ttistable(t_) && \
+           inpacked(hvalue(t_), ivalue(rc))) { \
+    getpacked(hvalue(t_), ivalue(rc), v); \
+  } \
+  else Protect(LUAV_gettable(L, t_, rc, v)); }
+
+
+#if defined(LUA_USE_JIT)
+/*
+** run native code for the current frame if its prototype is hot
+** (counting one more event for it); used on frame changes and on loop
+** back edges
+*/
+#define jitenter() \
+  if (L->hookmask == 0 && LUAJ_ishot(L, cl->p)) { \
+    if (LUAJ_run(L, ci, cl)) {  /* stopped on a call to a LUA function? */ \
+      ci = L->ci; \
+      ci->callstatus |= CIST_REENTRY; \
+      goto newframe; \
+    } \
+    base = ci->u.l.base; \
+  }
+#else
+#define jitenter()	((void)0)
+#endif
+
+
 #define vmdispatch(o)	switch(o)
 #define vmcase(l,b)	case l: {b}  break;
 #define vmcasenb(l,b)	case l: {b}		/* nb = no break */
@@ -536,23 +990,20 @@ void LUAV_execute (LUA_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if defined(LUA_USE_JUMPTABLE)
+#include "Ljumptab.h"
+#endif
  newframe:  /* reentry point when frame changes (call/return) */
   LUA_assert(ci == L->ci);
   cl = clLvalue(ci->func);
   k = cl->p->k;
   base = ci->u.l.base;
+  jitenter();
   /* main loop of interpreter */
   for (;;) {
-    Instruction i = *(ci->u.l.savedpc++);
+    Instruction i;
     StkId ra;
-    if ((L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) &&
-        (--L->hookcount == 0 || L->hookmask & LUA_MASKLINE)) {
-      Protect(traceexec(L));
-    }
-    /* WARNING: several calls may realloc the stack and invalidate `ra' */
-    ra = RA(i);
-    LUA_assert(base == ci->u.l.base);
-    LUA_assert(base <= L->top && L->top < L->stack + L->stacksize);
+    vmfetch();
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE,
         setobjs2s(L, ra, RB(i));
@@ -583,10 +1034,10 @@ void LUAV_execute (LUA_State *L) {
       )
       vmcase(OP_GETTABUP,
         int b = GETARG_B(i);
-        Protect(LUAV_gettable(L, cl->upvals[b]->v, RKC(i), ra));
+        gettableK(cl->upvals[b]->v, i, ra);
       )
       vmcase(OP_GETTABLE,
-        Protect(LUAV_gettable(L, RB(i), RKC(i), ra));
+        gettableK(RB(i), i, ra);
       )
       vmcase(OP_SETTABUP,
         int a = GETARG_A(i);
@@ -598,7 +1049,21 @@ void LUAV_execute (LUA_State *L) {
         LUAC_barrier(L, uv, ra);
       )
       vmcase(OP_SETTABLE,
-        Protect(LUAV_settable(L, ra, RKB(i), RKC(i)));
+        TValue *rb = RKB(i);
+        if (ttistable(ra) && ttisinteger(rb) &&  /* existing array entry? */
+            !ispacked(hvalue(ra)) &&
+            l_castU(ivalue(rb)) + 1 < cast(size_t, hvalue(ra)->sizearray) &&
+            !ttisnil(&hvalue(ra)->array[ivalue(rb) + 1])) {
+          TValue *rc = RKC(i);
+          setobj2t(L, &hvalue(ra)->array[ivalue(rb) + 1], rc);
+          LUAC_barrierback(L, obj2gco(hvalue(ra)), rc);
+        }
+        else if (ttistable(ra) && ttisinteger(rb) &&  /* same kind? */
+                 inpacked(hvalue(ra), ivalue(rb)) &&
+                 packedkind(hvalue(ra), RKC(i))) {
+          setpacked(hvalue(ra), ivalue(rb), RKC(i));
+        }
+        else Protect(LUAV_settable(L, ra, rb, RKC(i)));
       )
       vmcase(OP_NEWTABLE,
         int b = GETARG_B(i);
@@ -609,32 +1074,47 @@ void LUAV_execute (LUA_State *L) {
           LUAH_resize(L, t, LUAO_fb2int(b), LUAO_fb2int(c));
         checkGC(L, ra + 1);
       )
+      vmcase(OP_NEWTABLEK,
+        int bx = GETARG_Bx(i);
+        Table *t = LUAH_new(L);
+        sethvalue(L, ra, t);
+        if (bx == MAXARG_Bx) {
+          LUA_assert(GET_OPCODE(*ci->u.l.savedpc) == OP_EXTRAARG);
+          bx = GETARG_Ax(*ci->u.l.savedpc++);
+        }
+        LUAH_copy(L, t, hvalue(k + bx));
+        checkGC(L, ra + 1);
+      )
       vmcase(OP_SELF,
         StkId rb = RB(i);
         setobjs2s(L, ra+1, rb);
-        Protect(LUAV_gettable(L, rb, RKC(i), ra));
+        gettableK(rb, i, ra);
       )
       vmcase(OP_ADD,
-        arith_op(LUAi_numadd, TM_ADD);
+        arith_op(LUAi_numadd, LUAi_intadd, TM_ADD, OP_ADDNUM);
       )
       vmcase(OP_SUB,
-        arith_op(LUAi_numsub, TM_SUB);
+        arith_op(LUAi_numsub, LUAi_intsub, TM_SUB, OP_SUBNUM);
       )
       vmcase(OP_MUL,
-        arith_op(LUAi_nummul, TM_MUL);
+        arith_op(LUAi_nummul, LUAi_intmul, TM_MUL, OP_MULNUM);
       )
       vmcase(OP_DIV,
-        arith_op(LUAi_numdiv, TM_DIV);
+        arith_op(LUAi_numdiv, LUAi_intnone, TM_DIV, OP_DIVNUM);
       )
       vmcase(OP_MOD,
-        arith_op(LUAi_nummod, TM_MOD);
+        arith_op(LUAi_nummod, LUAi_intmod, TM_MOD, OP_MODNUM);
       )
       vmcase(OP_POW,
-        arith_op(LUAi_numpow, TM_POW);
+        arith_op(LUAi_numpow, LUAi_intnone, TM_POW, OP_POWNUM);
       )
       vmcase(OP_UNM,
         TValue *rb = RB(i);
-        if (ttisnumber(rb)) {
+        LUA_Integer ir;
+        if (ttisinteger(rb) && LUAi_intunm(ivalue(rb), ir)) {
+          setivalue(ra, ir);
+        }
+        else if (ttisnumber(rb)) {
           LUA_Number nb = nvalue(rb);
           setnvalue(ra, LUAi_numunm(L, nb));
         }
@@ -664,10 +1144,15 @@ void LUAV_execute (LUA_State *L) {
       )
       vmcase(OP_JMP,
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0) jitenter();
       )
       vmcase(OP_EQ,
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
+        TValue *rb;
+        TValue *rc;
+        l_OP_EQ:
+        rb = RKB(i);
+        rc = RKC(i);
+        if (ttisnumber(rb) && ttisnumber(rc)) quicken(OP_EQNUM);
         Protect(
           if (cast_int(equalobj(L, rb, rc)) != GETARG_A(i))
             ci->u.l.savedpc++;
@@ -676,6 +1161,8 @@ void LUAV_execute (LUA_State *L) {
         )
       )
       vmcase(OP_LT,
+        l_OP_LT:
+        if (ttisnumber(RKB(i)) && ttisnumber(RKC(i))) quicken(OP_LTNUM);
         Protect(
           if (LUAV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
             ci->u.l.savedpc++;
@@ -684,6 +1171,8 @@ void LUAV_execute (LUA_State *L) {
         )
       )
       vmcase(OP_LE,
+        l_OP_LE:
+        if (ttisnumber(RKB(i)) && ttisnumber(RKC(i))) quicken(OP_LENUM);
         Protect(
           if (LUAV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
             ci->u.l.savedpc++;
@@ -707,10 +1196,18 @@ void LUAV_execute (LUA_State *L) {
         }
       )
       vmcase(OP_CALL,
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
+        int b;
+        int nresults;
+        l_OP_CALL:
+        b = GETARG_B(i);
+        nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
-        if (LUAD_precall(L, ra, nresults)) {  /* C function? */
+        if (LUAV_fastlcf(L, ra)) {
+          LUAV_calllcf(L, ra, nresults);
+          if (nresults >= 0) L->top = ci->top;  /* adjust results */
+          base = ci->u.l.base;
+        }
+        else if (LUAD_precall(L, ra, nresults)) {  /* C function? */
           if (nresults >= 0) L->top = ci->top;  /* adjust results */
           base = ci->u.l.base;
         }
@@ -753,6 +1250,26 @@ void LUAV_execute (LUA_State *L) {
         int b = GETARG_B(i);
         if (b != 0) L->top = ra+b-1;
         if (cl->p->sizep > 0) LUAF_close(L, base);
+        if ((ci->callstatus & CIST_REENTRY) && L->hookmask == 0) {
+          /* back to a LUA caller: 'LUAD_poscall' without the hooks */
+          StkId res = ci->func;
+          int wanted = ci->nresults;
+          L->ci = ci = ci->previous;
+          if (wanted == LUA_MULTRET) {
+            while (ra < L->top)
+              setobjs2s(L, res++, ra++);
+            L->top = res;
+          }
+          else {
+            for (; wanted > 0 && ra < L->top; wanted--)
+              setobjs2s(L, res++, ra++);
+            for (; wanted > 0; wanted--)
+              setnilvalue(res++);
+            L->top = ci->top;
+          }
+          LUA_assert(GET_OPCODE(*((ci)->u.l.savedpc - 1)) == OP_CALL);
+          goto newframe;  /* restart LUAV_execute over new LUA function */
+        }
         b = LUAD_poscall(L, ra);
         if (!(ci->callstatus & CIST_REENTRY))  /* 'ci' still the called one */
           return;  /* external invocation: return */
@@ -765,27 +1282,32 @@ void LUAV_execute (LUA_State *L) {
         }
       )
       vmcase(OP_FORLOOP,
-        LUA_Number step = nvalue(ra+2);
-        LUA_Number idx = LUAi_numadd(L, nvalue(ra), step); /* increment index */
-        LUA_Number limit = nvalue(ra+1);
-        if (LUAi_numlt(L, 0, step) ? LUAi_numle(L, idx, limit)
-                                   : LUAi_numle(L, limit, idx)) {
-          ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
-          setnvalue(ra, idx);  /* update internal index... */
-          setnvalue(ra+3, idx);  /* ...and external index */
+        if (ttisinteger(ra)) {  /* integer loop? */
+          LUA_Integer step = ivalue(ra+2);
+          LUA_Integer idx = ivalue(ra) + step;  /* cannot overflow */
+          LUA_Integer limit = ivalue(ra+1);
+          if (0 < step ? idx <= limit : limit <= idx) {
+            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+            setivalue(ra, idx);  /* update internal index... */
+            setivalue(ra+3, idx);  /* ...and external index */
+            jitenter();
+          }
+        }
+        else {
+          LUA_Number step = fltvalue(ra+2);
+          LUA_Number idx = LUAi_numadd(L, fltvalue(ra), step); /* increment */
+          LUA_Number limit = fltvalue(ra+1);
+          if (LUAi_numlt(L, 0, step) ? LUAi_numle(L, idx, limit)
+                                     : LUAi_numle(L, limit, idx)) {
+            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+            setnvalue(ra, idx);  /* update internal index... */
+            setnvalue(ra+3, idx);  /* ...and external index */
+            jitenter();
+          }
         }
       )
       vmcase(OP_FORPREP,
-        const TValue *init = ra;
-        const TValue *plimit = ra+1;
-        const TValue *pstep = ra+2;
-        if (!tonumber(init, ra))
-          LUAG_runerror(L, LUA_QL("FOR") " initial value must be a number");
-        else if (!tonumber(plimit, ra+1))
-          LUAG_runerror(L, LUA_QL("FOR") " limit must be a number");
-        else if (!tonumber(pstep, ra+2))
-          LUAG_runerror(L, LUA_QL("FOR") " step must be a number");
-        setnvalue(ra, LUAi_numsub(L, nvalue(ra), nvalue(pstep)));
+        LUAV_forprep(L, ra);
         ci->u.l.savedpc += GETARG_sBx(i);
       )
       vmcasenb(OP_TFORCALL,
@@ -806,6 +1328,7 @@ void LUAV_execute (LUA_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           jitenter();
         }
       )
       vmcase(OP_SETLIST,
@@ -821,18 +1344,28 @@ void LUAV_execute (LUA_State *L) {
         LUAi_runtimecheck(L, ttistable(ra));
         h = hvalue(ra);
         last = ((c-1)*LFIELDS_PER_FLUSH) + n - 2;
-        if (last > h->sizearray)  /* needs more space? */
-          LUAH_resizearray(L, h, last);  /* pre-allocate it at once */
-        for (; n > 0; n--) {
+#if defined(LUA_USE_PACKEDARRAYS)
+        if (ispacked(h))
+          LUAH_unpack(L, h);  /* items are stored in place */
+#endif
+        if (last + 2 > h->sizearray)  /* needs more space? */
+          LUAH_resizearray(L, h, last + 2);  /* pre-allocate it at once */
+        for (; n > 0; n--) {  /* all items go to the array part */
           TValue *val = ra+n;
-          LUAH_setint(L, h, last--, val);
+          setobj2t(L, &h->array[last + 1], val);  /* (array starts at -1) */
+          last--;
           LUAC_barrierback(L, obj2gco(h), val);
         }
         L->top = ci->top;  /* correct top (in case of previous open call) */
       )
       vmcase(OP_CLOSURE,
         Proto *p = cl->p->p[GETARG_Bx(i)];
-        Closure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
+        Closure *ncl;
+        if (p->lazy != NULL) {  /* still in its image? */
+          Protect(p = LUAU_materialize(L, cl->p, GETARG_Bx(i)));
+          ra = RA(i);  /* stack may have changed */
+        }
+        ncl = getcached(p, cl->upvals, base);  /* cached closure */
         if (ncl == NULL)  /* no match? */
           pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
         else
@@ -843,6 +1376,7 @@ void LUAV_execute (LUA_State *L) {
         int b = GETARG_B(i) - 1;
         int j;
         int n = cast_int(base - ci->func) - cl->p->numparams - 1;
+        if (n < 0) n = 0;  /* called with no extra arguments */
         if (b < 0) {  /* B == 0? */
           b = n;  /* get all var. arguments */
           Protect(LUAD_checkstack(L, n));
@@ -861,6 +1395,59 @@ void LUAV_execute (LUA_State *L) {
       vmcase(OP_EXTRAARG,
         LUA_assert(0);
       )
+      vmcase(OP_ADDNUM,
+        arith_opnum(LUAi_numadd, LUAi_intadd, TM_ADD, OP_ADD);
+      )
+      vmcase(OP_SUBNUM,
+        arith_opnum(LUAi_numsub, LUAi_intsub, TM_SUB, OP_SUB);
+      )
+      vmcase(OP_MULNUM,
+        arith_opnum(LUAi_nummul, LUAi_intmul, TM_MUL, OP_MUL);
+      )
+      vmcase(OP_DIVNUM,
+        arith_opnum(LUAi_numdiv, LUAi_intnone, TM_DIV, OP_DIV);
+      )
+      vmcase(OP_MODNUM,
+        arith_opnum(LUAi_nummod, LUAi_intmod, TM_MOD, OP_MOD);
+      )
+      vmcase(OP_POWNUM,
+        arith_opnum(LUAi_numpow, LUAi_intnone, TM_POW, OP_POW);
+      )
+      vmcase(OP_EQNUM,
+        cmp_opnum(numeq, OP_EQ);
+      )
+      vmcase(OP_LTNUM,
+        cmp_opnum(numlt, OP_LT);
+      )
+      vmcase(OP_LENUM,
+        cmp_opnum(numle, OP_LE);
+      )
+      vmcase(OP_CALLFOP,
+        int b = GETARG_B(i);
+        int res = -1;
+        if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+        if (ttislcf(ra) && L->hookmask == 0 && (res = LUAV_fastfop(L, ra)) > 0)
+          L->top = ci->top;  /* done without a call */
+        else {
+          if (res < 0) quicken(OP_CALL);  /* not an operator function */
+          goto l_OP_CALL;
+        }
+      )
+      vmcase(OP_GETTABUP2,
+        int b = GETARG_B(i);
+        gettableK(cl->upvals[b]->v, i, ra);
+        if (fusednext()) {
+          LUA_assert(GET_BASEOP(i) == OP_GETTABLE);
+          gettableK(RB(i), i, ra);
+        }
+      )
+      vmcase(OP_GETTABLE2,
+        gettableK(RB(i), i, ra);
+        if (fusednext()) {
+          LUA_assert(GET_BASEOP(i) == OP_GETTABLE);
+          gettableK(RB(i), i, ra);
+        }
+      )
     }
   }
 }
@@ -40,5 +40,14 @@ LUAI_FUNC void LUAV_concat (LUA_State *L, int total);
 LUAI_FUNC void LUAV_arith (LUA_State *L, StkId ra, const TValue *rb,
                            const TValue *rc, TMS op);
 LUAI_FUNC void LUAV_objlen (LUA_State *L, StkId ra, const TValue *rb);
+LUAI_FUNC void LUAV_forprep (LUA_State *L, StkId ra);
+
+/* whether a call to 'f' can take the lean path for light C functions */
+#define LUAV_fastlcf(L,f)	(ttislcf(f) && (L)->hookmask == 0 && \
+				 (L)->stack_last - (L)->top > LUA_MINSTACK)
+
+LUAI_FUNC void LUAV_calllcf (LUA_State *L, StkId func, int nresults);
+LUAI_FUNC int LUAV_fastfop (LUA_State *L, StkId func);
+LUAI_FUNC void LUAV_quickenfop (LUA_State *L);
 
 #endif